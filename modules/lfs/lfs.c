@@ -8,6 +8,8 @@
 **   lfs.chdir (path)
 **   lfs.currentdir ()
 **   lfs.dir (path)
+**   lfs.dirx (path [, attributes [, reuse]])
+**   lfs.hash (filepath [, algorithm [, threads]])
 **   lfs.lock (fh, mode)
 **   lfs.lock_dir (path)
 **   lfs.mkdir (path)
@@ -16,6 +18,7 @@
 **   lfs.symlinkattributes (filepath [, attributename]) -- thanks to Sam Roberts
 **   lfs.touch (filepath [, atime [, mtime]])
 **   lfs.unlock (fh)
+**   lfs.walk (path [, options])
 **
 ** $Id: lfs.c,v 1.61 2009/07/04 02:10:16 mascarenhas Exp $
 */
@@ -31,9 +34,11 @@
 #define _LARGEFILE64_SOURCE
 
 #include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/stat.h>
 
@@ -56,6 +61,10 @@
 #include <utime.h>
 #endif
 
+#ifdef LFS_THREADS
+#include <pthread.h>
+#endif
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "lualib.h"
@@ -761,6 +770,1291 @@ static int link_info (lua_State *L) {
 #endif
 
 
+/*
+** Matches a shell glob against a file name: '*' and '?' match any run
+** of characters and any single character, '[...]' a character class
+** (negated by a leading '!' or '^') and '\' quotes the next character.
+*/
+static const char *glob_class (const char *p, int c) {
+	int neg = 0, found = 0;
+	if (*p == '!' || *p == '^') {
+		neg = 1;
+		p++;
+	}
+	do {
+		if (*p == '\0')
+			return NULL; /* unterminated class matches nothing */
+		if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+			if ((unsigned char)p[0] <= c && c <= (unsigned char)p[2])
+				found = 1;
+			p += 3;
+		} else {
+			if ((unsigned char)*p == c)
+				found = 1;
+			p++;
+		}
+	} while (*p != ']');
+	return found != neg ? p + 1 : NULL;
+}
+
+static int glob_match (const char *p, const char *s) {
+	const char *star = NULL, *back = NULL;
+	while (*s) {
+		const char *next = NULL;
+		if (*p == '*') {
+			star = ++p;
+			back = s;
+			continue;
+		}
+		if (*p == '?')
+			next = p + 1;
+		else if (*p == '[')
+			next = glob_class (p + 1, (unsigned char)*s);
+		else if (*p == '\\' && p[1] != '\0') {
+			if (p[1] == *s)
+				next = p + 2;
+		} else if (*p != '\0' && *p == *s)
+			next = p + 1;
+		if (next) {
+			p = next;
+			s++;
+		} else if (star) {
+			/* let the last '*' swallow one more character */
+			p = star;
+			s = ++back;
+		} else
+			return 0;
+	}
+	while (*p == '*')
+		p++;
+	return *p == '\0';
+}
+
+
+/*
+** Jobs of lfs.walk and lfs.hash. Built with LFS_THREADS, they are shared
+** out among worker threads, the calling one included; otherwise they run
+** in turn. Jobs must not touch the Lua state.
+*/
+#define LFS_MAXTHREADS 64
+
+typedef struct job_queue {
+	void (*run) (void *ud, int slot, int i); /* runs job i with the buffers of 'slot' */
+	void *ud;
+	int n;           /* number of jobs */
+	int next, slots; /* next job and next slot to hand out */
+#ifdef LFS_THREADS
+	pthread_mutex_t lock;
+#endif
+} job_queue;
+
+/*
+** Gives the number of threads for 'n' jobs, and so of slots: from 1 up to
+** 'threads', always 1 without LFS_THREADS.
+*/
+static int job_threads (int threads, int n) {
+#ifdef LFS_THREADS
+	if (threads > LFS_MAXTHREADS)
+		threads = LFS_MAXTHREADS;
+	if (threads > n)
+		threads = n;
+	return threads > 1 ? threads : 1;
+#else
+	(void)threads;
+	(void)n;
+	return 1;
+#endif
+}
+
+#ifdef LFS_THREADS
+static void *job_worker (void *arg) {
+	job_queue *q = (job_queue *)arg;
+	int slot, i;
+	pthread_mutex_lock (&q->lock);
+	slot = q->slots++;
+	pthread_mutex_unlock (&q->lock);
+	for (;;) {
+		pthread_mutex_lock (&q->lock);
+		i = q->next < q->n ? q->next++ : -1;
+		pthread_mutex_unlock (&q->lock);
+		if (i < 0)
+			return NULL;
+		q->run (q->ud, slot, i);
+	}
+}
+#endif
+
+/*
+** Runs all jobs on the number of threads given by job_threads, and waits
+** for them. Threads that can't be started leave their share to the others.
+*/
+static void job_run (job_queue *q, int threads) {
+	int i;
+#ifdef LFS_THREADS
+	pthread_t tid[LFS_MAXTHREADS];
+	int started = 0;
+	if (threads > 1 && pthread_mutex_init (&q->lock, NULL) == 0) {
+		q->next = q->slots = 0;
+		for (i = 1; i < threads; i++)
+			if (pthread_create (&tid[started], NULL, job_worker, q) == 0)
+				started++;
+		job_worker (q);
+		while (started > 0)
+			pthread_join (tid[--started], NULL);
+		pthread_mutex_destroy (&q->lock);
+		return;
+	}
+#else
+	(void)threads;
+#endif
+	for (i = 0; i < q->n; i++)
+		q->run (q->ud, 0, i);
+}
+
+
+#ifndef _WIN32
+#ifndef O_DIRECTORY
+#define O_DIRECTORY 0
+#endif
+#ifndef O_NOFOLLOW
+#define O_NOFOLLOW 0
+#endif
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#define WALK_METATABLE "walk metatable"
+#define WALK_BATCH 256
+
+/* one open directory on the walker's stack */
+typedef struct walk_frame {
+	DIR *dir;
+	size_t pathlen;  /* length of its path in the walker's buffer */
+	dev_t dev;       /* identity, checked for loops when following links */
+	ino_t ino;
+} walk_frame;
+
+/* an entry read by a worker thread: offset of its name and what to do with it */
+typedef struct walk_entry {
+	size_t name;
+	const char *mode;
+	int report, descend;
+} walk_entry;
+
+/*
+** A directory of a threaded walk. Its path and entries are freed once
+** drained, the node itself only with the walker since its descendants
+** check it for loops.
+*/
+typedef struct walk_node {
+	struct walk_node *parent;
+	struct walk_node *next;  /* in the stack of pending directories */
+	struct walk_node *all;   /* in the list of all of them */
+	DIR *dir;                /* the root, opened by the factory */
+	char *path;
+	int depth;
+	dev_t dev;
+	ino_t ino;
+	char *names;             /* NUL separated entry names */
+	size_t namelen, namesize;
+	walk_entry *entries;
+	int n, size;
+	int err;                 /* ENOMEM if the entries were cut short */
+} walk_node;
+
+#define WALK_ROUND 4 /* directories read per thread in a round */
+
+typedef struct walk_data {
+	int closed;
+	walk_frame *stack;
+	int depth, stacksize;
+	char *path;
+	size_t pathsize;
+	char *include, *exclude; /* NUL separated globs, NULL if none */
+	int maxdepth, follow, dirs, batch;
+	int threads;             /* more than one to read directories on worker threads */
+	walk_node *pending, *nodes;
+	walk_node **round;       /* directories read by the last round */
+	int nround, cur, entry;  /* their number, and the next entry to drain */
+} walk_data;
+
+/*
+** Checks a name against a list of globs.
+*/
+static int walk_matches (const char *globs, const char *name) {
+	for (; *globs; globs += strlen (globs) + 1)
+		if (glob_match (globs, name))
+			return 1;
+	return 0;
+}
+
+/*
+** Reads the string or list of strings in field 'key' of the options
+** table into a NUL separated list of globs ended by an empty string.
+*/
+static char *walk_globs (lua_State *L, const char *key) {
+	size_t size = 1, len;
+	char *globs, *g;
+	int i, n, t;
+	lua_getfield (L, 2, key);
+	t = lua_gettop (L);
+	if (lua_isnil (L, t)) {
+		lua_pop (L, 1);
+		return NULL;
+	}
+	if (lua_isstring (L, t)) {
+		lua_pushvalue (L, t);
+		n = 1;
+	} else {
+		luaL_argcheck (L, lua_istable (L, t), 2, "globs must be a string or a list");
+		n = (int)lua_rawlen (L, t);
+		luaL_checkstack (L, n, "too many globs");
+		for (i = 1; i <= n; i++)
+			lua_rawgeti (L, t, i);
+	}
+	for (i = 1; i <= n; i++) {
+		luaL_argcheck (L, lua_isstring (L, t + i), 2, "globs must be strings");
+		lua_tolstring (L, t + i, &len);
+		size += len + 1;
+	}
+	if ((globs = g = (char *)malloc (size)) == NULL)
+		luaL_error (L, "not enough memory");
+	for (i = 1; i <= n; i++) {
+		const char *s = lua_tolstring (L, t + i, &len);
+		memcpy (g, s, len + 1);
+		g += len + 1;
+	}
+	*g = '\0';
+	lua_settop (L, t - 1);
+	return globs;
+}
+
+/*
+** Appends "/name" to the path of the directory whose path is the first
+** 'len' bytes of the buffer.
+*/
+static size_t walk_append (lua_State *L, walk_data *w, size_t len, const char *name) {
+	size_t namelen = strlen (name);
+	if (len + namelen + 2 > w->pathsize) {
+		size_t size = 2 * (len + namelen + 2);
+		char *path = (char *)realloc (w->path, size);
+		if (path == NULL)
+			luaL_error (L, "not enough memory");
+		w->path = path;
+		w->pathsize = size;
+	}
+	if (len > 0 && w->path[len - 1] != '/')
+		w->path[len++] = '/';
+	memcpy (w->path + len, name, namelen + 1);
+	return len + namelen;
+}
+
+/*
+** Pushes an open directory, refusing ones already on the stack when
+** symbolic links are followed.
+*/
+static void walk_push (lua_State *L, walk_data *w, DIR *dir, size_t pathlen) {
+	STAT_STRUCT info;
+	walk_frame *f;
+	if (w->follow) {
+		int i;
+		if (fstat (dirfd (dir), &info)) {
+			closedir (dir);
+			return;
+		}
+		for (i = 0; i < w->depth; i++)
+			if (w->stack[i].dev == info.st_dev && w->stack[i].ino == info.st_ino) {
+				closedir (dir);
+				return;
+			}
+	}
+	if (w->depth == w->stacksize) {
+		int size = w->stacksize ? 2 * w->stacksize : 16;
+		f = (walk_frame *)realloc (w->stack, size * sizeof(walk_frame));
+		if (f == NULL) {
+			closedir (dir);
+			luaL_error (L, "not enough memory");
+		}
+		w->stack = f;
+		w->stacksize = size;
+	}
+	f = &w->stack[w->depth++];
+	f->dir = dir;
+	f->pathlen = pathlen;
+	if (w->follow) {
+		f->dev = info.st_dev;
+		f->ino = info.st_ino;
+	}
+}
+
+/*
+** Gives the mode of a directory entry from the d_type filled in by readdir,
+** or NULL when the file system leaves it unknown or when the entry is a
+** link that is to be followed.
+*/
+static const char *dirent_mode (struct dirent *entry, int follow) {
+#ifdef DT_DIR
+	switch (entry->d_type) {
+		case DT_REG: return "file";
+		case DT_DIR: return "directory";
+		case DT_LNK: return follow ? NULL : "link";
+		case DT_SOCK: return "socket";
+		case DT_FIFO: return "named pipe";
+		case DT_CHR: return "char device";
+		case DT_BLK: return "block device";
+	}
+#endif
+	return NULL;
+}
+
+/*
+** Stats a directory entry relative to its directory. When following links,
+** dangling ones are reported as links.
+*/
+static int dirent_stat (DIR *dir, const char *name, STAT_STRUCT *info, int follow) {
+	if (fstatat (dirfd (dir), name, info, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0)
+		return 0;
+	return follow ? fstatat (dirfd (dir), name, info, AT_SYMLINK_NOFOLLOW) : -1;
+}
+
+/*
+** Finds the type of a directory entry, with fstatat only when readdir
+** does not tell. Returns NULL for entries that vanished meanwhile.
+*/
+static const char *walk_type (walk_data *w, DIR *dir, struct dirent *entry, int *isdir) {
+	STAT_STRUCT info;
+	const char *mode = dirent_mode (entry, w->follow);
+	if (mode) {
+		*isdir = *mode == 'd';
+		return mode;
+	}
+	if (dirent_stat (dir, entry->d_name, &info, w->follow))
+		return NULL;
+	*isdir = S_ISDIR (info.st_mode);
+	return mode2string (info.st_mode);
+}
+
+/*
+** Appends an entry to a directory read by a worker. Returns -1 when out
+** of memory.
+*/
+static int walk_add (walk_node *d, const char *name, const char *mode, int report, int descend) {
+	size_t len = strlen (name) + 1;
+	walk_entry *e;
+	if (d->namelen + len > d->namesize) {
+		size_t size = 2 * (d->namelen + len) + 256;
+		char *names = (char *)realloc (d->names, size);
+		if (names == NULL)
+			return -1;
+		d->names = names;
+		d->namesize = size;
+	}
+	if (d->n == d->size) {
+		int size = d->size ? 2 * d->size : 16;
+		e = (walk_entry *)realloc (d->entries, size * sizeof(walk_entry));
+		if (e == NULL)
+			return -1;
+		d->entries = e;
+		d->size = size;
+	}
+	e = &d->entries[d->n++];
+	e->name = d->namelen;
+	e->mode = mode;
+	e->report = report;
+	e->descend = descend;
+	memcpy (d->names + d->namelen, name, len);
+	d->namelen += len;
+	return 0;
+}
+
+/*
+** Job of a threaded walk: reads directory 'i' of the round, refusing
+** ones that are their own ancestors when symbolic links are followed.
+*/
+static void walk_read (void *ud, int slot, int i) {
+	walk_data *w = (walk_data *)ud;
+	walk_node *d = w->round[i], *a;
+	struct dirent *entry;
+	DIR *dir = d->dir;
+	(void)slot;
+	d->dir = NULL;
+	if (dir == NULL) {
+		int fd = open (d->path,
+			O_RDONLY | O_DIRECTORY | O_CLOEXEC | (w->follow ? 0 : O_NOFOLLOW));
+		if (fd == -1)
+			return; /* unreadable directories are skipped */
+		if ((dir = fdopendir (fd)) == NULL) {
+			close (fd);
+			return;
+		}
+	}
+	if (w->follow) {
+		STAT_STRUCT info;
+		if (fstat (dirfd (dir), &info)) {
+			closedir (dir);
+			return;
+		}
+		for (a = d->parent; a != NULL; a = a->parent)
+			if (a->dev == info.st_dev && a->ino == info.st_ino) {
+				closedir (dir);
+				return;
+			}
+		d->dev = info.st_dev;
+		d->ino = info.st_ino;
+	}
+	while ((entry = readdir (dir)) != NULL) {
+		const char *name = entry->d_name, *mode;
+		int isdir, report;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		if (w->exclude && walk_matches (w->exclude, name))
+			continue;
+		if ((mode = walk_type (w, dir, entry, &isdir)) == NULL)
+			continue;
+		report = isdir ? w->dirs : (w->include == NULL || walk_matches (w->include, name));
+		isdir = isdir && d->depth < w->maxdepth;
+		if ((report || isdir) && walk_add (d, name, mode, report, isdir)) {
+			d->err = ENOMEM;
+			break;
+		}
+	}
+	closedir (dir);
+}
+
+/*
+** Adds the directory whose path is the first 'len' bytes of the buffer
+** to the pending ones of a threaded walk.
+*/
+static void walk_pend (lua_State *L, walk_data *w, walk_node *parent, size_t len) {
+	walk_node *d = (walk_node *)calloc (1, sizeof(walk_node));
+	if (d == NULL)
+		luaL_error (L, "not enough memory");
+	d->all = w->nodes;
+	w->nodes = d;
+	if ((d->path = (char *)malloc (len + 1)) == NULL)
+		luaL_error (L, "not enough memory");
+	memcpy (d->path, w->path, len + 1);
+	d->parent = parent;
+	d->depth = parent ? parent->depth + 1 : 1;
+	d->next = w->pending;
+	w->pending = d;
+}
+
+/*
+** Frees what a directory of a threaded walk holds besides its identity.
+*/
+static void walk_drop (walk_node *d) {
+	if (d->dir)
+		closedir (d->dir);
+	free (d->path);
+	free (d->names);
+	free (d->entries);
+	d->dir = NULL;
+	d->path = d->names = NULL;
+	d->entries = NULL;
+	d->n = 0;
+}
+
+/*
+** Reads the next pending directories on worker threads.
+*/
+static void walk_round (lua_State *L, walk_data *w) {
+	job_queue q;
+	int i;
+	w->nround = w->cur = w->entry = 0;
+	while (w->pending && w->nround < w->threads * WALK_ROUND) {
+		w->round[w->nround++] = w->pending;
+		w->pending = w->pending->next;
+	}
+	q.run = walk_read;
+	q.ud = w;
+	q.n = w->nround;
+	job_run (&q, job_threads (w->threads, w->nround));
+	for (i = 0; i < w->nround; i++)
+		if (w->round[i]->err)
+			luaL_error (L, "not enough memory");
+}
+
+/*
+** Stores a path and its mode as the n-th result of the walker iterator.
+*/
+static void walk_result (lua_State *L, walk_data *w, int n, size_t len, const char *mode) {
+	lua_pushlstring (L, w->path, len);
+	lua_rawseti (L, 2, n);
+	lua_pushstring (L, mode);
+	lua_rawseti (L, 3, n);
+}
+
+/*
+** Fills a batch depth first, one directory at a time.
+*/
+static int walk_batch (lua_State *L, walk_data *w) {
+	int n = 0;
+	while (n < w->batch && w->depth > 0) {
+		walk_frame *f = &w->stack[w->depth - 1];
+		struct dirent *entry = readdir (f->dir);
+		const char *name, *mode;
+		size_t len;
+		int isdir;
+		if (entry == NULL) {
+			closedir (f->dir);
+			w->depth--;
+			continue;
+		}
+		name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		if (w->exclude && walk_matches (w->exclude, name))
+			continue;
+		if ((mode = walk_type (w, f->dir, entry, &isdir)) == NULL)
+			continue;
+		len = walk_append (L, w, f->pathlen, name);
+		if (isdir ? w->dirs : (w->include == NULL || walk_matches (w->include, name)))
+			walk_result (L, w, ++n, len, mode);
+		if (isdir && w->depth < w->maxdepth) {
+			int fd = openat (dirfd (f->dir), name,
+				O_RDONLY | O_DIRECTORY | O_CLOEXEC | (w->follow ? 0 : O_NOFOLLOW));
+			DIR *dir = fd == -1 ? NULL : fdopendir (fd);
+			if (dir)
+				walk_push (L, w, dir, len);
+			else if (fd != -1)
+				close (fd);
+			/* unreadable directories are skipped */
+		}
+	}
+	return n;
+}
+
+/*
+** Fills a batch from the directories of the last round, starting another
+** one whenever they are drained.
+*/
+static int walk_batch_threads (lua_State *L, walk_data *w) {
+	int n = 0;
+	while (n < w->batch) {
+		walk_node *d;
+		walk_entry *e;
+		size_t len;
+		if (w->cur == w->nround) {
+			if (w->pending == NULL)
+				break;
+			walk_round (L, w);
+			continue;
+		}
+		d = w->round[w->cur];
+		if (w->entry == d->n) {
+			walk_drop (d);
+			w->cur++;
+			w->entry = 0;
+			continue;
+		}
+		e = &d->entries[w->entry++];
+		len = walk_append (L, w, walk_append (L, w, 0, d->path), d->names + e->name);
+		if (e->report)
+			walk_result (L, w, ++n, len, e->mode);
+		if (e->descend)
+			walk_pend (L, w, d, len);
+	}
+	return n;
+}
+
+/*
+** Closes all directories of a walker and frees its buffers.
+*/
+static int walk_close (lua_State *L) {
+	walk_data *w = (walk_data *)lua_touserdata (L, 1);
+	while (w->depth > 0)
+		closedir (w->stack[--w->depth].dir);
+	while (w->nodes) {
+		walk_node *d = w->nodes;
+		w->nodes = d->all;
+		walk_drop (d);
+		free (d);
+	}
+	free (w->round);
+	w->pending = NULL;
+	w->round = NULL;
+	w->nround = w->cur = 0;
+	free (w->stack);
+	free (w->path);
+	free (w->include);
+	free (w->exclude);
+	w->stack = NULL;
+	w->path = w->include = w->exclude = NULL;
+	w->closed = 1;
+	return 0;
+}
+
+/*
+** Walker iterator: returns the next batch of paths and a parallel list of
+** their modes, or nothing once the tree is exhausted.
+*/
+static int walk_iter (lua_State *L) {
+	walk_data *w = (walk_data *)luaL_checkudata (L, 1, WALK_METATABLE);
+	int n;
+	luaL_argcheck (L, !w->closed, 1, "closed walker");
+	lua_settop (L, 1);
+	lua_createtable (L, w->batch, 0);
+	lua_createtable (L, w->batch, 0);
+	n = w->threads > 1 ? walk_batch_threads (L, w) : walk_batch (L, w);
+	if (n == 0) {
+		walk_close (L);
+		return 0;
+	}
+	return 2;
+}
+
+/*
+** Factory of tree walkers.
+** @param #1 Root directory.
+** @param #2 Options table (optional): maxdepth, follow, dirs, batch,
+**   threads, include and exclude.
+*/
+static int walk_factory (lua_State *L) {
+	size_t len;
+	const char *root = luaL_checklstring (L, 1, &len);
+	walk_data *w;
+	DIR *dir;
+	if (!lua_isnoneornil (L, 2))
+		luaL_checktype (L, 2, LUA_TTABLE);
+	lua_settop (L, 2);
+	lua_pushcfunction (L, walk_iter);
+	w = (walk_data *)lua_newuserdata (L, sizeof(walk_data));
+	memset (w, 0, sizeof(walk_data));
+	w->maxdepth = INT_MAX;
+	w->dirs = 1;
+	w->batch = WALK_BATCH;
+	luaL_getmetatable (L, WALK_METATABLE);
+	lua_setmetatable (L, -2);
+	if (lua_istable (L, 2)) {
+		lua_getfield (L, 2, "maxdepth");
+		w->maxdepth = luaL_optint (L, -1, INT_MAX);
+		lua_getfield (L, 2, "batch");
+		w->batch = luaL_optint (L, -1, WALK_BATCH);
+		luaL_argcheck (L, w->batch > 0, 2, "batch must be positive");
+		lua_getfield (L, 2, "follow");
+		w->follow = lua_toboolean (L, -1);
+		lua_getfield (L, 2, "dirs");
+		w->dirs = lua_isnil (L, -1) || lua_toboolean (L, -1);
+		lua_getfield (L, 2, "threads");
+		w->threads = job_threads (luaL_optint (L, -1, 1), LFS_MAXTHREADS);
+		lua_pop (L, 5);
+		w->include = walk_globs (L, "include");
+		w->exclude = walk_globs (L, "exclude");
+	}
+	walk_append (L, w, 0, root);
+	if (w->maxdepth > 0 && w->threads > 1) {
+		w->round = (walk_node **)malloc (w->threads * WALK_ROUND * sizeof(walk_node *));
+		if (w->round == NULL)
+			luaL_error (L, "not enough memory");
+		walk_pend (L, w, NULL, len);
+		if ((w->pending->dir = opendir (root)) == NULL)
+			luaL_error (L, "cannot open %s: %s", root, strerror (errno));
+	} else if (w->maxdepth > 0) {
+		if ((dir = opendir (root)) == NULL)
+			luaL_error (L, "cannot open %s: %s", root, strerror (errno));
+		walk_push (L, w, dir, len);
+	}
+	return 2;
+}
+
+/*
+** Creates walker metatable.
+*/
+static int walk_create_meta (lua_State *L) {
+	luaL_newmetatable (L, WALK_METATABLE);
+	lua_newtable (L);
+	lua_pushcfunction (L, walk_iter);
+	lua_setfield (L, -2, "next");
+	lua_pushcfunction (L, walk_close);
+	lua_setfield (L, -2, "close");
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, walk_close);
+	lua_setfield (L, -2, "__gc");
+	return 1;
+}
+
+#define DIRX_METATABLE "dirx metatable"
+
+typedef struct dirx_data {
+	int closed;
+	DIR *dir;
+	int reuse;
+	int nfields;
+	unsigned char fields[sizeof(members) / sizeof(members[0])];
+} dirx_data;
+
+/*
+** Directory iterator with attributes: returns the next name and a table
+** with the requested attributes, or the name, nil and a message when the
+** entry can't be stat'ed.
+*/
+static int dirx_iter (lua_State *L) {
+	dirx_data *d = (dirx_data *)luaL_checkudata (L, 1, DIRX_METATABLE);
+	struct dirent *entry;
+	STAT_STRUCT info;
+	const char *mode = NULL;
+	int i;
+	luaL_argcheck (L, !d->closed, 1, "closed directory");
+	if ((entry = readdir (d->dir)) == NULL) {
+		/* no more entries => close directory */
+		closedir (d->dir);
+		d->closed = 1;
+		return 0;
+	}
+	lua_pushstring (L, entry->d_name);
+	/* the mode alone may come for free from readdir */
+	if (d->nfields == 1 && d->fields[0] == 0)
+		mode = dirent_mode (entry, 1);
+	if (mode == NULL && dirent_stat (d->dir, entry->d_name, &info, 1)) {
+		lua_pushnil (L);
+		lua_pushfstring (L, "cannot obtain information from file `%s'", entry->d_name);
+		return 3;
+	}
+	if (d->reuse)
+		lua_getuservalue (L, 1);
+	else
+		lua_createtable (L, 0, d->nfields);
+	if (mode) {
+		lua_pushstring (L, mode);
+		lua_setfield (L, -2, "mode");
+		return 2;
+	}
+	for (i = 0; i < d->nfields; i++) {
+		members[d->fields[i]].push (L, &info);
+		lua_setfield (L, -2, members[d->fields[i]].name);
+	}
+	return 2;
+}
+
+/*
+** Closes directory iterators with attributes
+*/
+static int dirx_close (lua_State *L) {
+	dirx_data *d = (dirx_data *)lua_touserdata (L, 1);
+	if (!d->closed && d->dir) {
+		closedir (d->dir);
+		d->closed = 1;
+	}
+	return 0;
+}
+
+/*
+** Looks up an attribute name in members.
+*/
+static int dirx_field (lua_State *L, int idx) {
+	const char *name = lua_tostring (L, idx);
+	int v;
+	for (v = 0; name && members[v].name; v++)
+		if (strcmp (members[v].name, name) == 0)
+			return v;
+	return luaL_argerror (L, 2, "invalid attribute name");
+}
+
+/*
+** Factory of directory iterators with attributes.
+** @param #1 Directory path.
+** @param #2 Attribute name or list of names (optional, all by default).
+** @param #3 Whether to return the same table on every step (optional).
+*/
+static int dirx_iter_factory (lua_State *L) {
+	const char *path = luaL_checkstring (L, 1);
+	int reuse = lua_toboolean (L, 3);
+	dirx_data *d;
+	lua_settop (L, 2);
+	lua_pushcfunction (L, dirx_iter);
+	d = (dirx_data *)lua_newuserdata (L, sizeof(dirx_data));
+	d->closed = 0;
+	d->dir = NULL;
+	d->reuse = reuse;
+	d->nfields = 0;
+	luaL_getmetatable (L, DIRX_METATABLE);
+	lua_setmetatable (L, -2);
+	if (lua_isnil (L, 2))
+		for (; members[d->nfields].name; d->nfields++)
+			d->fields[d->nfields] = (unsigned char)d->nfields;
+	else if (lua_istable (L, 2)) {
+		int i, n = (int)lua_rawlen (L, 2);
+		luaL_argcheck (L, n < (int)sizeof(d->fields), 2, "too many attributes");
+		for (i = 1; i <= n; i++) {
+			lua_rawgeti (L, 2, i);
+			d->fields[d->nfields++] = (unsigned char)dirx_field (L, -1);
+			lua_pop (L, 1);
+		}
+	} else
+		d->fields[d->nfields++] = (unsigned char)dirx_field (L, 2);
+	if (reuse) {
+		lua_createtable (L, 0, d->nfields);
+		lua_setuservalue (L, -2);
+	}
+	d->dir = opendir (path);
+	if (d->dir == NULL)
+		luaL_error (L, "cannot open %s: %s", path, strerror (errno));
+	return 2;
+}
+
+/*
+** Creates metatable of directory iterators with attributes.
+*/
+static int dirx_create_meta (lua_State *L) {
+	luaL_newmetatable (L, DIRX_METATABLE);
+	lua_newtable (L);
+	lua_pushcfunction (L, dirx_iter);
+	lua_setfield (L, -2, "next");
+	lua_pushcfunction (L, dirx_close);
+	lua_setfield (L, -2, "close");
+	lua_setfield (L, -2, "__index");
+	lua_pushcfunction (L, dirx_close);
+	lua_setfield (L, -2, "__gc");
+	return 1;
+}
+#else
+static int walk_factory (lua_State *L) {
+  lua_pushnil(L);
+  lua_pushliteral(L, "walk not supported on this platform");
+  return 2;
+}
+
+static int walk_create_meta (lua_State *L) {
+  (void)L;
+  return 0;
+}
+
+static int dirx_iter_factory (lua_State *L) {
+  lua_pushnil(L);
+  lua_pushliteral(L, "dirx not supported on this platform");
+  return 2;
+}
+
+static int dirx_create_meta (lua_State *L) {
+  (void)L;
+  return 0;
+}
+#endif
+
+
+/*
+** File hashing: xxh64, crc32c and sha256, fed from large unbuffered reads
+** so that contents never become Lua strings.
+*/
+#define HASH_BUFSIZE 65536
+#define HASH_THREADS 4
+
+#define ROTR32(x,n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL64(x,n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static uint32_t read32le (const unsigned char *p) {
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t read64le (const unsigned char *p) {
+	return (uint64_t)read32le (p) | (uint64_t)read32le (p + 4) << 32;
+}
+
+/* xxh64, seed 0 */
+#define XXH_P1 0x9E3779B185EBCA87ULL
+#define XXH_P2 0xC2B2AE3D27D4EB4FULL
+#define XXH_P3 0x165667B19E3779F9ULL
+#define XXH_P4 0x85EBCA77C2B2AE63ULL
+#define XXH_P5 0x27D4EB2F165667C5ULL
+
+typedef struct xxh64_state {
+	uint64_t v[4];
+	uint64_t total;
+	unsigned char mem[32];
+	size_t memsize;
+} xxh64_state;
+
+static uint64_t xxh64_round (uint64_t acc, uint64_t input) {
+	acc += input * XXH_P2;
+	acc = ROTL64 (acc, 31);
+	return acc * XXH_P1;
+}
+
+static uint64_t xxh64_merge (uint64_t acc, uint64_t val) {
+	acc ^= xxh64_round (0, val);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+static void xxh64_init (void *ctx) {
+	xxh64_state *s = (xxh64_state *)ctx;
+	s->v[0] = XXH_P1 + XXH_P2;
+	s->v[1] = XXH_P2;
+	s->v[2] = 0;
+	s->v[3] = 0 - XXH_P1;
+	s->total = 0;
+	s->memsize = 0;
+}
+
+static void xxh64_stripes (xxh64_state *s, const unsigned char *p) {
+	s->v[0] = xxh64_round (s->v[0], read64le (p));
+	s->v[1] = xxh64_round (s->v[1], read64le (p + 8));
+	s->v[2] = xxh64_round (s->v[2], read64le (p + 16));
+	s->v[3] = xxh64_round (s->v[3], read64le (p + 24));
+}
+
+static void xxh64_update (void *ctx, const unsigned char *p, size_t n) {
+	xxh64_state *s = (xxh64_state *)ctx;
+	s->total += n;
+	if (s->memsize + n < 32) {
+		memcpy (s->mem + s->memsize, p, n);
+		s->memsize += n;
+		return;
+	}
+	if (s->memsize) {
+		size_t fill = 32 - s->memsize;
+		memcpy (s->mem + s->memsize, p, fill);
+		xxh64_stripes (s, s->mem);
+		p += fill;
+		n -= fill;
+		s->memsize = 0;
+	}
+	for (; n >= 32; p += 32, n -= 32)
+		xxh64_stripes (s, p);
+	memcpy (s->mem, p, n);
+	s->memsize = n;
+}
+
+static void xxh64_final (void *ctx, unsigned char *out) {
+	xxh64_state *s = (xxh64_state *)ctx;
+	const unsigned char *p = s->mem, *end = s->mem + s->memsize;
+	uint64_t h;
+	int i;
+	if (s->total >= 32) {
+		h = ROTL64 (s->v[0], 1) + ROTL64 (s->v[1], 7) + ROTL64 (s->v[2], 12) + ROTL64 (s->v[3], 18);
+		for (i = 0; i < 4; i++)
+			h = xxh64_merge (h, s->v[i]);
+	} else
+		h = XXH_P5;
+	h += s->total;
+	for (; p + 8 <= end; p += 8) {
+		h ^= xxh64_round (0, read64le (p));
+		h = ROTL64 (h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)read32le (p) * XXH_P1;
+		h = ROTL64 (h, 23) * XXH_P2 + XXH_P3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= *p * XXH_P5;
+		h = ROTL64 (h, 11) * XXH_P1;
+	}
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	for (i = 7; i >= 0; i--, h >>= 8)
+		out[i] = (unsigned char)h;
+}
+
+/* crc32c (Castagnoli), with the SSE4.2 instruction when the CPU has it */
+static uint32_t crc32c_table[8][256];
+
+static void crc32c_maketable (void) {
+	uint32_t c;
+	int i, j;
+	for (i = 0; i < 256; i++) {
+		c = (uint32_t)i;
+		for (j = 0; j < 8; j++)
+			c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+		crc32c_table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++)
+		for (j = 1; j < 8; j++)
+			crc32c_table[j][i] = (crc32c_table[j-1][i] >> 8) ^ crc32c_table[0][crc32c_table[j-1][i] & 0xff];
+}
+
+/* slicing by 8 */
+static uint32_t crc32c_sw (uint32_t crc, const unsigned char *p, size_t n) {
+	for (; n >= 8; p += 8, n -= 8) {
+		uint32_t lo = read32le (p) ^ crc, hi = read32le (p + 4);
+		crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff] ^
+		      crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24] ^
+		      crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff] ^
+		      crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+	}
+	while (n--)
+		crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define CRC32C_HW
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw (uint32_t crc, const unsigned char *p, size_t n) {
+#ifdef __x86_64__
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t v;
+		memcpy (&v, p, 8);
+		crc = (uint32_t)__builtin_ia32_crc32di (crc, v);
+	}
+#endif
+	for (; n >= 4; p += 4, n -= 4) {
+		uint32_t v;
+		memcpy (&v, p, 4);
+		crc = __builtin_ia32_crc32si (crc, v);
+	}
+	while (n--)
+		crc = __builtin_ia32_crc32qi (crc, *p++);
+	return crc;
+}
+#endif
+
+static uint32_t (*crc32c_update_fn) (uint32_t, const unsigned char *, size_t);
+
+static void crc32c_init (void *ctx) {
+	if (crc32c_update_fn == NULL) {
+#ifdef CRC32C_HW
+		__builtin_cpu_init ();
+		if (__builtin_cpu_supports ("sse4.2"))
+			crc32c_update_fn = crc32c_hw;
+		else
+#endif
+		{
+			crc32c_maketable ();
+			crc32c_update_fn = crc32c_sw;
+		}
+	}
+	*(uint32_t *)ctx = 0xFFFFFFFF;
+}
+
+static void crc32c_update (void *ctx, const unsigned char *p, size_t n) {
+	*(uint32_t *)ctx = crc32c_update_fn (*(uint32_t *)ctx, p, n);
+}
+
+static void crc32c_final (void *ctx, unsigned char *out) {
+	uint32_t crc = ~*(uint32_t *)ctx;
+	out[0] = (unsigned char)(crc >> 24);
+	out[1] = (unsigned char)(crc >> 16);
+	out[2] = (unsigned char)(crc >> 8);
+	out[3] = (unsigned char)crc;
+}
+
+/* sha256 */
+typedef struct sha256_state {
+	uint32_t h[8];
+	uint64_t total;
+	unsigned char buf[64];
+	size_t n;
+} sha256_state;
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256_init (void *ctx) {
+	static const uint32_t h0[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	sha256_state *s = (sha256_state *)ctx;
+	memcpy (s->h, h0, sizeof(h0));
+	s->total = 0;
+	s->n = 0;
+}
+
+static void sha256_block (uint32_t *h, const unsigned char *p) {
+	uint32_t w[64], a, b, c, d, e, f, g, k, t1, t2;
+	int i;
+	for (i = 0; i < 16; i++, p += 4)
+		w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+	for (; i < 64; i++)
+		w[i] = (ROTR32 (w[i-2], 17) ^ ROTR32 (w[i-2], 19) ^ (w[i-2] >> 10)) + w[i-7] +
+		       (ROTR32 (w[i-15], 7) ^ ROTR32 (w[i-15], 18) ^ (w[i-15] >> 3)) + w[i-16];
+	a = h[0]; b = h[1]; c = h[2]; d = h[3];
+	e = h[4]; f = h[5]; g = h[6]; k = h[7];
+	for (i = 0; i < 64; i++) {
+		t1 = k + (ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		t2 = (ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_update (void *ctx, const unsigned char *p, size_t n) {
+	sha256_state *s = (sha256_state *)ctx;
+	s->total += n;
+	if (s->n) {
+		size_t fill = 64 - s->n < n ? 64 - s->n : n;
+		memcpy (s->buf + s->n, p, fill);
+		s->n += fill;
+		p += fill;
+		n -= fill;
+		if (s->n < 64)
+			return;
+		sha256_block (s->h, s->buf);
+		s->n = 0;
+	}
+	for (; n >= 64; p += 64, n -= 64)
+		sha256_block (s->h, p);
+	memcpy (s->buf, p, n);
+	s->n = n;
+}
+
+static void sha256_final (void *ctx, unsigned char *out) {
+	sha256_state *s = (sha256_state *)ctx;
+	uint64_t bits = s->total * 8;
+	int i;
+	s->buf[s->n++] = 0x80;
+	if (s->n > 56) {
+		memset (s->buf + s->n, 0, 64 - s->n);
+		sha256_block (s->h, s->buf);
+		s->n = 0;
+	}
+	memset (s->buf + s->n, 0, 56 - s->n);
+	for (i = 63; i >= 56; i--, bits >>= 8)
+		s->buf[i] = (unsigned char)bits;
+	sha256_block (s->h, s->buf);
+	for (i = 0; i < 8; i++) {
+		out[4*i] = (unsigned char)(s->h[i] >> 24);
+		out[4*i+1] = (unsigned char)(s->h[i] >> 16);
+		out[4*i+2] = (unsigned char)(s->h[i] >> 8);
+		out[4*i+3] = (unsigned char)s->h[i];
+	}
+}
+
+typedef union hash_state {
+	xxh64_state xxh64;
+	uint32_t crc32c;
+	sha256_state sha256;
+} hash_state;
+
+typedef struct hash_algo {
+	size_t size;  /* digest bytes */
+	void (*init) (void *ctx);
+	void (*update) (void *ctx, const unsigned char *p, size_t n);
+	void (*final) (void *ctx, unsigned char *out);
+} hash_algo;
+
+/* in the order of the names accepted by file_hash */
+static const hash_algo hash_algos[] = {
+	{ 8,  xxh64_init,  xxh64_update,  xxh64_final },
+	{ 4,  crc32c_init, crc32c_update, crc32c_final },
+	{ 32, sha256_init, sha256_update, sha256_final },
+	{ 0, NULL, NULL, NULL }
+};
+
+/*
+** Hashes a file into 'hex', using 'buf' for reads. Returns 0 on success,
+** or -1 with errno set.
+*/
+static int hash_file (const hash_algo *algo, const char *path, unsigned char *buf, char *hex) {
+	static const char digits[] = "0123456789abcdef";
+	unsigned char digest[32];
+	hash_state ctx;
+	size_t i, n;
+	int err;
+	FILE *f = fopen (path, "rb");
+	if (f == NULL)
+		return -1;
+	setvbuf (f, NULL, _IONBF, 0);
+	algo->init (&ctx);
+	while ((n = fread (buf, 1, HASH_BUFSIZE, f)) > 0)
+		algo->update (&ctx, buf, n);
+	err = ferror (f) ? errno : 0;
+	fclose (f);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	algo->final (&ctx, digest);
+	for (i = 0; i < algo->size; i++) {
+		hex[2*i] = digits[digest[i] >> 4];
+		hex[2*i+1] = digits[digest[i] & 15];
+	}
+	return 0;
+}
+
+/* a file of a batch, hashed by a worker */
+typedef struct hash_job {
+	const char *path;
+	int ok;
+	char hex[64];
+} hash_job;
+
+typedef struct hash_batch {
+	const hash_algo *algo;
+	hash_job *jobs;
+	unsigned char *bufs; /* a read buffer per slot */
+} hash_batch;
+
+static void hash_run (void *ud, int slot, int i) {
+	hash_batch *b = (hash_batch *)ud;
+	hash_job *j = &b->jobs[i];
+	j->ok = hash_file (b->algo, j->path, b->bufs + (size_t)slot * HASH_BUFSIZE, j->hex) == 0;
+}
+
+/*
+** Hashes files.
+** @param #1 File path, or list of file paths.
+** @param #2 Algorithm: "xxh64" (default), "crc32c" or "sha256".
+** @param #3 Number of worker threads for a list (optional, default 4).
+** Returns the hex digest, or for a list a table mapping each path to its
+** digest or to false when the file couldn't be read.
+*/
+static int file_hash (lua_State *L) {
+	static const char *const names[] = { "xxh64", "crc32c", "sha256", NULL };
+	const hash_algo *algo = &hash_algos[luaL_checkoption (L, 2, "xxh64", names)];
+	if (!lua_istable (L, 1)) {
+		const char *path = luaL_checkstring (L, 1);
+		unsigned char *buf = (unsigned char *)lua_newuserdata (L, HASH_BUFSIZE);
+		char hex[64];
+		if (hash_file (algo, path, buf, hex)) {
+			lua_pushnil (L);
+			lua_pushfstring (L, "cannot hash file `%s': %s", path, strerror (errno));
+			return 2;
+		}
+		lua_pushlstring (L, hex, 2 * algo->size);
+		return 1;
+	} else {
+		int i, n = (int)lua_rawlen (L, 1);
+		int threads = job_threads (luaL_optint (L, 3, HASH_THREADS), n);
+		hash_state ctx;
+		hash_batch b;
+		job_queue q;
+		b.algo = algo;
+		b.jobs = (hash_job *)lua_newuserdata (L, n * sizeof(hash_job));
+		b.bufs = (unsigned char *)lua_newuserdata (L, threads * HASH_BUFSIZE);
+		/* keeps the paths, numbers turned into strings included, while the jobs run */
+		lua_createtable (L, n, 0);
+		for (i = 0; i < n; i++) {
+			lua_rawgeti (L, 1, i + 1);
+			luaL_argcheck (L, lua_isstring (L, -1), 1, "paths must be strings");
+			b.jobs[i].path = lua_tostring (L, -1);
+			lua_rawseti (L, -2, i + 1);
+		}
+		/* crc32c picks its implementation on first use, before any worker runs */
+		algo->init (&ctx);
+		q.run = hash_run;
+		q.ud = &b;
+		q.n = n;
+		job_run (&q, threads);
+		lua_createtable (L, 0, n);
+		for (i = 0; i < n; i++) {
+			lua_rawgeti (L, -2, i + 1);
+			if (b.jobs[i].ok)
+				lua_pushlstring (L, b.jobs[i].hex, 2 * algo->size);
+			else
+				lua_pushboolean (L, 0);
+			lua_rawset (L, -3);
+		}
+		return 1;
+	}
+}
+
+
 /*
 ** Assumes the table is on top of the stack.
 */
@@ -782,6 +2076,8 @@ static const struct luaL_Reg fslib[] = {
 	{"chdir", change_dir},
 	{"currentdir", get_dir},
 	{"dir", dir_iter_factory},
+	{"dirx", dirx_iter_factory},
+	{"hash", file_hash},
 	{"lock", file_lock},
 	{"mkdir", make_dir},
 	{"rmdir", remove_dir},
@@ -790,12 +2086,15 @@ static const struct luaL_Reg fslib[] = {
 	{"touch", file_utime},
 	{"unlock", file_unlock},
 	{"lock_dir", lfs_lock_dir},
+	{"walk", walk_factory},
 	{NULL, NULL},
 };
 
 int luaopen_lfs (lua_State *L) {
 	dir_create_meta (L);
 	lock_create_meta (L);
+	walk_create_meta (L);
+	dirx_create_meta (L);
 #if LUA_VERSION_NUM > 501
     lua_newtable(L);
     luaL_setfuncs(L,fslib,0);
@@ -152,4 +152,129 @@ local iter, dir = lfs.dir(tmp)
 dir:close()
 -- Fails on Windows build ???
 --assert(not pcall(dir.next, dir))
+
+-- Recursive walker
+if lfs.walk(tmp) then
+    local root = current..sep.."lfs_walk_dir"
+    local files = {"a.txt", "b.lua", "sub"..sep.."c.txt", "sub"..sep.."deeper"..sep.."d.lua",
+        "skip"..sep.."e.txt"}
+    for _, d in ipairs{"", sep.."sub", sep.."sub"..sep.."deeper", sep.."skip"} do
+        assert (lfs.mkdir (root..d))
+    end
+    for _, f in ipairs(files) do
+        assert (io.open (root..sep..f, "w")):close()
+    end
+    local function walk (opts)
+        local found, batches = {}, 0
+        for paths, modes in lfs.walk (root, opts) do
+            batches = batches + 1
+            assert (#paths == #modes)
+            for i = 1, #paths do
+                local rel = paths[i]:sub(#root + 2)
+                assert (lfs.attributes (paths[i]).mode == modes[i])
+                assert (not found[rel], "walked twice over "..rel)
+                found[rel] = modes[i]
+            end
+        end
+        return found, batches
+    end
+    local found, batches = walk ()
+    assert (batches == 1)
+    for _, f in ipairs(files) do assert (found[f] == "file") end
+    assert (found.sub == "directory" and found["sub"..sep.."deeper"] == "directory")
+    found = walk {maxdepth = 1}
+    assert (found["a.txt"] and found.sub and not found["sub"..sep.."c.txt"])
+    found = walk {include = "*.lua", dirs = false}
+    assert (found["b.lua"] and found["sub"..sep.."deeper"..sep.."d.lua"])
+    assert (not found["a.txt"] and not found.sub)
+    found = walk {exclude = {"skip", "[a-c].*"}}
+    assert (not found.skip and not found["skip"..sep.."e.txt"] and not found["a.txt"])
+    assert (found["sub"..sep.."deeper"..sep.."d.lua"])
+    found, batches = walk {batch = 2}
+    assert (batches == 4)
+    -- worker threads find the same entries, in another order
+    for _, opts in ipairs{{threads = 4}, {threads = 4, batch = 2}, {threads = 2, maxdepth = 2},
+            {threads = 3, include = "*.lua", dirs = false, follow = true}} do
+        local serial = walk {maxdepth = opts.maxdepth, include = opts.include, dirs = opts.dirs,
+            follow = opts.follow}
+        found, batches = walk (opts)
+        for k, v in pairs(serial) do assert (found[k] == v, "threads missed "..k) end
+        for k in pairs(found) do assert (serial[k], "threads found "..k) end
+    end
+    assert (batches == 1)
+    for i = #files, 1, -1 do assert (os.remove (root..sep..files[i])) end
+    for _, d in ipairs{sep.."skip", sep.."sub"..sep.."deeper", sep.."sub", ""} do
+        assert (lfs.rmdir (root..d))
+    end
+end
+
+-- Directory iterator with attributes
+if lfs.dirx(tmp) then
+    local names = {}
+    for name, attr in lfs.dirx (current, {"mode", "size", "modification", "ino"}) do
+        local expected = assert (lfs.attributes (current..sep..name))
+        assert (attr.mode == expected.mode and attr.size == expected.size)
+        assert (attr.modification == expected.modification and attr.ino == expected.ino)
+        assert (attr.uid == nil)
+        names[#names+1] = name
+    end
+    local i, last = 0
+    for name, attr in lfs.dirx (current, "mode", true) do
+        i = i + 1
+        assert (name == names[i] and attr.mode == lfs.attributes (current..sep..name, "mode"))
+        assert (last == nil or last == attr, "result table was not reused")
+        last = attr
+    end
+    assert (i == #names)
+    for name, attr in lfs.dirx (current) do
+        assert (attr.nlink and attr.change)
+    end
+    assert (not pcall (lfs.dirx, current, "nonsense"))
+end
+
+-- File hashing
+local hashfile = current..sep.."lfs_hash_file"
+local vectors = {
+    {"", "ef46db3751d8e999", "00000000",
+     "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+    {"123456789", "8cb841db40e6ae83", "e3069283",
+     "15e2b0d3c33891ebb0f1ef609ec419420c20e320ce94c65fbc8c3312448eb225"},
+}
+-- large enough to span several reads, and of odd length
+local t = {}
+for i = 0, 100002 do t[#t+1] = string.char((i * 7 + 3) % 256) end
+vectors[3] = {table.concat(t), "924a64f3ae9ea839", "97614f92",
+    "b4bec991fc613fcb4d2a26eb529e493ed4e3152cc00f0a49bd39b3e48b34824e"}
+for _, v in ipairs(vectors) do
+    local f = assert (io.open (hashfile, "wb"))
+    f:write (v[1])
+    f:close()
+    assert (lfs.hash (hashfile) == v[2])
+    assert (lfs.hash (hashfile, "xxh64") == v[2])
+    assert (lfs.hash (hashfile, "crc32c") == v[3])
+    assert (lfs.hash (hashfile, "sha256") == v[4])
+end
+local missing = hashfile.."_missing"
+assert (lfs.hash (missing) == nil)
+local digests = lfs.hash ({hashfile, missing}, "sha256")
+assert (digests[hashfile] == vectors[3][4] and digests[missing] == false)
+-- batches are hashed on worker threads
+local batch = {missing}
+for i, v in ipairs(vectors) do
+    batch[#batch+1] = hashfile..i
+    local f = assert (io.open (batch[#batch], "wb"))
+    f:write (v[1])
+    f:close()
+end
+for a, algo in ipairs{"xxh64", "crc32c", "sha256"} do
+    for _, threads in ipairs{1, 3, 100} do
+        digests = lfs.hash (batch, algo, threads)
+        assert (digests[missing] == false)
+        for i, v in ipairs(vectors) do assert (digests[hashfile..i] == v[a + 1]) end
+    end
+end
+for i = 1, #vectors do assert (os.remove (hashfile..i)) end
+assert (not pcall (lfs.hash, hashfile, "md4"))
+assert (os.remove (hashfile))
+
 print"Ok!"
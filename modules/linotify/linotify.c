@@ -24,24 +24,72 @@
 #include <lauxlib.h>
 
 #include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
 #include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #define INOTIFY_LIB_NAME "inotify"
 #define MT_NAME "INOTIFY_HANDLE"
+#define DIR_MT_NAME "INOTIFY_DIR"
+
+/* default size of the read buffer; a read never returns a partial event,
+ * so the buffer holds at least one event with the longest name */
+#define INOTIFY_BUFSIZE 65536
+#define INOTIFY_MINBUF (sizeof(struct inotify_event) + NAME_MAX + 1)
+
+/* events every directory of a watched tree needs to keep the tree complete */
+#define TREE_MASK (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+/* slots of the handle's uservalue */
+#define UV_PATHS 1 /* wd -> path, for watches added by watch_tree */
+#define UV_MASKS 2 /* wd -> mask, for watches added by watch_tree */
+
+#if LUA_VERSION_NUM > 501
+#define getuservalue lua_getuservalue
+#define setuservalue lua_setuservalue
+#else
+#define getuservalue lua_getfenv
+#define setuservalue lua_setfenv
+#endif
+
+typedef struct inotify_handle {
+    int fd;
+    int coalesce;   /* drop repeated events within one read */
+    size_t bufsize;
+    char *buffer;
+    size_t pathsize;
+    char *path;     /* scratch path for watch_tree */
+} inotify_handle;
 
 void push_inotify_handle(lua_State *L, int fd)
 {
-    int *udata = (int *) lua_newuserdata(L, sizeof(int));
-    *udata = fd;
+    inotify_handle *h = (inotify_handle *) lua_newuserdata(L, sizeof(inotify_handle));
+    memset(h, 0, sizeof(inotify_handle));
+    h->fd = fd;
     luaL_getmetatable(L, MT_NAME);
     lua_setmetatable(L, -2);
+    lua_createtable(L, 2, 0);
+    lua_newtable(L);
+    lua_rawseti(L, -2, UV_PATHS);
+    lua_newtable(L);
+    lua_rawseti(L, -2, UV_MASKS);
+    setuservalue(L, -2);
+}
+
+static inotify_handle *check_inotify_handle(lua_State *L, int index)
+{
+    inotify_handle *h = (inotify_handle *) luaL_checkudata(L, index, MT_NAME);
+    luaL_argcheck(L, h->fd != -1, index, "closed inotify handle");
+    return h;
 }
 
 int get_inotify_handle(lua_State *L, int index)
 {
-    return *((int *) luaL_checkudata(L, index, MT_NAME));
+    return check_inotify_handle(L, index)->fd;
 }
 
 static int handle_error(lua_State *L)
@@ -55,13 +103,32 @@ static int handle_error(lua_State *L)
 static int init(lua_State *L)
 {
     int fd;
+    size_t bufsize = INOTIFY_BUFSIZE;
+    int coalesce = 0;
+    inotify_handle *h;
+
+    if(lua_istable(L, 1)) {
+        lua_getfield(L, 1, "buffer");
+        bufsize = (size_t) luaL_optinteger(L, -1, INOTIFY_BUFSIZE);
+        lua_getfield(L, 1, "coalesce");
+        coalesce = lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        if(bufsize < INOTIFY_MINBUF) {
+            bufsize = INOTIFY_MINBUF;
+        }
+    }
 
     if((fd = inotify_init()) == -1) {
         return handle_error(L);
-    } else {
-        push_inotify_handle(L, fd);
-        return 1;
     }
+    push_inotify_handle(L, fd);
+    h = (inotify_handle *) lua_touserdata(L, -1);
+    h->coalesce = coalesce;
+    h->bufsize = bufsize;
+    if((h->buffer = (char *) malloc(bufsize)) == NULL) {
+        return luaL_error(L, "not enough memory");
+    }
+    return 1;
 }
 
 static int handle_fileno(lua_State *L)
@@ -70,27 +137,266 @@ static int handle_fileno(lua_State *L)
     return 1;
 }
 
+/* grows the scratch path so that it holds 'size' bytes */
+static void reserve_path(lua_State *L, inotify_handle *h, size_t size)
+{
+    if(size > h->pathsize) {
+        char *path = (char *) realloc(h->path, 2 * size);
+        if(path == NULL) {
+            luaL_error(L, "not enough memory");
+        }
+        h->path = path;
+        h->pathsize = 2 * size;
+    }
+}
+
+/* closes a directory left open by an error in watch_dir */
+static int dir__gc(lua_State *L)
+{
+    DIR **dir = (DIR **) lua_touserdata(L, 1);
+    if(*dir != NULL) {
+        closedir(*dir);
+        *dir = NULL;
+    }
+    return 0;
+}
+
+/* records in the table at 'failed' why the scratch path can't be watched */
+static void add_failure(lua_State *L, inotify_handle *h, size_t len, int err,
+                        int failed)
+{
+    lua_pushlstring(L, h->path, len);
+    lua_pushstring(L, strerror(err));
+    lua_rawset(L, failed);
+}
+
+/*
+ * Watches the directory whose path is in the first 'len' bytes of the
+ * scratch path, and every directory below it. The tables of the watched
+ * paths and masks are at stack indices 'paths' and 'masks'; directories
+ * below the top one that can't be watched or listed go into the table at
+ * 'failed', keyed by path. Returns the number of directories watched, -1
+ * when the top one can't be watched.
+ */
+static int watch_dir(lua_State *L, inotify_handle *h, size_t len, uint32_t mask,
+                     int paths, int masks, int failed)
+{
+    struct dirent *entry;
+    struct stat st;
+    DIR **dir;
+    int wd;
+    int count = 1;
+
+    if((wd = inotify_add_watch(h->fd, h->path, mask | TREE_MASK)) == -1) {
+        return -1;
+    }
+    luaL_checkstack(L, 4, "directory tree too deep");
+    lua_pushlstring(L, h->path, len);
+    lua_rawseti(L, paths, wd);
+    lua_pushinteger(L, mask);
+    lua_rawseti(L, masks, wd);
+
+    /* the directory is closed by collection if anything below raises */
+    dir = (DIR **) lua_newuserdata(L, sizeof(DIR *));
+    *dir = NULL;
+    luaL_getmetatable(L, DIR_MT_NAME);
+    lua_setmetatable(L, -2);
+    if((*dir = opendir(h->path)) == NULL) {
+        /* gone already: its IN_IGNORED is on the way */
+        if(errno != ENOENT && errno != ENOTDIR) {
+            add_failure(L, h, len, errno, failed);
+        }
+        lua_pop(L, 1);
+        return count;
+    }
+    while((entry = readdir(*dir)) != NULL) {
+        const char *name = entry->d_name;
+        size_t base, sublen;
+        int r;
+
+        if(name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+#ifdef DT_DIR
+        if(entry->d_type != DT_DIR && entry->d_type != DT_UNKNOWN) {
+            continue;
+        }
+#endif
+        /* the root may be "/" */
+        base = h->path[len - 1] == '/' ? len : len + 1;
+        sublen = base + strlen(name);
+        reserve_path(L, h, sublen + 1);
+        h->path[len] = '/';
+        strcpy(h->path + base, name);
+        if(lstat(h->path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            if((r = watch_dir(L, h, sublen, mask, paths, masks, failed)) > 0) {
+                count += r;
+            } else if(errno != ENOENT && errno != ENOTDIR) {
+                add_failure(L, h, sublen, errno, failed);
+            }
+        }
+        h->path[len] = '\0';
+    }
+    closedir(*dir);
+    *dir = NULL;
+    lua_pop(L, 1);
+    return count;
+}
+
+static int add_tree(lua_State *L, inotify_handle *h, const char *path, size_t len,
+                    uint32_t mask, int paths, int masks, int failed)
+{
+    /* strip trailing slashes, but keep "/" itself */
+    while(len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    reserve_path(L, h, len + 1);
+    memcpy(h->path, path, len);
+    h->path[len] = '\0';
+    return watch_dir(L, h, len, mask, paths, masks, failed);
+}
+
+/*
+ * Removes the watches on the directory 'path' and every directory below
+ * it from the inotify instance and from the tables at 'paths' and 'masks'
+ */
+static void drop_tree(lua_State *L, inotify_handle *h, const char *path, size_t len,
+                      int paths, int masks)
+{
+    lua_pushnil(L);
+    while(lua_next(L, paths)) {
+        size_t plen;
+        const char *p = lua_tolstring(L, -1, &plen);
+        if(plen >= len && memcmp(p, path, len) == 0 && (plen == len || p[len] == '/')) {
+            inotify_rm_watch(h->fd, (int) lua_tointeger(L, -2));
+            lua_pushvalue(L, -2);
+            lua_pushnil(L);
+            lua_rawset(L, masks);
+            /* clearing the current field keeps the traversal valid */
+            lua_pushvalue(L, -2);
+            lua_pushnil(L);
+            lua_rawset(L, paths);
+        }
+        lua_pop(L, 1);
+    }
+}
+
+static int handle_watch_tree(lua_State *L)
+{
+    inotify_handle *h = check_inotify_handle(L, 1);
+    size_t len;
+    const char *root = luaL_checklstring(L, 2, &len);
+    uint32_t mask = 0;
+    int top = lua_gettop(L);
+    int i, count;
+
+    for(i = 3; i <= top; i++) {
+        mask |= luaL_checkinteger(L, i);
+    }
+    getuservalue(L, 1);
+    lua_rawgeti(L, -1, UV_PATHS);
+    lua_rawgeti(L, -2, UV_MASKS);
+    lua_newtable(L);
+    if((count = add_tree(L, h, root, len, mask, top + 2, top + 3, top + 4)) == -1) {
+        return handle_error(L);
+    }
+    lua_pushinteger(L, count);
+    lua_pushnil(L);
+    if(lua_next(L, top + 4)) {
+        /* some directories below the root are not watched */
+        lua_pop(L, 2);
+        lua_pushvalue(L, top + 4);
+        return 2;
+    }
+    return 1;
+}
+
+static int handle_getpath(lua_State *L)
+{
+    check_inotify_handle(L, 1);
+    luaL_checkinteger(L, 2);
+    getuservalue(L, 1);
+    lua_rawgeti(L, -1, UV_PATHS);
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+static int same_event(struct inotify_event *a, struct inotify_event *b)
+{
+    return a->wd == b->wd && a->mask == b->mask &&
+        (a->len == 0 ? b->len == 0 : b->len != 0 && strcmp(a->name, b->name) == 0);
+}
+
+static size_t hash_event(struct inotify_event *iev)
+{
+    size_t hash = (size_t) iev->wd * 31 + iev->mask;
+    const char *p;
+    if(iev->len) {
+        for(p = iev->name; *p; p++) {
+            hash = hash * 33 + (unsigned char) *p;
+        }
+    }
+    return hash;
+}
+
 static int handle_read(lua_State *L)
 {
-    int fd;
-    int i = 0;
+    inotify_handle *h = check_inotify_handle(L, 1);
+    size_t i = 0;
     int n = 1;
     ssize_t bytes;
+    size_t *slots = NULL;
+    size_t nslots = 0;
     struct inotify_event *iev;
-    char buffer[1024];
+    char *buffer = h->buffer;
 
-    fd = get_inotify_handle(L, 1);
-    if((bytes = read(fd, buffer, 1024)) < 0) {
+    if((bytes = read(h->fd, buffer, h->bufsize)) < 0) {
         return handle_error(L);
     }
+    lua_settop(L, 1);
+    getuservalue(L, 1);
+    lua_rawgeti(L, 2, UV_PATHS);
+    lua_rawgeti(L, 2, UV_MASKS);
     lua_newtable(L);
 
-    while(bytes >= sizeof(struct inotify_event)) {
+    if(h->coalesce) {
+        /* an open addressed set of the events kept so far, by offset + 1 */
+        size_t count = 0;
+        for(i = 0; i + sizeof(struct inotify_event) <= (size_t) bytes; count++) {
+            i += sizeof(struct inotify_event) + ((struct inotify_event *) (buffer + i))->len;
+        }
+        for(nslots = 8; nslots < 2 * count; nslots *= 2)
+            ;
+        slots = (size_t *) lua_newuserdata(L, nslots * sizeof(size_t));
+        memset(slots, 0, nslots * sizeof(size_t));
+        i = 0;
+    }
+
+    for(; i + sizeof(struct inotify_event) <= (size_t) bytes;
+          i += sizeof(struct inotify_event) + iev->len) {
         iev = (struct inotify_event *) (buffer + i);
 
-        lua_createtable(L, 0, 4);
+        /* moves are paired by cookie, so those are never dropped */
+        if(slots && iev->cookie == 0) {
+            size_t s = hash_event(iev) & (nslots - 1);
+            int seen = 0;
+            while(slots[s]) {
+                if(same_event((struct inotify_event *) (buffer + slots[s] - 1), iev)) {
+                    seen = 1;
+                    break;
+                }
+                s = (s + 1) & (nslots - 1);
+            }
+            if(seen) {
+                continue;
+            }
+            slots[s] = i + 1;
+        }
+
+        lua_createtable(L, 0, 5);
         lua_pushvalue(L, -1);
-        lua_rawseti(L, -3, n++);
+        lua_rawseti(L, 5, n++);
 
         lua_pushinteger(L, iev->wd);
         lua_setfield(L, -2, "wd");
@@ -106,19 +412,70 @@ static int handle_read(lua_State *L)
             lua_setfield(L, -2, "name");
         }
 
-        lua_pop(L, 1);
+        /* events on watched trees carry the full path, and keep the
+         * tree and the wd <-> path map up to date */
+        lua_rawgeti(L, 3, iev->wd);
+        if(!lua_isnil(L, -1)) {
+            if(iev->mask & IN_IGNORED) {
+                lua_setfield(L, -2, "path");
+                lua_pushnil(L);
+                lua_rawseti(L, 3, iev->wd);
+                lua_pushnil(L);
+                lua_rawseti(L, 4, iev->wd);
+            } else {
+                size_t len;
+                if(iev->len) {
+                    const char *dir = lua_tolstring(L, -1, &len);
+                    if(len > 0 && dir[len - 1] == '/') {
+                        lua_pushliteral(L, "");
+                    } else {
+                        lua_pushliteral(L, "/");
+                    }
+                    lua_pushstring(L, iev->name);
+                    lua_concat(L, 3);
+                }
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "path");
+                if((iev->mask & IN_ISDIR) && (iev->mask & (IN_CREATE | IN_MOVED_TO))) {
+                    const char *path = lua_tolstring(L, -1, &len);
+                    int failed = lua_gettop(L) + 2;
+                    lua_rawgeti(L, 4, iev->wd);
+                    lua_newtable(L);
+                    if(add_tree(L, h, path, len, (uint32_t) lua_tointeger(L, -2),
+                                3, 4, failed) == -1 && errno != ENOENT) {
+                        add_failure(L, h, strlen(h->path), errno, failed);
+                    }
+                    lua_pushnil(L);
+                    if(lua_next(L, failed)) {
+                        lua_pop(L, 2);
+                        lua_setfield(L, -4, "failed");
+                    } else {
+                        lua_pop(L, 1);
+                    }
+                    lua_pop(L, 1);
+                } else if((iev->mask & IN_ISDIR) && (iev->mask & IN_MOVED_FROM)) {
+                    /* a move within the tree watches it again on IN_MOVED_TO */
+                    const char *path = lua_tolstring(L, -1, &len);
+                    drop_tree(L, h, path, len, 3, 4);
+                }
+                lua_pop(L, 1);
+            }
+        } else {
+            lua_pop(L, 1);
+        }
 
-        i += (sizeof(struct inotify_event) + iev->len);
-        bytes -= (sizeof(struct inotify_event) + iev->len);
+        lua_pop(L, 1);
     }
 
+    lua_settop(L, 5);
     return 1;
 }
 
 static int handle_close(lua_State *L)
 {
-    int fd = get_inotify_handle(L, 1);
-    close(fd);
+    inotify_handle *h = check_inotify_handle(L, 1);
+    close(h->fd);
+    h->fd = -1;
     return 0;
 }
 
@@ -163,7 +520,15 @@ static int handle_rm_watch(lua_State *L)
 
 static int handle__gc(lua_State *L)
 {
-    return handle_close(L);
+    inotify_handle *h = (inotify_handle *) luaL_checkudata(L, 1, MT_NAME);
+    if(h->fd != -1) {
+        close(h->fd);
+        h->fd = -1;
+    }
+    free(h->buffer);
+    free(h->path);
+    h->buffer = h->path = NULL;
+    return 0;
 }
 
 static luaL_Reg inotify_funcs[] = {
@@ -177,6 +542,8 @@ static luaL_Reg handle_funcs[] = {
     {"addwatch", handle_add_watch},
     {"rmwatch", handle_rm_watch},
     {"fileno", handle_fileno},
+    {"watch_tree", handle_watch_tree},
+    {"getpath", handle_getpath},
     {NULL, NULL}
 };
 
@@ -198,6 +565,11 @@ int luaopen_inotify(lua_State *L)
     lua_setfield(L, -2, "__gc");
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, DIR_MT_NAME);
+    lua_pushcfunction(L, dir__gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
 #if LUA_VERSION_NUM > 501
     lua_newtable(L);
     luaL_setfuncs(L,inotify_funcs,0);
@@ -16,3 +16,67 @@ local events = handle:read()
 print(events[1].name)
 assert(events[1].name == "frodo")
 handle:close()
+
+-- recursive watches, with repeated events coalesced
+local root = posix.getcwd() .. '/inotify_tree'
+os.execute('rm -rf ' .. root)
+assert(posix.mkdir(root))
+assert(posix.mkdir(root .. '/a'))
+assert(posix.mkdir(root .. '/a/b'))
+
+handle = inotify.init{buffer = 4096, coalesce = true}
+assert(handle:watch_tree(root, inotify.IN_CLOSE_WRITE, inotify.IN_MODIFY) == 3)
+
+-- a new directory is watched as soon as its creation is read
+assert(posix.mkdir(root .. '/a/b/c'))
+events = handle:read()
+assert(#events == 1 and events[1].path == root .. '/a/b/c')
+assert(handle:getpath(events[1].wd) == root .. '/a/b')
+
+local f = io.open(root .. '/a/b/c/file', 'w')
+for i = 1, 10 do f:write('x') f:flush() end
+f:close()
+events = handle:read()
+local modified = 0
+for _, ev in ipairs(events) do
+    assert(ev.path == root .. '/a/b/c/file')
+    if ev.mask == inotify.IN_MODIFY then modified = modified + 1 end
+end
+assert(modified == 1, 'repeated events were not coalesced')
+
+-- directories moved out of the tree stop being watched, while
+-- directories moved within it stay watched
+local function paths(events)
+    local t = {}
+    for _, ev in ipairs(events) do
+        if ev.path then t[#t+1] = ev.path end
+    end
+    return t
+end
+local outside = posix.getcwd() .. '/inotify_out'
+os.execute('rm -rf ' .. outside)
+assert(posix.mkdir(outside))
+assert(posix.mkdir(root .. '/z'))
+assert(posix.mkdir(root .. '/z/b'))
+handle:read()
+assert(os.rename(root .. '/z', outside .. '/z'))
+local seen = paths(handle:read())
+assert(#seen == 1 and seen[1] == root .. '/z')
+assert(posix.mkdir(outside .. '/z/b/g'))
+assert(posix.mkdir(root .. '/y'))
+seen = paths(handle:read())
+assert(#seen == 1 and seen[1] == root .. '/y', 'moved out directory still watched')
+assert(os.rename(root .. '/y', root .. '/a/y'))
+seen = paths(handle:read())
+assert(#seen == 2 and seen[2] == root .. '/a/y')
+assert(posix.mkdir(root .. '/a/y/h'))
+seen = paths(handle:read())
+assert(#seen == 1 and seen[1] == root .. '/a/y/h', 'moved directory not watched')
+os.execute('rm -rf ' .. outside)
+
+-- removed directories leave the map
+local wd = events[1].wd
+os.execute('rm -rf ' .. root)
+events = handle:read()
+assert(handle:getpath(wd) == nil)
+handle:close()
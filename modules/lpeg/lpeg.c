@@ -55,8 +55,20 @@
 /* initial size for call/backtrack stack */
 #define INITBACK	100
 
-/* default maximum size for call/backtrack stack */
-#define MAXBACK		INITBACK
+/* registry key for arrays kept between matches (see 'checkout') */
+#define ARENAIDX	"lpeg-arena"
+#define ARENACAPS	1
+#define ARENASTACK	2
+
+/* largest capture list or stack, in entries, kept between matches */
+#define MAXARENA	0x10000
+
+/*
+** default maximum size for call/backtrack stack ('lpeg.setmaxstack'
+** changes it). A match starts with INITBACK entries and doubles its
+** stack, reusing the arena, until it reaches this ceiling
+*/
+#define MAXBACK		MAXARENA
 
 /* size for call/backtrack stack for verifier */
 #define MAXBACKVER	200
@@ -372,6 +384,182 @@ static void printcaplist (Capture *cap) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Charset spans
+** =======================================================
+*/
+
+/*
+** Kinds of ISpan instructions, kept in their 'aux' field. For SPANRANGE
+** and SPANCHARS, 'offset' holds two bytes: the range bounds or the (one
+** or two) characters of the set.
+*/
+#define SPANSET		0	/* any set */
+#define SPANRANGE	1	/* one range of characters */
+#define SPANCHARS	2	/* one or two characters */
+
+#define spanlo(p)	((byte)((unsigned short)(p)->i.offset & 0xFF))
+#define spanhi(p)	((byte)((unsigned short)(p)->i.offset >> 8))
+
+/* spans are scanned byte by byte up to this length before using SIMD */
+#define SPANPREFIX	16
+
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#define SPANSIMD
+
+/* -1: unknown; 0: none; 1: SSE2; 2: SSE2 and SSSE3 */
+static int spansimd = -1;
+
+static int getspansimd (void) {
+  if (spansimd < 0) {
+    __builtin_cpu_init();
+    spansimd = !__builtin_cpu_supports("sse2") ? 0
+             : !__builtin_cpu_supports("ssse3") ? 1 : 2;
+  }
+  return spansimd;
+}
+
+
+/* returns the first position in [s, e - 15] not in the span, or where it
+   stopped scanning */
+__attribute__((target("sse2")))
+static const char *spanrange_sse2 (byte lo, byte hi, const char *s,
+                                   const char *e) {
+  const __m128i vlo = _mm_set1_epi8((char)lo);
+  const __m128i vlim = _mm_set1_epi8((char)(hi - lo));
+  for (; e - s >= 16; s += 16) {
+    __m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)s), vlo);
+    __m128i in = _mm_cmpeq_epi8(_mm_max_epu8(v, vlim), vlim);
+    int miss = ~_mm_movemask_epi8(in) & 0xFFFF;
+    if (miss) return s + __builtin_ctz(miss);
+  }
+  return s;
+}
+
+
+__attribute__((target("sse2")))
+static const char *spanchars_sse2 (byte c1, byte c2, const char *s,
+                                   const char *e) {
+  const __m128i v1 = _mm_set1_epi8((char)c1);
+  const __m128i v2 = _mm_set1_epi8((char)c2);
+  for (; e - s >= 16; s += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    __m128i in = _mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2));
+    int miss = ~_mm_movemask_epi8(in) & 0xFFFF;
+    if (miss) return s + __builtin_ctz(miss);
+  }
+  return s;
+}
+
+
+/* transposes an 8x8 bit matrix, one row per byte */
+static unsigned long long transpose8 (unsigned long long x) {
+  unsigned long long t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL; x ^= t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL; x ^= t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL; x ^= t ^ (t << 28);
+  return x;
+}
+
+
+/*
+** Builds the lookup tables of the nibble algorithm: entry 'l' of the
+** first (second) half has bit 'h' set when character 16*h + l (16*(h+8)
+** + l) is in the set.
+*/
+static void nibbletables (const byte *cs, byte *tab) {
+  int half, col, h;
+  for (half = 0; half < 2; half++) {
+    for (col = 0; col < 2; col++) {  /* low nibbles 0-7, then 8-15 */
+      unsigned long long rows = 0;
+      for (h = 0; h < 8; h++)
+        rows |= (unsigned long long)cs[16*half + 2*h + col] << (8*h);
+      rows = transpose8(rows);
+      for (h = 0; h < 8; h++)
+        tab[16*half + 8*col + h] = (byte)(rows >> (8*h));
+    }
+  }
+}
+
+
+__attribute__((target("ssse3")))
+static const char *spanset_ssse3 (const byte *cs, const char *s,
+                                  const char *e) {
+  byte tab[32];
+  __m128i t0, t1, bitsel, m8f, m0f, m80, zero;
+  nibbletables(cs, tab);
+  t0 = _mm_loadu_si128((const __m128i *)tab);
+  t1 = _mm_loadu_si128((const __m128i *)(tab + 16));
+  bitsel = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+                         1, 2, 4, 8, 16, 32, 64, -128);
+  m8f = _mm_set1_epi8((char)0x8F);
+  m0f = _mm_set1_epi8(0x0F);
+  m80 = _mm_set1_epi8((char)0x80);
+  zero = _mm_setzero_si128();
+  for (; e - s >= 16; s += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)s);
+    /* indices with the high bit set select zero, so each table only
+       answers for its half of the characters */
+    __m128i bits = _mm_or_si128(
+        _mm_shuffle_epi8(t0, _mm_and_si128(v, m8f)),
+        _mm_shuffle_epi8(t1, _mm_and_si128(_mm_xor_si128(v, m80), m8f)));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), m0f);
+    __m128i out = _mm_cmpeq_epi8(
+        _mm_and_si128(bits, _mm_shuffle_epi8(bitsel, hi)), zero);
+    int miss = _mm_movemask_epi8(out);
+    if (miss) return s + __builtin_ctz(miss);
+  }
+  return s;
+}
+
+#endif
+
+
+/*
+** Returns the first position in [s, e) whose character is not in the
+** set of ISpan instruction 'p', or 'e'.
+*/
+static const char *span (const Instruction *p, const char *s, const char *e) {
+  const byte *cs = (p+1)->buff;
+  const char *lim = (e - s > SPANPREFIX) ? s + SPANPREFIX : e;
+  for (; s < lim; s++) {  /* most spans are short */
+    if (!testchar(cs, (byte)*s)) return s;
+  }
+#if defined(SPANSIMD)
+  if (e - s >= 16) {
+    int simd = getspansimd();
+    const char *r = s;
+    switch (p->i.aux) {
+      case SPANRANGE:
+        if (simd >= 1) r = spanrange_sse2(spanlo(p), spanhi(p), s, e);
+        break;
+      case SPANCHARS:
+        if (simd >= 1) r = spanchars_sse2(spanlo(p), spanhi(p), s, e);
+        break;
+      default:
+        if (simd >= 2) r = spanset_ssse3(cs, s, e);
+        break;
+    }
+    if ((r - s) & 15) return r;  /* stopped inside a block: a mismatch */
+    s = r;
+  }
+#endif
+  for (; s < e; s++) {
+    if (!testchar(cs, (byte)*s)) break;
+  }
+  return s;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Virtual Machine
@@ -393,13 +581,64 @@ static int runtimecap (lua_State *L, Capture *close, Capture *ocap,
                        const char *o, const char *s, int ptop);
 
 
-static Capture *doublecap (lua_State *L, Capture *cap, int captop, int ptop) {
+/*
+** Capture lists and stacks that outgrew their initial C arrays are kept
+** in an arena (in the registry) after the match, so that later matches
+** needing that much room reuse them instead of allocating again. A match
+** takes an array out of the arena while using it, so nested matches
+** (from match-time captures or capture functions) never share one.
+*/
+static int checkout (lua_State *L, int slot, int n, size_t size) {
+  int len;
+  lua_getfield(L, LUA_REGISTRYINDEX, ARENAIDX);
+  lua_rawgeti(L, -1, slot);
+  len = (int)(lua_objlen(L, -1) / size);
+  if (len > n) {  /* big enough? */
+    lua_pushnil(L);
+    lua_rawseti(L, -3, slot);  /* take it out of the arena */
+    lua_remove(L, -2);  /* leave only the array on the stack */
+    return len;
+  }
+  lua_pop(L, 2);
+  return 0;
+}
+
+
+static void checkin (lua_State *L, int idx, int slot, size_t size) {
+  size_t len = lua_objlen(L, idx);
+  if (lua_type(L, idx) == LUA_TUSERDATA && len / size <= MAXARENA) {
+    lua_getfield(L, LUA_REGISTRYINDEX, ARENAIDX);
+    lua_rawgeti(L, -1, slot);
+    if (lua_objlen(L, -1) < len) {  /* keep the larger one */
+      lua_pushvalue(L, idx);
+      lua_rawseti(L, -3, slot);
+    }
+    lua_pop(L, 2);
+  }
+}
+
+
+/* returns to the arena the arrays grown by the match at 'ptop' */
+static void keeparena (lua_State *L, int ptop) {
+  checkin(L, caplistidx(ptop), ARENACAPS, sizeof(Capture));
+  checkin(L, stackidx(ptop), ARENASTACK, sizeof(Stack));
+}
+
+
+static Capture *doublecap (lua_State *L, Capture *cap, int captop,
+                           int *capsize, int ptop) {
   Capture *newc;
-  if (captop >= INT_MAX/((int)sizeof(Capture) * 2))
-    luaL_error(L, "too many captures");
-  newc = (Capture *)lua_newuserdata(L, captop * 2 * sizeof(Capture));
+  int n = checkout(L, ARENACAPS, captop, sizeof(Capture));
+  if (n == 0) {  /* nothing suitable in the arena? */
+    if (captop >= INT_MAX/((int)sizeof(Capture) * 2))
+      luaL_error(L, "too many captures");
+    n = captop * 2;
+    lua_newuserdata(L, n * sizeof(Capture));
+  }
+  newc = (Capture *)lua_touserdata(L, -1);
   memcpy(newc, cap, captop * sizeof(Capture));
   lua_replace(L, caplistidx(ptop));
+  *capsize = n;
   return newc;
 }
 
@@ -414,8 +653,13 @@ static Stack *doublestack (lua_State *L, Stack **stacklimit, int ptop) {
   lua_pop(L, 1);
   if (n >= max)
     luaL_error(L, "too many pending calls/choices");
-  newn = 2*n; if (newn > max) newn = max;
-  newstack = (Stack *)lua_newuserdata(L, newn * sizeof(Stack));
+  newn = checkout(L, ARENASTACK, n, sizeof(Stack));
+  if (newn == 0) {  /* nothing suitable in the arena? */
+    newn = 2*n;
+    lua_newuserdata(L, newn * sizeof(Stack));
+  }
+  if (newn > max) newn = max;
+  newstack = (Stack *)lua_touserdata(L, -1);
   memcpy(newstack, stack, n * sizeof(Stack));
   lua_replace(L, stackidx(ptop));
   *stacklimit = newstack + newn;
@@ -440,19 +684,52 @@ static void adddyncaptures (const char *s, Capture *base, int n, int fd) {
 }
 
 
+/*
+** State of a match over a stream that stopped for lack of input. The
+** backtrack stack and the capture list stay in their slots of the Lua
+** stack ('stackidx' and 'caplistidx'), from where the caller saves them.
+*/
+typedef struct MatchState {
+  const Instruction *p;  /* where to resume; NULL if not suspended */
+  const char *s;
+  int stacktop, stacksize;
+  int captop, capsize;
+  int eof;  /* no more input will come: the end of subject is final */
+} MatchState;
+
+
 #define condfailed(p)	{ int f = p->i.offset; if (f) p+=f; else goto fail; }
 
+/* true when reaching the end of the subject must wait for more input */
+#define needmore(ms)	((ms) != NULL && !(ms)->eof)
+
+/*
+** 'ms', when not NULL, makes the match resumable: instead of failing
+** for lack of input it stops and returns NULL with 'ms->p' set. A later
+** call with the same 'ms' (and the stack and capture list back in their
+** slots) continues from there.
+*/
 static const char *match (lua_State *L,
                           const char *o, const char *s, const char *e,
-                          Instruction *op, Capture *capture, int ptop) {
+                          Instruction *op, Capture *capture, int ptop,
+                          MatchState *ms) {
   Stack stackbase[INITBACK];
   Stack *stacklimit = stackbase + INITBACK;
   Stack *stack = stackbase;  /* point to first empty slot in stack */
   int capsize = INITCAPSIZE;
   int captop = 0;  /* point to first empty slot in captures */
   const Instruction *p = op;
-  stack->p = &giveup; stack->s = s; stack->caplevel = 0; stack++;
-  lua_pushlightuserdata(L, stackbase);
+  if (ms != NULL && ms->p != NULL) {  /* resuming? */
+    Stack *base = getstackbase(L, ptop);
+    stack = base + ms->stacktop; stacklimit = base + ms->stacksize;
+    captop = ms->captop; capsize = ms->capsize;
+    p = ms->p; s = ms->s;
+    ms->p = NULL;
+  }
+  else {
+    stack->p = &giveup; stack->s = s; stack->caplevel = 0; stack++;
+    lua_pushlightuserdata(L, stackbase);
+  }
   for (;;) {
 #if defined(DEBUG)
       printf("s: |%s| stck: %d c: %d  ",
@@ -478,11 +755,13 @@ static const char *match (lua_State *L,
       case IAny: {
         int n = p->i.aux;
         if (n <= e - s) { p++; s += n; }
+        else if (needmore(ms)) goto suspend;
         else condfailed(p);
         continue;
       }
       case IChar: {
         if ((byte)*s == p->i.aux && s < e) { p++; s++; }
+        else if (s >= e && needmore(ms)) goto suspend;
         else condfailed(p);
         continue;
       }
@@ -490,6 +769,7 @@ static const char *match (lua_State *L,
         int c = (byte)*s;
         if (testchar((p+1)->buff, c) && s < e)
           { p += CHARSETINSTSIZE; s++; }
+        else if (s >= e && needmore(ms)) goto suspend;
         else condfailed(p);
         continue;
       }
@@ -500,10 +780,8 @@ static const char *match (lua_State *L,
         continue;
       }
       case ISpan: {
-        for (; s < e; s++) {
-          int c = (byte)*s;
-          if (!testchar((p+1)->buff, c)) break;
-        }
+        s = span(p, s, e);
+        if (s == e && needmore(ms)) goto suspend;  /* span may go on */
         p += CHARSETINSTSIZE;
         continue;
       }
@@ -589,10 +867,8 @@ static const char *match (lua_State *L,
         captop -= ncap;  /* remove nested captures */
         lua_remove(L, fr);  /* remove first result (offset) */
         if (n > 0) {  /* captures? */
-          if ((captop += n + 1) >= capsize) {
-            capture = doublecap(L, capture, captop, ptop);
-            capsize = 2 * captop;
-          }
+          if ((captop += n + 1) >= capsize)
+            capture = doublecap(L, capture, captop, &capsize, ptop);
           adddyncaptures(s, capture + captop - n - 1, n, fr);
         }
         p++;
@@ -624,10 +900,8 @@ static const char *match (lua_State *L,
         capture[captop].s = s - getoff(p);
         capture[captop].idx = p->i.offset;
         capture[captop].kind = getkind(p);
-        if (++captop >= capsize) {
-          capture = doublecap(L, capture, captop, ptop);
-          capsize = 2 * captop;
-        }
+        if (++captop >= capsize)
+          capture = doublecap(L, capture, captop, &capsize, ptop);
         p++;
         continue;
       }
@@ -635,6 +909,20 @@ static const char *match (lua_State *L,
         lua_rawgeti(L, penvidx(ptop), p->i.offset);
         luaL_error(L, "reference to %s outside a grammar", val2str(L, -1));
       }
+      suspend: {  /* out of input: save the machine for 'ms' */
+        Stack *base = getstackbase(L, ptop);
+        if (base == stackbase) {  /* stack still in the C stack? */
+          base = (Stack *)lua_newuserdata(L, INITBACK * sizeof(Stack));
+          memcpy(base, stackbase, (stack - stackbase) * sizeof(Stack));
+          lua_replace(L, stackidx(ptop));
+          stack = base + (stack - stackbase);
+          stacklimit = base + INITBACK;
+        }
+        ms->p = p; ms->s = s;
+        ms->stacktop = stack - base; ms->stacksize = stacklimit - base;
+        ms->captop = captop; ms->capsize = capsize;
+        return NULL;
+      }
       default: assert(0); return NULL;
     }
   }
@@ -1592,6 +1880,24 @@ static int union_l (lua_State *L) {
 }
 
 
+static void setspankind (Instruction *p) {
+  const byte *cs = (p+1)->buff;
+  int c, n = 0, lo = -1, hi = -1, range = 1;
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    if (testchar(cs, c)) {
+      if (n++ == 0) lo = c;
+      else if (c != hi + 1) range = 0;
+      hi = c;
+    }
+  }
+  if (n == 0 || (n > 2 && !range))
+    setinstaux(p, ISpan, 0, SPANSET);
+  else  /* for one or two characters these are the characters */
+    setinstaux(p, ISpan, (short)(unsigned short)(lo | (hi << 8)),
+               n <= 2 ? SPANCHARS : SPANRANGE);
+}
+
+
 static int repeatcharset (lua_State *L, Charset cs, int l1, int n) {
   /* e; ...; e; span; */
   int i;
@@ -1599,8 +1905,8 @@ static int repeatcharset (lua_State *L, Charset cs, int l1, int n) {
   for (i = 0; i < n; i++) {
     p += addpatt(L, p, 1);
   }
-  setinst(p, ISpan, 0);
   loopset(k, p[1].buff[k] = cs[k]);
+  setspankind(p);
   return 1;
 }
 
@@ -2234,7 +2540,10 @@ static int pushcapture (CapState *cs) {
 }
 
 
-static int getcaptures (lua_State *L, const char *s, const char *r, int ptop) {
+/*
+** Pushes the values of all captures of a match; returns how many
+*/
+static int pushcaptures (lua_State *L, const char *s, int ptop) {
   Capture *capture = (Capture *)lua_touserdata(L, caplistidx(ptop));
   int n = 0;
   if (!isclosecap(capture)) {  /* is there any capture? */
@@ -2245,6 +2554,12 @@ static int getcaptures (lua_State *L, const char *s, const char *r, int ptop) {
       n += pushcapture(&cs);
     } while (!isclosecap(cs.cap));
   }
+  return n;
+}
+
+
+static int getcaptures (lua_State *L, const char *s, const char *r, int ptop) {
+  int n = pushcaptures(L, s, ptop);
   if (n == 0) {  /* no capture values? */
     lua_pushinteger(L, r - s + 1);  /* return only end position */
     n = 1;
@@ -2335,6 +2650,7 @@ static int printpat_l (lua_State *L) {
 static int matchl (lua_State *L) {
   Capture capture[INITCAPSIZE];
   const char *r;
+  int n;
   size_t l;
   Instruction *p = getpatt(L, 1, NULL);
   const char *s = luaL_checklstring(L, SUBJIDX, &l);
@@ -2346,17 +2662,497 @@ static int matchl (lua_State *L) {
   lua_pushnil(L);  /* subscache */
   lua_pushlightuserdata(L, capture);  /* caplistidx */
   lua_getfenv(L, 1);  /* penvidx */
-  r = match(L, s, s + i, s + l, p, capture, ptop);
+  r = match(L, s, s + i, s + l, p, capture, ptop, NULL);
   if (r == NULL) {
+    keeparena(L, ptop);
     lua_pushnil(L);
     return 1;
   }
-  return getcaptures(L, s, r, ptop);
+  n = getcaptures(L, s, r, ptop);
+  keeparena(L, ptop);
+  return n;
 }
 
 
+/*
+** {======================================================
+** Search
+** =======================================================
+*/
+
+#define FINDCACHE	"lpeg-findcache"
+
+/* budget of instructions visited when computing first characters */
+#define FINDBUDGET	256
+
+/* maximum depth of calls followed when computing first characters */
+#define FINDMAXCALLS	16
+
+
+/* how 'find' skips positions where the pattern cannot match */
+#define FINDANY		0	/* no skipping: try every position */
+#define FINDCHAR	1	/* 'memchr' for one character */
+#define FINDSET		2	/* span the complement of a set */
+
+typedef struct FindInfo {
+  int kind;
+  byte c;  /* character for FINDCHAR */
+  Instruction skip[CHARSETINSTSIZE];  /* ISpan for FINDSET */
+} FindInfo;
+
+
+typedef struct CallStack {
+  const Instruction *ret[FINDMAXCALLS];
+  int n;
+} CallStack;
+
+
+/*
+** Adds to 'cs' the characters that may start a match of the code at
+** 'p'. Returns 1 when that code may succeed (or do something this
+** analysis does not follow, like a look-behind or a match-time
+** capture) without consuming a character; 'cs' is then useless.
+*/
+static int firstchars (const Instruction *p, Charset cs, CallStack *calls,
+                       int *budget) {
+  for (;;) {
+    if (--*budget < 0) return 1;
+    switch ((Opcode)p->i.code) {
+      case IAny: {
+        loopset(i, cs[i] = 0xFF);
+        goto check;
+      }
+      case IChar: {
+        setchar(cs, p->i.aux);
+        goto check;
+      }
+      case ISet: {
+        loopset(i, cs[i] |= (p+1)->buff[i]);
+      check:
+        if (p->i.offset == 0) return 0;  /* consumed a character */
+        p += p->i.offset;  /* test: go on where it jumps on failure */
+        continue;
+      }
+      case ISpan: {  /* may consume nothing */
+        loopset(i, cs[i] |= (p+1)->buff[i]);
+        p += CHARSETINSTSIZE;
+        continue;
+      }
+      case IChoice: {
+        CallStack other = *calls;
+        if (p->i.aux != 0 ||
+            firstchars(dest(0, p), cs, &other, budget))
+          return 1;
+        p++;
+        continue;
+      }
+      case ICall: {
+        if (calls->n >= FINDMAXCALLS) return 1;
+        calls->ret[calls->n++] = p + 1;
+        p += p->i.offset;
+        continue;
+      }
+      case IRet: {
+        if (calls->n == 0) return 1;
+        p = calls->ret[--calls->n];
+        continue;
+      }
+      case IJmp: case ICommit: case IPartialCommit: case IBackCommit: {
+        p += p->i.offset;
+        continue;
+      }
+      case IFail: case IFailTwice: case IGiveup:
+        return 0;
+      case IOpenCapture: case ICloseCapture:
+      case IEmptyCapture: case IEmptyCaptureIdx:
+      case IFullCapture: {
+        p++;
+        continue;
+      }
+      default:  /* IEnd, IBack, IFunc, ICloseRunTime, IOpenCall */
+        return 1;
+    }
+  }
+}
+
+
+static void buildfindinfo (const Instruction *p, FindInfo *info) {
+  Charset cs;
+  CallStack calls;
+  int budget = FINDBUDGET;
+  int c, n = 0;
+  calls.n = 0;
+  loopset(i, cs[i] = 0);
+  info->kind = FINDANY;
+  if (firstchars(p, cs, &calls, &budget))
+    return;
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    if (testchar(cs, c)) { n++; info->c = (byte)c; }
+  }
+  if (n == 1)
+    info->kind = FINDCHAR;
+  else if (n <= UCHAR_MAX) {
+    byte *skipset = (info->skip + 1)->buff;
+    info->kind = FINDSET;
+    loopset(i, skipset[i] = ~cs[i]);
+    setspankind(info->skip);
+  }
+}
+
+
+/*
+** Gets the search information of the pattern at 'idx', computing it
+** only once for each pattern
+*/
+static const FindInfo *getfindinfo (lua_State *L, int idx,
+                                    const Instruction *p) {
+  FindInfo *info;
+  lua_getfield(L, LUA_REGISTRYINDEX, FINDCACHE);
+  lua_pushvalue(L, idx);
+  lua_rawget(L, -2);
+  info = (FindInfo *)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  if (info == NULL) {
+    lua_pushvalue(L, idx);
+    info = (FindInfo *)lua_newuserdata(L, sizeof(FindInfo));
+    buildfindinfo(p, info);
+    lua_rawset(L, -3);
+  }
+  lua_pop(L, 1);  /* info stays anchored by the (weak-keyed) cache */
+  return info;
+}
+
+
+/*
+** Searches for the first position in the subject, from 'init' on, where
+** the pattern matches. Returns its start and end, like 'string.find',
+** followed by the values of its captures. Positions where the match
+** would have to start with a character the pattern cannot begin with
+** are skipped without running the matcher.
+*/
+static int findl (lua_State *L) {
+  Capture capture[INITCAPSIZE];
+  const FindInfo *info;
+  const char *r;
+  size_t l;
+  Instruction *p = getpatt(L, 1, NULL);
+  const char *s = luaL_checklstring(L, SUBJIDX, &l);
+  int ptop = lua_gettop(L);
+  lua_Integer ii = luaL_optinteger(L, 3, 1);
+  size_t i = (ii > 0) ?
+             (((size_t)ii <= l) ? (size_t)ii - 1 : l) :
+             (((size_t)-ii <= l) ? l - ((size_t)-ii) : 0);
+  info = getfindinfo(L, 1, p);
+  lua_pushnil(L);  /* subscache */
+  lua_pushlightuserdata(L, capture);  /* caplistidx */
+  lua_getfenv(L, 1);  /* penvidx */
+  for (;;) {
+    if (info->kind == FINDCHAR) {
+      const char *c = (const char *)memchr(s + i, info->c, l - i);
+      if (c == NULL) break;
+      i = c - s;
+    }
+    else if (info->kind == FINDSET) {
+      i = span(info->skip, s + i, s + l) - s;
+      if (i == l) break;  /* a match needs at least one character */
+    }
+    r = match(L, s, s + i, s + l, p, capture, ptop, NULL);
+    if (r != NULL) {
+      int n;
+      lua_pushinteger(L, i + 1);
+      lua_pushinteger(L, r - s);
+      n = pushcaptures(L, s, ptop);
+      keeparena(L, ptop);
+      return n + 2;
+    }
+    keeparena(L, ptop);
+    if (i >= l) break;
+    i++;
+    lua_settop(L, penvidx(ptop));  /* discard what the attempt left */
+    lua_pushlightuserdata(L, capture);  /* capture list may have grown */
+    lua_replace(L, caplistidx(ptop));
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Streams
+** =======================================================
+*/
+
+#define STREAM_T	"lpeg-stream"
+
+/* slots of a stream's environment */
+#define STREAMPATT	1	/* the pattern */
+#define STREAMBUFF	2	/* userdata with the buffered input */
+#define STREAMSTACK	3	/* backtrack stack of a suspended match */
+#define STREAMCAPS	4	/* capture list */
+#define STREAMSOURCE	5	/* function giving more input, or nil */
+
+/* initial size of a stream buffer */
+#define STREAMBUFSIZE	4096
+
+
+typedef struct Stream {
+  char *buff;  /* input still needed: 'len' bytes followed by a '\0' */
+  size_t len, size;
+  size_t discarded;  /* bytes of input dropped before 'buff' */
+  size_t start;  /* input offset where the current match starts */
+  int failed;  /* last match failed; stream is stuck */
+  int lookbehind;  /* how far before its start a match may look */
+  MatchState ms;
+} Stream;
+
+
+#define checkstream(L, idx)	((Stream *)luaL_checkudata(L, idx, STREAM_T))
+
+
+/*
+** Moves every position saved by a suspended match from 'from' to 'to',
+** as the buffer contents moved. 'env' is the stream environment.
+*/
+static void rebase (lua_State *L, Stream *st, int env, const char *from,
+                    const char *to) {
+  int i;
+  if (st->ms.p == NULL) return;
+  st->ms.s = to + (st->ms.s - from);
+  lua_rawgeti(L, env, STREAMSTACK);
+  {
+    Stack *stack = (Stack *)lua_touserdata(L, -1);
+    stack[0].s = to;  /* bottom entry only gives up; position is unused */
+    for (i = 1; i < st->ms.stacktop; i++)
+      if (stack[i].s != NULL)  /* not a call? */
+        stack[i].s = to + (stack[i].s - from);
+  }
+  lua_rawgeti(L, env, STREAMCAPS);
+  {
+    Capture *capture = (Capture *)lua_touserdata(L, -1);
+    for (i = 0; i < st->ms.captop; i++)
+      capture[i].s = to + (capture[i].s - from);
+  }
+  lua_pop(L, 2);
+}
+
+
+/*
+** Drops the buffered input that no match can use anymore: everything
+** before the current match start, or, inside a suspended match, before
+** the oldest position of a pending choice or capture; plus some slack
+** for look-behinds.
+*/
+static void compact (lua_State *L, Stream *st, int env) {
+  size_t keep = st->start - st->discarded;
+  int i;
+  if (st->ms.p != NULL) {
+    keep = st->ms.s - st->buff;
+    lua_rawgeti(L, env, STREAMSTACK);
+    {
+      Stack *stack = (Stack *)lua_touserdata(L, -1);
+      for (i = 1; i < st->ms.stacktop; i++)
+        if (stack[i].s != NULL && (size_t)(stack[i].s - st->buff) < keep)
+          keep = stack[i].s - st->buff;
+    }
+    lua_rawgeti(L, env, STREAMCAPS);
+    {
+      Capture *capture = (Capture *)lua_touserdata(L, -1);
+      for (i = 0; i < st->ms.captop; i++)
+        if ((size_t)(capture[i].s - st->buff) < keep)
+          keep = capture[i].s - st->buff;
+    }
+    lua_pop(L, 2);
+  }
+  keep = (keep > (size_t)st->lookbehind) ? keep - st->lookbehind : 0;
+  if (keep > 0) {
+    rebase(L, st, env, st->buff + keep, st->buff);
+    memmove(st->buff, st->buff + keep, st->len - keep + 1);
+    st->len -= keep;
+    st->discarded += keep;
+  }
+}
+
+
+/* appends 'l' bytes to the buffer; 'env' is the stream environment */
+static void addinput (lua_State *L, Stream *st, int env,
+                      const char *s, size_t l) {
+  if (st->len + l >= st->size) {
+    compact(L, st, env);
+    if (st->len + l >= st->size) {  /* still no room? */
+      size_t newsize = st->size * 2;
+      char *newbuff;
+      if (newsize <= st->len + l) newsize = st->len + l + 1;
+      newbuff = (char *)lua_newuserdata(L, newsize);
+      memcpy(newbuff, st->buff, st->len + 1);
+      rebase(L, st, env, st->buff, newbuff);
+      lua_rawseti(L, env, STREAMBUFF);
+      st->buff = newbuff;
+      st->size = newsize;
+    }
+  }
+  memcpy(st->buff + st->len, s, l);
+  st->len += l;
+  st->buff[st->len] = '\0';
+}
+
+
+static int stream_l (lua_State *L) {
+  Stream *st;
+  int size, i;
+  Instruction *p = getpatt(L, 1, &size);
+  if (!lua_isnoneornil(L, 2))
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+  lua_settop(L, 2);
+  st = (Stream *)lua_newuserdata(L, sizeof(Stream));
+  st->lookbehind = 0;
+  for (i = 0; i < size; i += sizei(p + i)) {
+    if (p[i].i.code == ICloseRunTime)
+      luaL_argerror(L, 1, "match-time captures are not supported");
+    else if (p[i].i.code == IBack && p[i].i.aux > st->lookbehind)
+      st->lookbehind = p[i].i.aux;
+  }
+  st->len = st->discarded = st->start = 0;
+  st->size = STREAMBUFSIZE;
+  st->failed = 0;
+  st->ms.p = NULL; st->ms.eof = 0;
+  luaL_getmetatable(L, STREAM_T);
+  lua_setmetatable(L, -2);
+  lua_createtable(L, 5, 0);
+  lua_pushvalue(L, 1);
+  lua_rawseti(L, -2, STREAMPATT);
+  st->buff = (char *)lua_newuserdata(L, st->size);
+  st->buff[0] = '\0';
+  lua_rawseti(L, -2, STREAMBUFF);
+  lua_newuserdata(L, INITCAPSIZE * sizeof(Capture));
+  lua_rawseti(L, -2, STREAMCAPS);
+  lua_pushvalue(L, 2);
+  lua_rawseti(L, -2, STREAMSOURCE);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+
+/*
+** Adds a chunk of input to the stream; without a chunk (or with nil),
+** marks the end of the input
+*/
+static int stream_feed (lua_State *L) {
+  Stream *st = checkstream(L, 1);
+  size_t l;
+  const char *s = luaL_optlstring(L, 2, NULL, &l);
+  if (st->ms.eof)
+    luaL_error(L, "stream already ended");
+  lua_settop(L, 2);
+  lua_getfenv(L, 1);
+  if (s == NULL)
+    st->ms.eof = 1;
+  else
+    addinput(L, st, 3, s, l);
+  lua_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** Matches the pattern from where the previous match ended, resuming a
+** match that ran out of input. Returns the captures, or the position
+** after the match (positions count from the start of the input); nil if
+** the match failed; or nil plus "more" when the match needs more input
+** and the stream has no source to pull it from.
+*/
+static int stream_match (lua_State *L) {
+  Stream *st = checkstream(L, 1);
+  int ptop = FIXEDARGS;  /* no extra arguments for 'Carg' */
+  for (;;) {
+    const char *r;
+    Capture *capture;
+    Instruction *p;
+    if (st->failed) {
+      lua_pushnil(L);
+      return 1;
+    }
+    lua_settop(L, 1);
+    lua_getfenv(L, 1);
+    lua_rawgeti(L, 2, STREAMPATT);  /* 'ptop' */
+    p = (Instruction *)lua_touserdata(L, -1);
+    lua_pushnil(L);  /* subscache */
+    lua_rawgeti(L, 2, STREAMCAPS);  /* caplistidx */
+    capture = (Capture *)lua_touserdata(L, -1);
+    lua_getfenv(L, 3);  /* penvidx */
+    if (st->ms.p != NULL)  /* resuming? */
+      lua_rawgeti(L, 2, STREAMSTACK);  /* stackidx */
+    r = match(L, st->buff, st->buff + (st->start - st->discarded),
+              st->buff + st->len, p, capture, ptop, &st->ms);
+    lua_pushvalue(L, caplistidx(ptop));  /* keep list for next time */
+    lua_rawseti(L, 2, STREAMCAPS);
+    if (r != NULL) {
+      const char *origin = st->buff - st->discarded;
+      st->start = r - origin;
+      lua_pushnil(L);  /* release the stack of a suspended match */
+      lua_rawseti(L, 2, STREAMSTACK);
+      return getcaptures(L, origin, r, ptop);
+    }
+    else if (st->ms.p == NULL) {  /* failed */
+      st->failed = 1;
+      continue;
+    }
+    lua_pushvalue(L, stackidx(ptop));
+    lua_rawseti(L, 2, STREAMSTACK);
+    lua_rawgeti(L, 2, STREAMSOURCE);
+    if (lua_isnil(L, -1)) {
+      lua_pushnil(L);
+      lua_pushliteral(L, "more");
+      return 2;
+    }
+    lua_call(L, 0, 1);  /* get next chunk */
+    if (lua_isnil(L, -1))
+      st->ms.eof = 1;
+    else {
+      size_t l;
+      const char *s = lua_tolstring(L, -1, &l);
+      if (s == NULL)
+        luaL_error(L, "stream source must return strings or nil");
+      addinput(L, st, 2, s, l);
+    }
+  }
+}
+
+
+/* returns the input position where the next match starts */
+static int stream_position (lua_State *L) {
+  Stream *st = checkstream(L, 1);
+  lua_pushinteger(L, st->start + 1);
+  return 1;
+}
+
+
+/* returns how many bytes of input the stream holds and has discarded */
+static int stream_buffered (lua_State *L) {
+  Stream *st = checkstream(L, 1);
+  lua_pushinteger(L, st->len);
+  lua_pushinteger(L, st->discarded);
+  return 2;
+}
+
+
+static struct luaL_Reg streamreg[] = {
+  {"feed", stream_feed},
+  {"match", stream_match},
+  {"position", stream_position},
+  {"buffered", stream_buffered},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
 static struct luaL_Reg pattreg[] = {
   {"match", matchl},
+  {"find", findl},
+  {"stream", stream_l},
   {"print", printpat_l},
   {"locale", locale_l},
   {"setmaxstack", setmax},
@@ -2397,6 +3193,19 @@ int luaopen_lpeg (lua_State *L);
 int luaopen_lpeg (lua_State *L) {
   lua_pushcfunction(L, (lua_CFunction)&l_newpf);  /* new-pattern function */
   lua_setfield(L, LUA_REGISTRYINDEX, KEYNEWPATT);  /* register it */
+  lua_newtable(L);  /* cache of search information, weak in patterns */
+  lua_createtable(L, 0, 1);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_setfield(L, LUA_REGISTRYINDEX, FINDCACHE);
+  lua_createtable(L, 2, 0);
+  lua_setfield(L, LUA_REGISTRYINDEX, ARENAIDX);
+  luaL_newmetatable(L, STREAM_T);
+  luaL_register(L, NULL, streamreg);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, -2, "__index");
+  lua_pop(L, 1);
   luaL_newmetatable(L, PATTERN_T);
   lua_pushnumber(L, MAXBACK);
   lua_setfield(L, LUA_REGISTRYINDEX, MAXSTACKIDX);
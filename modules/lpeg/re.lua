@@ -211,14 +211,19 @@ local function match (s, p, i)
   return cp:match(s, i or 1)
 end
 
+-- drops the end position returned by 'find'
+local function dropend (i, e, ...)
+  if i then return i, ... end
+  return nil
+end
+
 local function find (s, p, i)
   local cp = fmem[p]
   if not cp then
     cp = compile(p)
-    cp = mm.P{ mm.Cp() * cp + 1 * mm.V(1) }
     fmem[p] = cp
   end
-  return cp:match(s, i or 1)
+  return dropend(cp:find(s, i or 1))
 end
 
 local function gsub (s, p, rep)
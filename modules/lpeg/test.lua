@@ -269,6 +269,118 @@ assert(m.match(m.P"ab" + "cd" + m.P"e"^1 + "x", "cd") == 3)
 assert(m.match(m.P"ab" + "cd" + m.P"e"^1 + "x", "x") == 2)
 assert(m.match(m.P"ab" + "cd" + m.P"e"^1 + "x" + "", "zee") == 1)
 
+-- long spans, stopping at every position of a block
+do
+  local sets = {
+    {m.R"az", "q", "A"},                          -- one range
+    {m.S"x", "x", "y"},                           -- one character
+    {m.S"\0\255", "\255", "\254"},              -- two characters
+    {m.R"az" + m.R"09" + m.S"\128\200_", "\200", "-"}, -- any set
+  }
+  for _, t in ipairs(sets) do
+    local p, c, bad = t[1]^0, t[2], t[3]
+    for n = 0, 70 do
+      assert(p:match(string.rep(c, n) .. bad .. c) == n + 1)
+      assert(p:match(string.rep(c, n)) == n + 1)
+      assert(p:match(bad .. string.rep(c, n), 2) == n + 2)
+    end
+  end
+end
+
+-- searching
+local function checkfind (s, p, ...)
+  local t = {m.find(p, s, ...)}
+  return table.concat(t, ",")
+end
+assert(checkfind("hello world", "o") == "5,5")
+assert(checkfind("hello world", "wor") == "7,9")
+assert(checkfind("hello world", "o", 6) == "8,8")
+assert(checkfind("hello world", "o", -3) == "")
+assert(m.find("x", "hello world") == nil)
+assert(checkfind("abc", true, 2) == "2,1")
+assert(checkfind("abc", -m.P(1)) == "4,3")
+assert(checkfind("...b...a", m.P"a" + "b") == "4,4")
+assert(checkfind("aaab", 1 - m.P"a") == "4,4")
+assert(checkfind("  123 abc", m.P{ m.V"num", num = m.R"09"^1 }) == "3,5")
+assert(checkfind("x = key = value", m.C(m.R"az"^1) * " = " * m.C(m.R"az"^1))
+       == "1,7,x,key")
+assert(checkfind("x = key = value",
+                 m.C(m.R"az"^2) * " = " * m.C(m.R"az"^1)) == "5,15,key,value")
+assert(checkfind("abc", m.Carg(1) * "b", 1, "x") == "2,2,x")
+assert(checkfind("abc", m.Cg(m.C"b", "k") * "c") == "2,3")
+assert(checkfind(string.rep(" ", 1000) .. "zy", m.S"xyz"^1) == "1001,1002")
+assert(m.find(m.S"xy", string.rep("a", 1000)) == nil)
+assert(("abcb"):find("b", 3) == m.P"b":find("abcb", 3))
+do   -- compare with a grammar that tries every position
+  local pats = {m.P"ab", m.S"ab" * "c", m.P"b"^0 * "c", m.R"ac"^1 * -m.P"b",
+                m.P"a" + m.P"b" * "b", (m.P"ca" + "cb") * 1, #m.P"b" * 1}
+  local chars = {"a", "b", "c", "d"}
+  math.randomseed(7)
+  for _, p in ipairs(pats) do
+    local g = m.P{ m.Cp() * m.C(p) * m.Cp() + 1 * m.V(1) }
+    for n = 1, 200 do
+      local t = {}
+      for i = 1, math.random(0, 40) do t[i] = chars[math.random(#chars)] end
+      local s = table.concat(t)
+      local i, c, e = g:match(s)
+      local fi, fe = m.find(m.C(p), s)
+      assert(fi == i and (not i or (fe == e - 1 and s:sub(fi, fe) == c)))
+    end
+  end
+end
+
+-- streams
+do
+  local line = m.C((1 - m.P"\n")^0) * "\n"
+  local st = m.stream(line)
+  local r, more = st:match()
+  assert(r == nil and more == "more")
+  st:feed("ab")
+  assert(select(2, st:match()) == "more")
+  st:feed("c\nde")
+  assert(st:match() == "abc" and st:position() == 5)
+  assert(select(2, st:match()) == "more")
+  st:feed("f\n"):feed()
+  assert(st:match() == "def")
+  r, more = st:match()
+  assert(r == nil and more == nil)
+  assert(not pcall(st.feed, st, "x"))
+
+  -- backtracking over chunk boundaries, one byte at a time
+  local function source (s, n)
+    local i = 1
+    return function ()
+      local c = s:sub(i, i + n - 1)
+      i = i + n
+      return c ~= "" and c or nil
+    end
+  end
+  st = m.stream(m.C(m.P"abcx" + "abcy") * m.Cp(), source("abcyabcx", 1))
+  assert(select(2, st:match()) == 5)
+  local c, p = st:match()
+  assert(c == "abcx" and p == 9)
+  assert(st:match() == nil)
+
+  -- the buffer keeps only what pending matches may need
+  local s = string.rep("key=value;", 10000)
+  local rec = m.Cp() * m.C(m.R"az"^1) * "=" * m.C(m.R"az"^1) * ";"
+  st = m.stream(rec, source(s, 1000))
+  for i = 1, 10000 do
+    local pos, k, v = st:match()
+    assert(pos == 10 * i - 9 and k == "key" and v == "value")
+  end
+  assert(st:match() == nil and st:position() == #s + 1)
+  local len, discarded = st:buffered()
+  assert(len < 4096 and len + discarded == #s)
+
+  -- a single match over many chunks
+  st = m.stream(m.Ct((m.C(m.R"az"^1) * m.S"=;")^0) * -1, source(s, 7))
+  local t = st:match()
+  assert(#t == 20000 and t[1] == "key" and t[20000] == "value")
+
+  assert(not pcall(m.stream, m.Cmt(1, function () return true end)))
+end
+
 pi = "3.14159 26535 89793 23846 26433 83279 50288 41971 69399 37510"
 assert(m.match(m.Cs((m.P"1" / "a" + m.P"5" / "b" + m.P"9" / "c" + 1)^0), pi) ==
   m.match(m.Cs((m.P(1) / {["1"] = "a", ["5"] = "b", ["9"] = "c"})^0), pi))
@@ -503,6 +615,27 @@ m.setmaxstack(2*lim)
 assert(not pcall(m.match, p, string.rep("0", lim)))
 m.setmaxstack(2*lim + 2)
 assert(pcall(m.match, p, string.rep("0", lim)))
+-- by default the stack grows well past its initial size
+package.loaded.lpeg = nil
+assert(pcall(require"lpeg".match, p, string.rep("0", lim)))
+package.loaded.lpeg = m
+m.setmaxstack(2*lim + 2)
+
+-- arrays grown by a match are reused by later (and nested) matches
+do
+  local inner = m.Ct(m.C(1)^0)
+  local function count (c) return #inner:match(string.rep(c, 100)) end
+  local outer = m.Ct((m.C(1) / count)^0)
+  for i = 1, 3 do
+    local t = outer:match(string.rep("x", 200))
+    assert(#t == 200 and t[1] == 100 and t[200] == 100)
+    assert(pcall(m.match, p, string.rep("0", lim)))
+  end
+  outer = m.Ct((m.C(1) * m.Cmt(0, function () return count"y" == 100 end))^0)
+  local t = outer:match(string.rep("x", 200))
+  assert(#t == 200 and t[200] == "x")
+  assert(m.find(outer, string.rep("x", 200)))
+end
 
 -- tests for optional start position
 assert(m.match("a", "abc", 1))
@@ -0,0 +1,101 @@
+
+-- Measures insert, lookup and scan speed under different page cache,
+-- memory-mapping and journal settings, with the page cache hit rate
+-- reported by db:status().
+--
+-- usage: lua benchmark.lua [rows]
+
+require("lsqlite3")
+
+local ROWS = tonumber(arg and arg[1]) or 100000
+local LOOKUPS = ROWS
+
+local settings = {
+  { name = "default" },
+  { name = "small cache", cache = 100 },
+  { name = "large cache", cache = -65536 },
+  { name = "mmap 256MB", mmap = 268435456 },
+  { name = "wal", journal = "wal" },
+  { name = "wal + mmap", journal = "wal", mmap = 268435456 },
+}
+
+local function hit_rate(db)
+  local st = db:status(true)
+  local total = st.cache_hit + st.cache_miss
+  return total > 0 and 100 * st.cache_hit / total or 0
+end
+
+-- wall-clock time, since os.clock() leaves out the time spent waiting on
+-- I/O; without LuaSocket only whole seconds are available
+local ok, socket = pcall(require, "socket")
+local now = ok and socket.gettime or os.time
+
+local function timed(f)
+  local t = now()
+  f()
+  return math.max(now() - t, 1e-6)
+end
+
+local function run(s)
+  local file = os.tmpname()
+  local db = assert( sqlite3.open(file) )
+  if s.journal then db:journal_mode(s.journal) end
+  if s.cache then db:page_cache_size(s.cache) end
+  if s.mmap then db:mmap_size(s.mmap) end
+  db:exec "CREATE TABLE test (id INTEGER PRIMARY KEY, name TEXT, value REAL)"
+
+  local rows = {}
+  for i = 1, ROWS do
+    rows[i] = { i, "name " .. i, i * 0.5 }
+  end
+  local results = {}
+
+  local stmt = db:prepare "INSERT INTO test VALUES (?, ?, ?)"
+  db:status(true)
+  results.insert = ROWS / timed(function()
+    assert( stmt:executemany(rows) == sqlite3.OK )
+  end)
+  results.insert_hits = hit_rate(db)
+  stmt:finalize()
+
+  -- start the lookups and scans with a cold page cache
+  db:close()
+  db = assert( sqlite3.open(file) )
+  if s.cache then db:page_cache_size(s.cache) end
+  if s.mmap then db:mmap_size(s.mmap) end
+
+  stmt = db:prepare "SELECT name FROM test WHERE id = ?"
+  math.randomseed(42)
+  db:status(true)
+  results.lookup = LOOKUPS / timed(function()
+    for i = 1, LOOKUPS do
+      stmt:bind_values(math.random(ROWS))
+      stmt:step()
+      stmt:reset()
+    end
+  end)
+  results.lookup_hits = hit_rate(db)
+  stmt:finalize()
+
+  stmt = db:prepare "SELECT id, name, value FROM test"
+  local row = {}
+  results.scan = ROWS / timed(function()
+    while stmt:fetch_into(row) do end
+  end)
+  results.scan_hits = hit_rate(db)
+  stmt:finalize()
+
+  db:close()
+  os.remove(file)
+  os.remove(file .. "-wal")
+  os.remove(file .. "-shm")
+  return results
+end
+
+print(("%d rows, %d random lookups (rows/sec, page cache hit rate)"):format(ROWS, LOOKUPS))
+print(("%-14s %16s %16s %16s"):format("setting", "insert", "lookup", "scan"))
+for _, s in ipairs(settings) do
+  local r = run(s)
+  print(("%-14s %10.0f %4.0f%% %10.0f %4.0f%% %10.0f %4.0f%%"):format(s.name,
+    r.insert, r.insert_hits, r.lookup, r.lookup_hits, r.scan, r.scan_hits))
+end
@@ -28,8 +28,15 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
+#ifndef WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
 #define LUA_LIB
 #include "lua.h"
 #include "lauxlib.h"
@@ -50,11 +57,16 @@ static int luaL_typerror (lua_State *L, int narg, const char *tname) {
 
 #if LUA_VERSION_NUM > 501
 #define lua_strlen lua_rawlen
+#else
+#define lua_getuservalue lua_getfenv
+#define lua_setuservalue lua_setfenv
 #endif
 
 typedef struct sdb sdb;
 typedef struct sdb_vm sdb_vm;
 typedef struct sdb_func sdb_func;
+typedef struct sdb_stmt sdb_stmt;
+typedef struct sdb_blob sdb_blob;
 
 /* to use as C user data so i know what function sqlite is calling */
 struct sdb_func {
@@ -69,6 +81,19 @@ struct sdb_func {
     sdb_func *next;
 };
 
+/* a reset statement kept for reuse, keyed by its sql text */
+struct sdb_stmt {
+    sqlite3_stmt *vm;
+    int tail;               /* offset of the sql text not compiled */
+    unsigned int hash;
+    size_t len;
+    sdb_stmt *prev, *next;  /* most recently used first */
+    char sql[1];
+};
+
+/* default number of statements kept by a database */
+#define LSQLITE_CACHE_SIZE 16
+
 /* information about database */
 struct sdb {
     /* associated lua state */
@@ -88,13 +113,111 @@ struct sdb {
 
     int trace_cb;       /* trace callback */
     int trace_udata;
+
+    /* settings handed on to background workers */
+    int busy_timeout;   /* milliseconds, 0 if not set */
+    int progress_ops;   /* opcodes between progress checks, 0 if not set */
+
+    /* prepared statement cache */
+    sdb_stmt *cache;
+    int cache_size;
+    int cache_count;
+    double cache_hits;
+    double cache_misses;
+
+    /* open blob handles, closed with the database */
+    sdb_blob *blobs;
 };
 
 static const char *sqlite_meta      = ":sqlite3";
 static const char *sqlite_vm_meta   = ":sqlite3:vm";
 static const char *sqlite_ctx_meta  = ":sqlite3:ctx";
+static const char *sqlite_blob_meta = ":sqlite3:blob";
+static const char *sqlite_async_meta  = ":sqlite3:async";
+static const char *sqlite_future_meta = ":sqlite3:future";
 static int sqlite_ctx_meta_ref;
 
+/*
+** =======================================================
+** Prepared Statement Cache
+** =======================================================
+*/
+
+static unsigned int stmt_hash(const char *sql, size_t len) {
+    unsigned int h = 2166136261u;
+    while (len--)
+        h = (h ^ (unsigned char)*sql++) * 16777619u;
+    return h;
+}
+
+static void stmt_unlink(sdb *db, sdb_stmt *st) {
+    if (st->prev) st->prev->next = st->next;
+    else db->cache = st->next;
+    if (st->next) st->next->prev = st->prev;
+    db->cache_count--;
+}
+
+/* finalizes the least recently used statements beyond the cache size */
+static void stmt_trim(sdb *db) {
+    while (db->cache_count > db->cache_size) {
+        sdb_stmt *st = db->cache;
+        while (st->next) st = st->next;
+        stmt_unlink(db, st);
+        sqlite3_finalize(st->vm);
+        free(st);
+    }
+}
+
+/*
+** Like sqlite3_prepare, but takes the statement out of the cache when
+** one for the same sql text is there.
+*/
+static int stmt_prepare(sdb *db, const char *sql, int len, sqlite3_stmt **vm, const char **tail) {
+    if (db->cache_size > 0) {
+        unsigned int h = stmt_hash(sql, len);
+        sdb_stmt *st;
+        for (st = db->cache; st; st = st->next) {
+            if (st->hash == h && st->len == (size_t)len && memcmp(st->sql, sql, len) == 0) {
+                *vm = st->vm;
+                if (tail) *tail = sql + st->tail;
+                stmt_unlink(db, st);
+                free(st);
+                db->cache_hits++;
+                return SQLITE_OK;
+            }
+        }
+        db->cache_misses++;
+    }
+    return sqlite3_prepare(db->db, sql, len, vm, tail);
+}
+
+/*
+** Hands back a statement prepared by stmt_prepare: resets it and keeps it
+** in the cache, or finalizes it when the cache is off. Returns what
+** sqlite3_finalize would.
+*/
+static int stmt_release(sdb *db, const char *sql, size_t len, int tail, sqlite3_stmt *vm) {
+    sdb_stmt *st;
+    int result;
+    if (db->cache_size == 0 || db->db == NULL || sql == NULL ||
+        (st = (sdb_stmt*)malloc(sizeof(sdb_stmt) + len)) == NULL)
+        return sqlite3_finalize(vm);
+    result = sqlite3_reset(vm);
+    sqlite3_clear_bindings(vm);
+    st->vm = vm;
+    st->tail = tail;
+    st->hash = stmt_hash(sql, len);
+    st->len = len;
+    memcpy(st->sql, sql, len);
+    st->prev = NULL;
+    st->next = db->cache;
+    if (db->cache) db->cache->prev = st;
+    db->cache = st;
+    db->cache_count++;
+    stmt_trim(db);
+    return result;
+}
+
 /*
 ** =======================================================
 ** Database Virtual Machine Operations
@@ -141,6 +264,7 @@ struct sdb_vm {
     char has_values;        /* true when step succeeds */
 
     char temp;              /* temporary vm used in db:rows */
+    int tail;               /* offset of the sql text not compiled */
 };
 
 /* called with sql text on the lua stack */
@@ -155,6 +279,7 @@ static sdb_vm *newvm(lua_State *L, sdb *db) {
     svm->has_values = 0;
     svm->vm = NULL;
     svm->temp = 0;
+    svm->tail = 0;
 
     /* add an entry on the database table: svm -> sql text */
     lua_pushlightuserdata(L, db);
@@ -168,21 +293,30 @@ static sdb_vm *newvm(lua_State *L, sdb *db) {
 }
 
 static int cleanupvm(lua_State *L, sdb_vm *svm) {
+    int result;
+
     /* remove entry in database table - no harm if not present in the table */
     lua_pushlightuserdata(L, svm->db);
     lua_rawget(L, LUA_REGISTRYINDEX);
     lua_pushlightuserdata(L, svm);
+    lua_rawget(L, -2); /* sql text, to key the statement cache */
+    lua_pushlightuserdata(L, svm);
     lua_pushnil(L);
-    lua_rawset(L, -3);
-    lua_pop(L, 1);
+    lua_rawset(L, -4);
 
     svm->columns = 0;
     svm->has_values = 0;
 
-    if (!svm->vm) return 0;
+    if (!svm->vm) {
+        lua_pop(L, 2);
+        return 0;
+    }
 
-    lua_pushnumber(L, sqlite3_finalize(svm->vm));
+    /* finalize, or keep for reuse */
+    result = stmt_release(svm->db, lua_tostring(L, -1), lua_strlen(L, -1), svm->tail, svm->vm);
     svm->vm = NULL;
+    lua_pop(L, 2);
+    lua_pushnumber(L, result);
     return 1;
 }
 
@@ -306,6 +440,55 @@ static int dbvm_columns(lua_State *L) {
     return 1;
 }
 
+static const struct {
+    const char *name;
+    int op;
+} stmt_status_counters[] = {
+    { "fullscan_step",  SQLITE_STMTSTATUS_FULLSCAN_STEP },
+    { "sort",           SQLITE_STMTSTATUS_SORT          },
+    { "autoindex",      SQLITE_STMTSTATUS_AUTOINDEX     },
+#ifdef SQLITE_STMTSTATUS_VM_STEP
+    { "vm_step",        SQLITE_STMTSTATUS_VM_STEP       },
+#endif
+#ifdef SQLITE_STMTSTATUS_REPREPARE
+    { "reprepare",      SQLITE_STMTSTATUS_REPREPARE     },
+    { "run",            SQLITE_STMTSTATUS_RUN           },
+#endif
+#ifdef SQLITE_STMTSTATUS_FILTER_MISS
+    { "filter_miss",    SQLITE_STMTSTATUS_FILTER_MISS   },
+    { "filter_hit",     SQLITE_STMTSTATUS_FILTER_HIT    },
+#endif
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+    { "memused",        SQLITE_STMTSTATUS_MEMUSED       },
+#endif
+    { NULL, 0 }
+};
+
+/*
+** Params: stmt[, reset]
+** returns: table of the statement's performance counters by name; the
+** counters are zeroed afterwards if reset is true
+*/
+static int dbvm_status(lua_State *L) {
+    sdb_vm *svm = lsqlite_checkvm(L, 1);
+    int reset = lua_toboolean(L, 2);
+    int i;
+
+    lua_newtable(L);
+    for (i = 0; stmt_status_counters[i].name; ++i) {
+        int op = stmt_status_counters[i].op;
+#ifdef SQLITE_STMTSTATUS_MEMUSED
+        /* not a counter */
+        int value = sqlite3_stmt_status(svm->vm, op, reset && op != SQLITE_STMTSTATUS_MEMUSED);
+#else
+        int value = sqlite3_stmt_status(svm->vm, op, reset);
+#endif
+        lua_pushnumber(L, value);
+        lua_setfield(L, -2, stmt_status_counters[i].name);
+    }
+    return 1;
+}
+
 /*
 ** =======================================================
 ** Virtual Machine - getters
@@ -566,6 +749,121 @@ static int dbvm_bind_names(lua_State *L) {
     return 1;
 }
 
+/*
+** Binds the values of the row table at 'row' like stmt:bind_names does.
+** Unlike dbvm_bind_index, never raises an error: on failure leaves an
+** error message on the stack and returns the error code.
+*/
+static int dbvm_bind_row(lua_State *L, sqlite3_stmt *vm, int row) {
+    int count = sqlite3_bind_parameter_count(vm);
+    const char *name;
+    int result, n;
+
+    for (n = 1; n <= count; ++n) {
+        name = sqlite3_bind_parameter_name(vm, n);
+        if (name && (name[0] == ':' || name[0] == '$'))
+            lua_getfield(L, row, name + 1);
+        else
+            lua_rawgeti(L, row, n);
+
+        switch (lua_type(L, -1)) {
+            case LUA_TSTRING: case LUA_TNUMBER: case LUA_TBOOLEAN: case LUA_TNIL:
+                result = dbvm_bind_index(L, vm, n, -1);
+                break;
+            default:
+                lua_pushfstring(L, "index (%d) - invalid data type for bind (%s)",
+                    n, luaL_typename(L, -1));
+                return SQLITE_MISMATCH;
+        }
+        lua_pop(L, 1);
+
+        if (result != SQLITE_OK) {
+            lua_pushstring(L, sqlite3_errmsg(sqlite3_db_handle(vm)));
+            return result;
+        }
+    }
+    return SQLITE_OK;
+}
+
+/*
+** Binds and steps the statement once for each row table in the array at
+** 'rows', inside a transaction unless one is already open.
+** Returns: sqlite3.OK and the number of rows, or on failure an error code,
+** the index of the failing row (0 if the transaction could not start or
+** end) and an error message. A failed batch is rolled back when it runs
+** in its own transaction.
+*/
+static int dbvm_do_many(lua_State *L, sdb_vm *svm, int rows) {
+    sqlite3 *db = svm->db->db;
+    int n = lua_strlen(L, rows);
+    int began = 0;
+    int result = SQLITE_OK;
+    int top, i;
+
+    if (sqlite3_get_autocommit(db)) {
+        result = sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+        if (result != SQLITE_OK) {
+            lua_pushnumber(L, result);
+            lua_pushnumber(L, 0);
+            lua_pushstring(L, sqlite3_errmsg(db));
+            return 3;
+        }
+        began = 1;
+    }
+
+    top = lua_gettop(L);
+    for (i = 1; i <= n; ++i) {
+        lua_rawgeti(L, rows, i);
+        if (!lua_istable(L, -1)) {
+            lua_pushfstring(L, "row is not a table (%s)", luaL_typename(L, -1));
+            result = SQLITE_MISMATCH;
+        }
+        else if ((result = dbvm_bind_row(L, svm->vm, top + 1)) == SQLITE_OK) {
+            result = stepvm(L, svm);
+            if (result == SQLITE_DONE || result == SQLITE_ROW)
+                result = sqlite3_reset(svm->vm);
+            else if (result != SQLITE_OK) /* stepvm may have reset it */
+                lua_pushstring(L, sqlite3_errmsg(db));
+        }
+        if (result != SQLITE_OK) {
+            lua_replace(L, top + 1);    /* keep only the message */
+            lua_settop(L, top + 1);
+            break;
+        }
+        lua_settop(L, top);
+    }
+    svm->has_values = 0;
+
+    if (result != SQLITE_OK) {
+        sqlite3_reset(svm->vm);
+        if (began)
+            sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        lua_pushnumber(L, result);
+        lua_pushnumber(L, i);
+        lua_pushvalue(L, top + 1);
+        return 3;
+    }
+
+    if (began && (result = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL)) != SQLITE_OK) {
+        lua_pushnumber(L, result);
+        lua_pushnumber(L, 0);
+        lua_pushstring(L, sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+        return 3;
+    }
+
+    lua_pushnumber(L, SQLITE_OK);
+    lua_pushnumber(L, n);
+    return 2;
+}
+
+static int dbvm_executemany(lua_State *L) {
+    sdb_vm *svm = lsqlite_checkvm(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+    return dbvm_do_many(L, svm, 2);
+}
+
 /*
 ** =======================================================
 ** Database (internal management)
@@ -592,6 +890,15 @@ static sdb *newdb (lua_State *L) {
     db->trace_cb =
     db->trace_udata = LUA_NOREF;
 
+    db->busy_timeout = 0;
+    db->progress_ops = 0;
+
+    db->cache = NULL;
+    db->cache_size = LSQLITE_CACHE_SIZE;
+    db->cache_count = 0;
+    db->cache_hits = db->cache_misses = 0;
+    db->blobs = NULL;
+
     luaL_getmetatable(L, sqlite_meta);
     lua_setmetatable(L, -2);        /* set metatable */
 
@@ -603,12 +910,33 @@ static sdb *newdb (lua_State *L) {
     return db;
 }
 
+/* an open blob handle and the offset at which to read or write next */
+struct sdb_blob {
+    sdb *db;
+    sqlite3_blob *blob;
+    int offset;
+    sdb_blob *prev, *next;
+};
+
+static int cleanupblob(sdb_blob *sb) {
+    int result;
+    if (sb->prev) sb->prev->next = sb->next;
+    else sb->db->blobs = sb->next;
+    if (sb->next) sb->next->prev = sb->prev;
+    result = sqlite3_blob_close(sb->blob);
+    sb->blob = NULL;
+    return result;
+}
+
 static int cleanupdb(lua_State *L, sdb *db) {
     sdb_func *func;
     sdb_func *func_next;
     int top;
     int result;
 
+    /* statements are finalized from now on, cached ones right after */
+    db->cache_size = 0;
+
     /* free associated virtual machines */
     lua_pushlightuserdata(L, db);
     lua_rawget(L, LUA_REGISTRYINDEX);
@@ -625,6 +953,11 @@ static int cleanupdb(lua_State *L, sdb *db) {
     }
 
     lua_pop(L, 1); /* pop vm table */
+    stmt_trim(db);
+
+    /* close blob handles */
+    while (db->blobs)
+        cleanupblob(db->blobs);
 
     /* remove entry in lua registry table */
     lua_pushlightuserdata(L, db);
@@ -1250,6 +1583,7 @@ static int db_progress_handler(lua_State *L) {
 
         db->progress_cb =
         db->progress_udata = LUA_NOREF;
+        db->progress_ops = 0;
 
         /* clear busy handler */
         sqlite3_progress_handler(db->db, 0, NULL, NULL);
@@ -1266,6 +1600,7 @@ static int db_progress_handler(lua_State *L) {
 
         db->progress_udata = luaL_ref(L, LUA_REGISTRYINDEX);
         db->progress_cb = luaL_ref(L, LUA_REGISTRYINDEX);
+        db->progress_ops = nop;
 
         /* set progress callback */
         sqlite3_progress_handler(db->db, nop, db_progress_callback, db);
@@ -1333,6 +1668,7 @@ static int db_busy_handler(lua_State *L) {
 
         db->busy_udata = luaL_ref(L, LUA_REGISTRYINDEX);
         db->busy_cb = luaL_ref(L, LUA_REGISTRYINDEX);
+        db->busy_timeout = 0;
 
         /* set busy handler */
         sqlite3_busy_handler(db->db, db_busy_callback, db);
@@ -1345,6 +1681,7 @@ static int db_busy_timeout(lua_State *L) {
     sdb *db = lsqlite_checkdb(L, 1);
     int timeout = luaL_checkint(L, 2);
     sqlite3_busy_timeout(db->db, timeout);
+    db->busy_timeout = timeout > 0 ? timeout : 0;
 
     /* if there was a timeout callback registered, it is now
     ** invalid/useless. free any references we may have */
@@ -1428,8 +1765,32 @@ static int db_exec(lua_State *L) {
         result = sqlite3_exec(db->db, sql, db_exec_callback, L, NULL);
     }
     else {
-        /* no callbacks */
-        result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+        /* no callbacks: a single statement can come from the cache */
+        size_t len = lua_strlen(L, 2);
+        sqlite3_stmt *vm = NULL;
+        const char *tail = sql;
+        if (db->cache_size > 0 && stmt_prepare(db, sql, len, &vm, &tail) == SQLITE_OK && vm) {
+            while (isspace((unsigned char)*tail)) tail++;
+        }
+        if (vm == NULL || *tail != '\0') {
+            if (vm) sqlite3_finalize(vm);
+            result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+        }
+        else {
+            while ((result = sqlite3_step(vm)) == SQLITE_ROW)
+                ;
+            if (result == SQLITE_ERROR)
+                result = sqlite3_reset(vm);
+            if (result == SQLITE_SCHEMA) {
+                /* stale after a schema change: let sqlite do it all */
+                sqlite3_finalize(vm);
+                result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+            }
+            else if (result == SQLITE_DONE)
+                result = stmt_release(db, sql, len, tail - sql, vm);
+            else
+                stmt_release(db, sql, len, tail - sql, vm);
+        }
     }
 
     lua_pushnumber(L, result);
@@ -1449,7 +1810,7 @@ static int db_prepare(lua_State *L) {
     lua_settop(L,2); /* sql is on top of stack for call to newvm */
     svm = newvm(L, db);
 
-    if (sqlite3_prepare(db->db, sql, sql_len, &svm->vm, &sqltail) != SQLITE_OK) {
+    if (stmt_prepare(db, sql, sql_len, &svm->vm, &sqltail) != SQLITE_OK) {
         cleanupvm(L, svm);
 
         lua_pushnil(L);
@@ -1457,11 +1818,42 @@ static int db_prepare(lua_State *L) {
         return 2;
     }
 
+    svm->tail = sqltail - sql;
     /* vm already in the stack */
     lua_pushstring(L, sqltail);
     return 2;
 }
 
+/*
+** Params: db, sql, rows
+** returns: as stmt:executemany
+*/
+static int db_insert_many(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    const char *sql = luaL_checkstring(L, 2);
+    const char *sqltail;
+    sdb_vm *svm;
+    int n;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_settop(L, 3);
+    lua_pushvalue(L, 2); /* sql is on top of stack for call to newvm */
+    svm = newvm(L, db);
+    svm->temp = 1;
+
+    if (stmt_prepare(db, sql, lua_strlen(L, 2), &svm->vm, &sqltail) != SQLITE_OK) {
+        lua_pushnumber(L, sqlite3_errcode(db->db));
+        lua_pushnumber(L, 0);
+        lua_pushstring(L, sqlite3_errmsg(db->db));
+        lua_pop(L, cleanupvm(L, svm));
+        return 3;
+    }
+
+    svm->tail = sqltail - sql;
+    n = dbvm_do_many(L, svm, 3);
+    lua_pop(L, cleanupvm(L, svm));
+    return n;
+}
+
 static int db_do_next_row(lua_State *L, int packed) {
     int result;
     sdb_vm *svm = lsqlite_checkvm(L, 1);
@@ -1501,10 +1893,10 @@ static int db_do_next_row(lua_State *L, int packed) {
     }
 
     if (svm->temp) {
-        /* finalize and check for errors */
-        result = sqlite3_finalize(vm);
-        svm->vm = NULL;
+        /* finalize (or keep for reuse) and check for errors */
         cleanupvm(L, svm);
+        result = (int)lua_tonumber(L, -1);
+        lua_pop(L, 1);
     }
     else if (result == SQLITE_DONE) {
         result = sqlite3_reset(vm);
@@ -1517,6 +1909,116 @@ static int db_do_next_row(lua_State *L, int packed) {
     return 0;
 }
 
+/*
+** Steps a statement for the batch fetch functions. Returns 1 on a row, 0
+** when done (after resetting the statement); raises errors.
+*/
+static int dbvm_fetch_step(lua_State *L, sdb_vm *svm) {
+    int result = stepvm(L, svm);
+    svm->has_values = result == SQLITE_ROW ? 1 : 0;
+    svm->columns = sqlite3_data_count(svm->vm);
+    if (result == SQLITE_ROW)
+        return 1;
+    if (result == SQLITE_DONE)
+        result = sqlite3_reset(svm->vm);
+    if (result != SQLITE_OK) {
+        lua_pushstring(L, sqlite3_errmsg(svm->db->db));
+        lua_error(L);
+    }
+    return 0;
+}
+
+/*
+** Params: stmt, n[, columns]
+** returns: table with one array per column holding up to n rows, and the
+** number of rows (also in field 'n'). The 'columns' table of a previous
+** call can be passed back to be refilled.
+*/
+static int dbvm_fetch_columns(lua_State *L) {
+    sdb_vm *svm = lsqlite_checkvm(L, 1);
+    int n = luaL_checkint(L, 2);
+    int columns = sqlite3_column_count(svm->vm);
+    int rows = 0, old = 0, i, j;
+
+    if (lua_isnoneornil(L, 3)) {
+        lua_settop(L, 2);
+        lua_createtable(L, columns, 1);
+    }
+    else {
+        luaL_checktype(L, 3, LUA_TTABLE);
+        lua_settop(L, 3);
+        lua_getfield(L, 3, "n");
+        old = (int)lua_tonumber(L, -1);
+        lua_pop(L, 1);
+    }
+
+    /* one array per column, reusing those already there */
+    luaL_checkstack(L, columns + 2, "too many columns");
+    for (j = 1; j <= columns; ++j) {
+        lua_rawgeti(L, 3, j);
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            lua_createtable(L, n > 0 ? n : 0, 0);
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, 3, j);
+        }
+    }
+
+    while (rows < n && dbvm_fetch_step(L, svm)) {
+        ++rows;
+        for (j = 0; j < columns; ++j) {
+            vm_push_column(L, svm->vm, j);
+            lua_rawseti(L, 4 + j, rows);
+        }
+    }
+
+    /* clear what a previous batch left beyond this one */
+    for (i = rows + 1; i <= old; ++i) {
+        for (j = 0; j < columns; ++j) {
+            lua_pushnil(L);
+            lua_rawseti(L, 4 + j, i);
+        }
+    }
+
+    lua_settop(L, 3);
+    lua_pushnumber(L, rows);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, 3, "n");
+    return 2;
+}
+
+/*
+** Params: stmt, table[, named]
+** returns: the table, refilled with the values of the next row (by
+** column name if 'named' is true), or nil when there are no more rows
+*/
+static int dbvm_fetch_into(lua_State *L) {
+    sdb_vm *svm = lsqlite_checkvm(L, 1);
+    int named = lua_toboolean(L, 3);
+    int columns, i;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    lua_settop(L, 2);
+
+    if (!dbvm_fetch_step(L, svm)) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    columns = svm->columns;
+    for (i = 0; i < columns; ++i) {
+        if (named) {
+            lua_pushstring(L, sqlite3_column_name(svm->vm, i));
+            vm_push_column(L, svm->vm, i);
+            lua_rawset(L, 2);
+        }
+        else {
+            vm_push_column(L, svm->vm, i);
+            lua_rawseti(L, 2, i + 1);
+        }
+    }
+    return 1;
+}
+
 static int db_next_row(lua_State *L) {
     return db_do_next_row(L, 0);
 }
@@ -1553,17 +2055,19 @@ static int dbvm_urows(lua_State *L) {
 static int db_do_rows(lua_State *L, int(*f)(lua_State *)) {
     sdb *db = lsqlite_checkdb(L, 1);
     const char *sql = luaL_checkstring(L, 2);
+    const char *sqltail;
     sdb_vm *svm;
     lua_settop(L,2); /* sql is on top of stack for call to newvm */
     svm = newvm(L, db);
     svm->temp = 1;
 
-    if (sqlite3_prepare(db->db, sql, -1, &svm->vm, NULL) != SQLITE_OK) {
+    if (stmt_prepare(db, sql, lua_strlen(L, 2), &svm->vm, &sqltail) != SQLITE_OK) {
         cleanupvm(L, svm);
 
         lua_pushstring(L, sqlite3_errmsg(svm->db->db));
         lua_error(L);
     }
+    svm->tail = sqltail - sql;
 
     lua_pushcfunction(L, f);
     lua_insert(L, -2);
@@ -1626,50 +2130,1272 @@ static int db_close_vm(lua_State *L) {
     return 0;
 }
 
-static int db_gc(lua_State *L) {
-    sdb *db = lsqlite_getdb(L, 1);
-    if (db->db != NULL)  /* ignore closed databases */
-        cleanupdb(L, db);
-    return 0;
-}
-
 /*
-** =======================================================
-** General library functions
-** =======================================================
+** Params: db[, size]
+** returns: previous size of the prepared statement cache
 */
-
-static int lsqlite_version(lua_State *L) {
-    lua_pushstring(L, sqlite3_libversion());
+static int db_cache_size(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    int size = db->cache_size;
+    if (!lua_isnoneornil(L, 2)) {
+        db->cache_size = luaL_checkint(L, 2);
+        if (db->cache_size < 0) db->cache_size = 0;
+        stmt_trim(db);
+    }
+    lua_pushnumber(L, size);
     return 1;
 }
 
-static int lsqlite_complete(lua_State *L) {
-    const char *sql = luaL_checkstring(L, 1);
-    lua_pushboolean(L, sqlite3_complete(sql));
-    return 1;
+/*
+** Params: db
+** returns: hits, misses and statements held by the cache
+*/
+static int db_cache_stats(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    lua_pushnumber(L, db->cache_hits);
+    lua_pushnumber(L, db->cache_misses);
+    lua_pushnumber(L, db->cache_count);
+    return 3;
 }
 
-#ifndef WIN32
-static int lsqlite_temp_directory(lua_State *L) {
-    const char *oldtemp = sqlite3_temp_directory;
+/*
+** Page cache and lookaside counters of sqlite3_db_status(). For the
+** lookaside hit and miss counters sqlite reports the count as the
+** highwater value.
+*/
+static const struct {
+    const char *name;
+    int op;
+    char highwater;
+} db_status_counters[] = {
+    { "lookaside_used",         SQLITE_DBSTATUS_LOOKASIDE_USED,         0 },
+    { "cache_used",             SQLITE_DBSTATUS_CACHE_USED,             0 },
+    { "schema_used",            SQLITE_DBSTATUS_SCHEMA_USED,            0 },
+    { "stmt_used",              SQLITE_DBSTATUS_STMT_USED,              0 },
+#ifdef SQLITE_DBSTATUS_LOOKASIDE_HIT
+    { "lookaside_hit",          SQLITE_DBSTATUS_LOOKASIDE_HIT,          1 },
+    { "lookaside_miss_size",    SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE,    1 },
+    { "lookaside_miss_full",    SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL,    1 },
+#endif
+#ifdef SQLITE_DBSTATUS_CACHE_HIT
+    { "cache_hit",              SQLITE_DBSTATUS_CACHE_HIT,              0 },
+    { "cache_miss",             SQLITE_DBSTATUS_CACHE_MISS,             0 },
+#endif
+#ifdef SQLITE_DBSTATUS_CACHE_WRITE
+    { "cache_write",            SQLITE_DBSTATUS_CACHE_WRITE,            0 },
+#endif
+#ifdef SQLITE_DBSTATUS_DEFERRED_FKS
+    { "deferred_fks",           SQLITE_DBSTATUS_DEFERRED_FKS,           0 },
+#endif
+#ifdef SQLITE_DBSTATUS_CACHE_USED_SHARED
+    { "cache_used_shared",      SQLITE_DBSTATUS_CACHE_USED_SHARED,      0 },
+#endif
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+    { "cache_spill",            SQLITE_DBSTATUS_CACHE_SPILL,            0 },
+#endif
+    { NULL, 0, 0 }
+};
 
-    if (!lua_isnone(L, 1)) {
-        const char *temp = luaL_optstring(L, 1, NULL);
-        if (sqlite3_temp_directory) {
-            sqlite3_free((char*)sqlite3_temp_directory);
-        }
-        if (temp) {
-            sqlite3_temp_directory = sqlite3_mprintf("%s", temp);
-        }
-        else {
-            sqlite3_temp_directory = NULL;
+/*
+** Params: db[, reset]
+** returns: table of the connection's status counters by name, with the
+** highwater mark of the lookaside memory in 'lookaside_used_max'; the
+** resettable counters are zeroed afterwards if reset is true
+*/
+static int db_status(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    int reset = lua_toboolean(L, 2);
+    int i;
+
+    lua_newtable(L);
+    for (i = 0; db_status_counters[i].name; ++i) {
+        int current = 0, highwater = 0;
+        if (sqlite3_db_status(db->db, db_status_counters[i].op,
+                &current, &highwater, reset) != SQLITE_OK)
+            continue;
+        lua_pushnumber(L, db_status_counters[i].highwater ? highwater : current);
+        lua_setfield(L, -2, db_status_counters[i].name);
+        if (db_status_counters[i].op == SQLITE_DBSTATUS_LOOKASIDE_USED) {
+            lua_pushnumber(L, highwater);
+            lua_setfield(L, -2, "lookaside_used_max");
         }
     }
-    lua_pushstring(L, oldtemp);
     return 1;
 }
-#endif
+
+/*
+** Runs "PRAGMA name = value" if value is not NULL, then "PRAGMA name", and
+** pushes the first value the latter returns (nil if none); raises errors
+*/
+static void db_pragma(lua_State *L, sdb *db, const char *name, const char *value) {
+    sqlite3_stmt *vm;
+    const char *sql;
+    int result;
+
+    if (value) {
+        sql = lua_pushfstring(L, "PRAGMA %s = %s", name, value);
+        result = sqlite3_exec(db->db, sql, NULL, NULL, NULL);
+        lua_pop(L, 1);
+        if (result != SQLITE_OK) {
+            lua_pushstring(L, sqlite3_errmsg(db->db));
+            lua_error(L);
+        }
+    }
+
+    sql = lua_pushfstring(L, "PRAGMA %s", name);
+    result = sqlite3_prepare_v2(db->db, sql, -1, &vm, NULL);
+    lua_pop(L, 1);
+    if (result == SQLITE_OK) {
+        result = sqlite3_step(vm);
+        if (result == SQLITE_ROW)
+            vm_push_column(L, vm, 0);
+        else
+            lua_pushnil(L);
+        result = sqlite3_finalize(vm);
+    }
+    if (result != SQLITE_OK) {
+        lua_pushstring(L, sqlite3_errmsg(db->db));
+        lua_error(L);
+    }
+}
+
+/* the optional numeric value at index as pragma text, NULL if absent */
+static const char *pragma_number(lua_State *L, int index) {
+    if (lua_isnoneornil(L, index))
+        return NULL;
+    lua_pushnumber(L, luaL_checknumber(L, index));
+    return lua_tostring(L, -1);
+}
+
+/*
+** Params: db[, bytes]
+** returns: the maximum number of bytes of the database file that are
+** memory-mapped, after setting it to bytes
+*/
+static int db_mmap_size(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    db_pragma(L, db, "mmap_size", pragma_number(L, 2));
+    return 1;
+}
+
+/*
+** Params: db[, size]
+** returns: the size of the page cache, in pages or, if negative, in KiB,
+** after setting it to size
+*/
+static int db_page_cache_size(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    db_pragma(L, db, "cache_size", pragma_number(L, 2));
+    return 1;
+}
+
+/*
+** Params: db[, mode]
+** returns: the journal mode ("delete", "wal", ...), after setting it to mode
+*/
+static int db_journal_mode(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    const char *mode = luaL_optstring(L, 2, NULL);
+    if (mode) {
+        const char *c;
+        for (c = mode; *c; ++c)
+            if (!isalpha((unsigned char)*c))
+                luaL_argerror(L, 2, "invalid journal mode");
+    }
+    db_pragma(L, db, "journal_mode", mode);
+    return 1;
+}
+
+/*
+** Params: db[, mode[, dbname]]
+** returns: error code, frames in the WAL and frames checkpointed
+*/
+static int db_wal_checkpoint(lua_State *L) {
+    static const char *const modes[] = {
+        "passive", "full", "restart",
+#ifdef SQLITE_CHECKPOINT_TRUNCATE
+        "truncate",
+#endif
+        NULL
+    };
+    static const int codes[] = {
+        SQLITE_CHECKPOINT_PASSIVE, SQLITE_CHECKPOINT_FULL,
+        SQLITE_CHECKPOINT_RESTART,
+#ifdef SQLITE_CHECKPOINT_TRUNCATE
+        SQLITE_CHECKPOINT_TRUNCATE
+#endif
+    };
+    sdb *db = lsqlite_checkdb(L, 1);
+    int mode = luaL_checkoption(L, 2, "passive", modes);
+    const char *dbname = luaL_optstring(L, 3, NULL);
+    int log = 0, done = 0;
+    lua_pushnumber(L, sqlite3_wal_checkpoint_v2(db->db, dbname, codes[mode], &log, &done));
+    lua_pushnumber(L, log);
+    lua_pushnumber(L, done);
+    return 3;
+}
+
+static int db_gc(lua_State *L) {
+    sdb *db = lsqlite_getdb(L, 1);
+    if (db->db != NULL)  /* ignore closed databases */
+        cleanupdb(L, db);
+    return 0;
+}
+
+/*
+** =======================================================
+** Incremental Blob I/O
+** =======================================================
+*/
+
+static sdb_blob *lsqlite_getblob(lua_State *L, int index) {
+    return (sdb_blob*)luaL_checkudata(L, index, sqlite_blob_meta);
+}
+
+static sdb_blob *lsqlite_checkblob(lua_State *L, int index) {
+    sdb_blob *sb = lsqlite_getblob(L, index);
+    if (sb->blob == NULL) luaL_argerror(L, index, "attempt to use closed sqlite blob");
+    return sb;
+}
+
+/*
+** Params: db, table, column, rowid[, write[, dbname]]
+** returns: blob handle, or nil, error code and message
+*/
+static int db_blob_open(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    const char *table = luaL_checkstring(L, 2);
+    const char *column = luaL_checkstring(L, 3);
+    sqlite3_int64 rowid = (sqlite3_int64)luaL_checknumber(L, 4);
+    int write = lua_toboolean(L, 5);
+    const char *dbname = luaL_optstring(L, 6, "main");
+    sqlite3_blob *blob;
+    sdb_blob *sb;
+    int result;
+
+    result = sqlite3_blob_open(db->db, dbname, table, column, rowid, write, &blob);
+    if (result != SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, result);
+        lua_pushstring(L, sqlite3_errmsg(db->db));
+        return 3;
+    }
+
+    sb = (sdb_blob*)lua_newuserdata(L, sizeof(sdb_blob));
+    sb->db = db;
+    sb->blob = blob;
+    sb->offset = 0;
+    sb->prev = NULL;
+    sb->next = db->blobs;
+    if (db->blobs) db->blobs->prev = sb;
+    db->blobs = sb;
+
+    luaL_getmetatable(L, sqlite_blob_meta);
+    lua_setmetatable(L, -2);
+    /* keep the database alive while the blob is */
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/* reads up to n bytes at offset, leaving them on the stack; 0 at the end */
+static int blob_read_at(lua_State *L, sdb_blob *sb, int n, int offset, int *result) {
+    int size = sqlite3_blob_bytes(sb->blob);
+    luaL_Buffer b;
+
+    *result = SQLITE_OK;
+    if (offset < 0 || offset >= size || n <= 0)
+        return 0;
+    if (n > size - offset)
+        n = size - offset;
+
+    luaL_buffinit(L, &b);
+    while (n > 0) {
+        int chunk = n < LUAL_BUFFERSIZE ? n : LUAL_BUFFERSIZE;
+        *result = sqlite3_blob_read(sb->blob, luaL_prepbuffer(&b), chunk, offset);
+        if (*result != SQLITE_OK)
+            return 0;
+        luaL_addsize(&b, chunk);
+        offset += chunk;
+        n -= chunk;
+    }
+    luaL_pushresult(&b);
+    sb->offset = offset;
+    return 1;
+}
+
+/*
+** Params: blob, n[, offset]
+** returns: up to n bytes read at offset (by default where the last read
+** or write ended), or nil at the end of the blob; raises errors
+*/
+static int blob_read(lua_State *L) {
+    sdb_blob *sb = lsqlite_checkblob(L, 1);
+    int n = luaL_checkint(L, 2);
+    int offset = luaL_optint(L, 3, sb->offset);
+    int result;
+
+    if (blob_read_at(L, sb, n, offset, &result))
+        return 1;
+    if (result != SQLITE_OK) {
+        lua_pushstring(L, sqlite3_errmsg(sb->db->db));
+        lua_error(L);
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+/*
+** Params: blob, s[, offset]
+** returns: error code; blobs cannot grow, so s must fit
+*/
+static int blob_write(lua_State *L) {
+    sdb_blob *sb = lsqlite_checkblob(L, 1);
+    size_t len;
+    const char *s = luaL_checklstring(L, 2, &len);
+    int offset = luaL_optint(L, 3, sb->offset);
+    int result = sqlite3_blob_write(sb->blob, s, (int)len, offset);
+    if (result == SQLITE_OK)
+        sb->offset = offset + (int)len;
+    lua_pushnumber(L, result);
+    return 1;
+}
+
+/*
+** Params: blob, rowid
+** returns: error code; moves the handle to another row of the same column
+*/
+static int blob_reopen(lua_State *L) {
+    sdb_blob *sb = lsqlite_checkblob(L, 1);
+    sqlite3_int64 rowid = (sqlite3_int64)luaL_checknumber(L, 2);
+    sb->offset = 0;
+    lua_pushnumber(L, sqlite3_blob_reopen(sb->blob, rowid));
+    return 1;
+}
+
+static int blob_bytes(lua_State *L) {
+    sdb_blob *sb = lsqlite_checkblob(L, 1);
+    lua_pushnumber(L, sqlite3_blob_bytes(sb->blob));
+    return 1;
+}
+
+static int blob_source_step(lua_State *L) {
+    sdb_blob *sb = lsqlite_getblob(L, lua_upvalueindex(1));
+    int result;
+    if (sb->blob == NULL) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "blob closed");
+        return 2;
+    }
+    if (blob_read_at(L, sb, lua_tointeger(L, lua_upvalueindex(2)), sb->offset, &result))
+        return 1;
+    lua_pushnil(L);
+    if (result == SQLITE_OK)
+        return 1;
+    lua_pushstring(L, sqlite3_errmsg(sb->db->db));
+    return 2;
+}
+
+/*
+** Params: blob[, size]
+** returns: an ltn12 source reading chunks of size bytes from where the
+** last read or write ended
+*/
+static int blob_source(lua_State *L) {
+    int size = luaL_optint(L, 2, LUAL_BUFFERSIZE);
+    lsqlite_checkblob(L, 1);
+    lua_settop(L, 1);
+    lua_pushinteger(L, size);
+    lua_pushcclosure(L, blob_source_step, 2);
+    return 1;
+}
+
+static int blob_sink_step(lua_State *L) {
+    sdb_blob *sb = lsqlite_getblob(L, lua_upvalueindex(1));
+    size_t len;
+    const char *s = lua_tolstring(L, 1, &len);
+    int result;
+    if (s == NULL) {
+        lua_pushnumber(L, 1);
+        return 1;
+    }
+    if (sb->blob == NULL) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "blob closed");
+        return 2;
+    }
+    result = sqlite3_blob_write(sb->blob, s, (int)len, sb->offset);
+    if (result != SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushstring(L, sqlite3_errmsg(sb->db->db));
+        return 2;
+    }
+    sb->offset += (int)len;
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*
+** Params: blob
+** returns: an ltn12 sink writing from where the last read or write ended
+*/
+static int blob_sink(lua_State *L) {
+    lsqlite_checkblob(L, 1);
+    lua_settop(L, 1);
+    lua_pushcclosure(L, blob_sink_step, 1);
+    return 1;
+}
+
+static int blob_isopen(lua_State *L) {
+    sdb_blob *sb = lsqlite_getblob(L, 1);
+    lua_pushboolean(L, sb->blob != NULL);
+    return 1;
+}
+
+static int blob_close(lua_State *L) {
+    sdb_blob *sb = lsqlite_checkblob(L, 1);
+    lua_pushnumber(L, cleanupblob(sb));
+    return 1;
+}
+
+static int blob_tostring(lua_State *L) {
+    char buff[32];
+    sdb_blob *sb = lsqlite_getblob(L, 1);
+    if (sb->blob == NULL)
+        strcpy(buff, "closed");
+    else
+        sprintf(buff, "%p", lua_touserdata(L, 1));
+    lua_pushfstring(L, "sqlite blob (%s)", buff);
+    return 1;
+}
+
+static int blob_gc(lua_State *L) {
+    sdb_blob *sb = lsqlite_getblob(L, 1);
+    if (sb->blob != NULL)  /* ignore closed blobs */
+        cleanupblob(sb);
+    return 0;
+}
+
+/*
+** =======================================================
+** Background Worker
+** =======================================================
+*/
+
+#ifndef WIN32
+
+typedef struct sdb_value sdb_value;
+typedef struct sdb_job sdb_job;
+typedef struct sdb_async sdb_async;
+
+/* a value copied between lua and the worker thread */
+struct sdb_value {
+    int type;               /* SQLITE_FLOAT, SQLITE_TEXT, ... */
+    double number;
+    char *data;             /* text and blobs */
+    int len;
+};
+
+enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE };
+
+/* a query submitted to the worker */
+struct sdb_job {
+    char *sql;
+    sdb_value *params;
+    int nparams;
+
+    /* state is guarded by the worker lock; cancel is only ever set */
+    int state;
+    volatile int cancel;
+    int orphan;             /* future collected while running */
+    sdb_job *next;          /* queue link */
+
+    /* results, written by the worker before state becomes JOB_DONE */
+    int code;
+    char *errmsg;
+    int columns;
+    char **names;
+    sdb_value *values;      /* rows * columns values */
+    int rows;
+    int size;               /* rows allocated in values */
+    double changes;
+    double rowid;
+};
+
+/* a worker thread with its own connection to the database file */
+struct sdb_async {
+    sqlite3 *db;
+    int open;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        /* new job or stop request */
+    pthread_cond_t finished;    /* a job completed */
+    sdb_job *queue, *last;
+    int stop;
+    int fds[2];                 /* a byte is written per completed job */
+
+    /* only touched by the worker thread */
+    sdb_job *job;
+    int busy_timeout;
+    int waited;
+};
+
+static void value_free(sdb_value *v) {
+    if (v->type == SQLITE_TEXT || v->type == SQLITE_BLOB)
+        free(v->data);
+}
+
+static void job_clear(sdb_job *job) {
+    int i;
+    for (i = 0; i < job->rows * job->columns; ++i)
+        value_free(&job->values[i]);
+    for (i = 0; i < job->columns; ++i)
+        free(job->names[i]);
+    free(job->values);
+    free(job->names);
+    job->values = NULL;
+    job->names = NULL;
+    job->rows = job->size = job->columns = 0;
+}
+
+static void job_free(sdb_job *job) {
+    int i;
+    job_clear(job);
+    for (i = 0; i < job->nparams; ++i)
+        value_free(&job->params[i]);
+    free(job->params);
+    free(job->errmsg);
+    free(job->sql);
+    free(job);
+}
+
+static char *copy_text(const char *s, int len) {
+    char *c = (char*)malloc(len + 1);
+    if (c) {
+        memcpy(c, s, len);
+        c[len] = 0;
+    }
+    return c;
+}
+
+static void job_fail(sdb_job *job, int code, const char *msg) {
+    job->code = code;
+    free(job->errmsg);
+    job->errmsg = copy_text(msg, strlen(msg));
+}
+
+/* worker side: make a copy of the current row of vm */
+static int job_add_row(sdb_job *job, sqlite3_stmt *vm) {
+    sdb_value *row;
+    int i;
+
+    if (job->rows == job->size) {
+        int size = job->size ? job->size * 2 : 16;
+        sdb_value *values = (sdb_value*)realloc(job->values,
+            (size_t)size * job->columns * sizeof(sdb_value));
+        if (values == NULL)
+            return SQLITE_NOMEM;
+        job->values = values;
+        job->size = size;
+    }
+    row = job->values + (size_t)job->rows * job->columns;
+    for (i = 0; i < job->columns; ++i) {
+        sdb_value *v = &row[i];
+        v->type = sqlite3_column_type(vm, i);
+        switch (v->type) {
+            case SQLITE_INTEGER:
+                v->number = (double)sqlite3_column_int64(vm, i);
+                break;
+            case SQLITE_FLOAT:
+                v->number = sqlite3_column_double(vm, i);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                const char *data = v->type == SQLITE_TEXT ?
+                    (const char*)sqlite3_column_text(vm, i) :
+                    (const char*)sqlite3_column_blob(vm, i);
+                v->len = sqlite3_column_bytes(vm, i);
+                v->data = copy_text(data ? data : "", v->len);
+                if (v->data == NULL) {
+                    while (i--)
+                        value_free(&row[i]);
+                    return SQLITE_NOMEM;
+                }
+                break;
+            }
+            default:
+                v->type = SQLITE_NULL;
+                break;
+        }
+    }
+    job->rows++;
+    return SQLITE_OK;
+}
+
+/* worker side: keeps the rows of vm, replacing those of earlier statements */
+static int job_start_rows(sdb_job *job, sqlite3_stmt *vm) {
+    int i, columns = sqlite3_column_count(vm);
+    job_clear(job);
+    job->names = (char**)calloc(columns, sizeof(char*));
+    if (job->names == NULL)
+        return SQLITE_NOMEM;
+    job->columns = columns;
+    for (i = 0; i < columns; ++i) {
+        const char *name = sqlite3_column_name(vm, i);
+        if (name == NULL || (job->names[i] = copy_text(name, strlen(name))) == NULL)
+            return SQLITE_NOMEM;
+    }
+    return SQLITE_OK;
+}
+
+static int async_bind(sqlite3_stmt *vm, sdb_job *job) {
+    int i, result = SQLITE_OK;
+    int count = sqlite3_bind_parameter_count(vm);
+    for (i = 0; i < job->nparams && i < count && result == SQLITE_OK; ++i) {
+        sdb_value *v = &job->params[i];
+        switch (v->type) {
+            case SQLITE_TEXT:
+                result = sqlite3_bind_text(vm, i + 1, v->data, v->len, SQLITE_STATIC);
+                break;
+            case SQLITE_INTEGER:
+                result = sqlite3_bind_int(vm, i + 1, (int)v->number);
+                break;
+            case SQLITE_FLOAT:
+                result = sqlite3_bind_double(vm, i + 1, v->number);
+                break;
+            default:
+                result = sqlite3_bind_null(vm, i + 1);
+                break;
+        }
+    }
+    return result;
+}
+
+/*
+** worker side: runs the statements of a job in turn; the rows kept are
+** those of the last statement returning columns
+*/
+static void async_run(sdb_async *as, sdb_job *job) {
+    const char *sql = job->sql;
+    int result = SQLITE_OK;
+
+    as->job = job;
+    as->waited = 0;
+    while (result == SQLITE_OK && *sql) {
+        sqlite3_stmt *vm;
+        const char *tail;
+
+        result = sqlite3_prepare_v2(as->db, sql, -1, &vm, &tail);
+        if (result != SQLITE_OK || vm == NULL)
+            break;
+        sql = tail;
+
+        result = async_bind(vm, job);
+        if (result == SQLITE_OK && sqlite3_column_count(vm) > 0)
+            result = job_start_rows(job, vm);
+        while (result == SQLITE_OK) {
+            result = sqlite3_step(vm);
+            if (result == SQLITE_ROW)
+                result = job_add_row(job, vm);
+        }
+        if (result == SQLITE_DONE)
+            result = SQLITE_OK;
+        if (result == SQLITE_NOMEM) {
+            sqlite3_finalize(vm);
+            job_fail(job, result, "out of memory");
+            return;
+        }
+        if (sqlite3_finalize(vm) != SQLITE_OK && result == SQLITE_OK)
+            result = sqlite3_errcode(as->db);
+    }
+    if (result != SQLITE_OK)
+        job_fail(job, result, sqlite3_errmsg(as->db));
+    else
+        job->code = SQLITE_OK;
+    job->changes = sqlite3_changes(as->db);
+    job->rowid = (double)sqlite3_last_insert_rowid(as->db);
+}
+
+/*
+** worker side: the busy timeout of the database, which also gives up
+** once the job is cancelled
+*/
+static int async_busy_callback(void *user, int tries) {
+    sdb_async *as = (sdb_async*)user;
+    int delay = tries < 10 ? tries + 1 : 10;
+    if (as->job->cancel || as->waited >= as->busy_timeout)
+        return 0;
+    if (delay > as->busy_timeout - as->waited)
+        delay = as->busy_timeout - as->waited;
+    sqlite3_sleep(delay);
+    as->waited += delay;
+    return 1;
+}
+
+#if !defined(SQLITE_OMIT_PROGRESS_CALLBACK) || !SQLITE_OMIT_PROGRESS_CALLBACK
+/* worker side: interrupts a cancelled job */
+static int async_progress_callback(void *user) {
+    sdb_async *as = (sdb_async*)user;
+    return as->job->cancel;
+}
+#endif
+
+static void async_notify(sdb_async *as) {
+    ssize_t n = write(as->fds[1], "", 1);
+    (void)n;    /* a full pipe is readable anyway */
+}
+
+static void *async_worker(void *user) {
+    sdb_async *as = (sdb_async*)user;
+
+    pthread_mutex_lock(&as->lock);
+    for (;;) {
+        sdb_job *job;
+        while (as->queue == NULL && !as->stop)
+            pthread_cond_wait(&as->wake, &as->lock);
+        if (as->stop)
+            break;
+
+        job = as->queue;
+        as->queue = job->next;
+        if (as->queue == NULL)
+            as->last = NULL;
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&as->lock);
+
+        async_run(as, job);
+
+        pthread_mutex_lock(&as->lock);
+        if (job->orphan) {
+            job_free(job);
+            continue;
+        }
+        job->state = JOB_DONE;
+        pthread_cond_broadcast(&as->finished);
+        async_notify(as);
+    }
+    pthread_mutex_unlock(&as->lock);
+    return NULL;
+}
+
+/* stops the worker, fails the jobs it did not start and closes everything */
+static void async_close(sdb_async *as) {
+    sdb_job *job;
+
+    pthread_mutex_lock(&as->lock);
+    as->stop = 1;
+    pthread_cond_signal(&as->wake);
+    pthread_mutex_unlock(&as->lock);
+    sqlite3_interrupt(as->db);
+    pthread_join(as->thread, NULL);
+
+    for (job = as->queue; job; job = job->next) {
+        job->state = JOB_DONE;
+        job_fail(job, SQLITE_ABORT, "database closed");
+    }
+    as->queue = as->last = NULL;
+
+    pthread_cond_destroy(&as->finished);
+    pthread_cond_destroy(&as->wake);
+    pthread_mutex_destroy(&as->lock);
+    close(as->fds[0]);
+    close(as->fds[1]);
+    sqlite3_close(as->db);
+    as->db = NULL;
+    as->open = 0;
+}
+
+static sdb_async *lsqlite_getasync(lua_State *L, int index) {
+    return (sdb_async*)luaL_checkudata(L, index, sqlite_async_meta);
+}
+
+static sdb_async *lsqlite_checkasync(lua_State *L, int index) {
+    sdb_async *as = lsqlite_getasync(L, index);
+    if (!as->open) luaL_argerror(L, index, "attempt to use closed sqlite worker");
+    return as;
+}
+
+static int set_cloexec_nonblock(int fd) {
+    return fcntl(fd, F_SETFD, FD_CLOEXEC) == -1 ||
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ? -1 : 0;
+}
+
+/*
+** Params: db
+** returns: a worker with its own connection to the database file, or
+** nil, error code and message
+*/
+static int db_async(lua_State *L) {
+    sdb *db = lsqlite_checkdb(L, 1);
+    const char *filename = sqlite3_db_filename(db->db, "main");
+    sdb_async *as;
+    sqlite3 *conn = NULL;
+    int result;
+
+    if (filename == NULL || *filename == 0) {
+        lua_pushnil(L);
+        lua_pushnumber(L, SQLITE_MISUSE);
+        lua_pushliteral(L, "a worker needs a database file");
+        return 3;
+    }
+    result = sqlite3_open_v2(filename, &conn,
+        SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if (result != SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, result);
+        lua_pushstring(L, conn ? sqlite3_errmsg(conn) : "out of memory");
+        sqlite3_close(conn);
+        return 3;
+    }
+
+    as = (sdb_async*)lua_newuserdata(L, sizeof(sdb_async));
+    memset(as, 0, sizeof(sdb_async));
+    as->db = conn;
+    as->busy_timeout = db->busy_timeout;
+    sqlite3_busy_handler(conn, async_busy_callback, as);
+#if !defined(SQLITE_OMIT_PROGRESS_CALLBACK) || !SQLITE_OMIT_PROGRESS_CALLBACK
+    sqlite3_progress_handler(conn, db->progress_ops > 0 ? db->progress_ops : 1000,
+        async_progress_callback, as);
+#endif
+
+    if (pipe(as->fds) == -1) {
+        sqlite3_close(conn);
+        lua_pushnil(L);
+        lua_pushnumber(L, SQLITE_ERROR);
+        lua_pushliteral(L, "cannot create worker pipe");
+        return 3;
+    }
+    set_cloexec_nonblock(as->fds[0]);
+    set_cloexec_nonblock(as->fds[1]);
+    pthread_mutex_init(&as->lock, NULL);
+    pthread_cond_init(&as->wake, NULL);
+    pthread_cond_init(&as->finished, NULL);
+    if (pthread_create(&as->thread, NULL, async_worker, as) != 0) {
+        pthread_cond_destroy(&as->finished);
+        pthread_cond_destroy(&as->wake);
+        pthread_mutex_destroy(&as->lock);
+        close(as->fds[0]);
+        close(as->fds[1]);
+        sqlite3_close(conn);
+        lua_pushnil(L);
+        lua_pushnumber(L, SQLITE_ERROR);
+        lua_pushliteral(L, "cannot start worker thread");
+        return 3;
+    }
+    as->open = 1;
+
+    luaL_getmetatable(L, sqlite_async_meta);
+    lua_setmetatable(L, -2);
+    /* pending futures, keyed by their job */
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*
+** Params: worker, sql, ...
+** returns: a future for the result of running sql with the given values
+** bound to its parameters
+*/
+static int async_query(lua_State *L) {
+    sdb_async *as = lsqlite_checkasync(L, 1);
+    size_t len;
+    const char *sql = luaL_checklstring(L, 2, &len);
+    int i, nparams = lua_gettop(L) - 2;
+    sdb_job *job, **future;
+
+    for (i = 1; i <= nparams; ++i) {
+        int type = lua_type(L, i + 2);
+        if (type != LUA_TSTRING && type != LUA_TNUMBER &&
+                type != LUA_TBOOLEAN && type != LUA_TNIL)
+            luaL_error(L, "index (%d) - invalid data type for bind (%s)", i,
+                lua_typename(L, type));
+    }
+
+    future = (sdb_job**)lua_newuserdata(L, sizeof(sdb_job*));
+    *future = NULL;
+    luaL_getmetatable(L, sqlite_future_meta);
+    lua_setmetatable(L, -2);
+    lua_createtable(L, 1, 0);   /* keeps the worker alive */
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_setuservalue(L, -2);
+
+    job = (sdb_job*)calloc(1, sizeof(sdb_job));
+    if (job == NULL || (job->sql = copy_text(sql, len)) == NULL ||
+            (nparams > 0 &&
+             (job->params = (sdb_value*)calloc(nparams, sizeof(sdb_value))) == NULL)) {
+        if (job) job_free(job);
+        luaL_error(L, "not enough memory");
+    }
+    *future = job;
+    for (i = 0; i < nparams; ++i) {
+        sdb_value *v = &job->params[i];
+        switch (lua_type(L, i + 3)) {
+            case LUA_TSTRING: {
+                size_t l;
+                const char *s = lua_tolstring(L, i + 3, &l);
+                if ((v->data = copy_text(s, l)) == NULL)
+                    luaL_error(L, "not enough memory");
+                v->type = SQLITE_TEXT;
+                v->len = (int)l;
+                break;
+            }
+            case LUA_TNUMBER:
+                v->type = SQLITE_FLOAT;
+                v->number = lua_tonumber(L, i + 3);
+                break;
+            case LUA_TBOOLEAN:
+                v->type = SQLITE_INTEGER;
+                v->number = lua_toboolean(L, i + 3);
+                break;
+            default:
+                v->type = SQLITE_NULL;
+                break;
+        }
+        job->nparams = i + 1;
+    }
+
+    /* register the future before the worker can finish the job */
+    lua_getuservalue(L, 1);
+    lua_pushlightuserdata(L, job);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+
+    pthread_mutex_lock(&as->lock);
+    if (as->last) as->last->next = job;
+    else as->queue = job;
+    as->last = job;
+    pthread_cond_signal(&as->wake);
+    pthread_mutex_unlock(&as->lock);
+    return 1;
+}
+
+/*
+** Params: worker
+** returns: array of the futures completed since the last call
+*/
+static int async_poll(lua_State *L) {
+    sdb_async *as = lsqlite_checkasync(L, 1);
+    char buff[64];
+    int n = 0;
+
+    while (read(as->fds[0], buff, sizeof(buff)) > 0)
+        ;
+
+    lua_settop(L, 1);
+    lua_getuservalue(L, 1);
+    lua_newtable(L);
+    pthread_mutex_lock(&as->lock);
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {
+        sdb_job **future = (sdb_job**)lua_touserdata(L, -1);
+        if ((*future)->state == JOB_DONE)
+            lua_rawseti(L, 3, ++n);
+        else
+            lua_pop(L, 1);
+    }
+    pthread_mutex_unlock(&as->lock);
+
+    /* completed futures are no longer tracked by the worker */
+    while (n > 0) {
+        sdb_job **future;
+        lua_rawgeti(L, 3, n--);
+        future = (sdb_job**)lua_touserdata(L, -1);
+        lua_pushlightuserdata(L, *future);
+        lua_pushnil(L);
+        lua_rawset(L, 2);
+        lua_pop(L, 1);
+    }
+    return 1;
+}
+
+static int async_getfd(lua_State *L) {
+    sdb_async *as = lsqlite_checkasync(L, 1);
+    lua_pushnumber(L, as->fds[0]);
+    return 1;
+}
+
+static int async_busy_timeout(lua_State *L) {
+    sdb_async *as = lsqlite_checkasync(L, 1);
+    int timeout = luaL_checkint(L, 2);
+    pthread_mutex_lock(&as->lock);
+    as->busy_timeout = timeout > 0 ? timeout : 0;
+    pthread_mutex_unlock(&as->lock);
+    return 0;
+}
+
+static int async_isopen(lua_State *L) {
+    sdb_async *as = lsqlite_getasync(L, 1);
+    lua_pushboolean(L, as->open);
+    return 1;
+}
+
+static int async_close_lua(lua_State *L) {
+    sdb_async *as = lsqlite_checkasync(L, 1);
+    async_close(as);
+    lua_pushnumber(L, SQLITE_OK);
+    return 1;
+}
+
+static int async_tostring(lua_State *L) {
+    char buff[32];
+    sdb_async *as = lsqlite_getasync(L, 1);
+    if (!as->open)
+        strcpy(buff, "closed");
+    else
+        sprintf(buff, "%p", lua_touserdata(L, 1));
+    lua_pushfstring(L, "sqlite worker (%s)", buff);
+    return 1;
+}
+
+static int async_gc(lua_State *L) {
+    sdb_async *as = lsqlite_getasync(L, 1);
+    if (as->open)
+        async_close(as);
+    return 0;
+}
+
+/*
+** Futures
+*/
+
+static sdb_job *lsqlite_checkfuture(lua_State *L, int index, sdb_async **as) {
+    sdb_job **future = (sdb_job**)luaL_checkudata(L, index, sqlite_future_meta);
+    lua_getuservalue(L, index);
+    lua_rawgeti(L, -1, 1);
+    *as = (sdb_async*)lua_touserdata(L, -1);
+    lua_pop(L, 2);
+    return *future;
+}
+
+static int future_done(lua_State *L) {
+    sdb_async *as;
+    sdb_job *job = lsqlite_checkfuture(L, 1, &as);
+    if (as->open) pthread_mutex_lock(&as->lock);
+    lua_pushboolean(L, job->state == JOB_DONE);
+    if (as->open) pthread_mutex_unlock(&as->lock);
+    return 1;
+}
+
+/*
+** Params: future
+** returns: array of rows, each an array of values, with fields names,
+** changes and last_insert_rowid; or nil, error code and message. Waits
+** for the job to complete.
+*/
+static int future_result(lua_State *L) {
+    sdb_async *as;
+    sdb_job *job = lsqlite_checkfuture(L, 1, &as);
+    int i, j;
+
+    if (as->open) {
+        pthread_mutex_lock(&as->lock);
+        while (job->state != JOB_DONE)
+            pthread_cond_wait(&as->finished, &as->lock);
+        pthread_mutex_unlock(&as->lock);
+
+        /* no need to poll for this one any more */
+        lua_getuservalue(L, 1);
+        lua_rawgeti(L, -1, 1);
+        lua_getuservalue(L, -1);
+        lua_pushlightuserdata(L, job);
+        lua_pushnil(L);
+        lua_rawset(L, -3);
+        lua_pop(L, 3);
+    }
+
+    if (job->code != SQLITE_OK) {
+        lua_pushnil(L);
+        lua_pushnumber(L, job->code);
+        lua_pushstring(L, job->errmsg);
+        return 3;
+    }
+
+    lua_createtable(L, job->rows, 3);
+    for (i = 0; i < job->rows; ++i) {
+        sdb_value *row = job->values + (size_t)i * job->columns;
+        lua_createtable(L, job->columns, 0);
+        for (j = 0; j < job->columns; ++j) {
+            sdb_value *v = &row[j];
+            switch (v->type) {
+                case SQLITE_INTEGER:
+                case SQLITE_FLOAT:
+                    lua_pushnumber(L, v->number);
+                    break;
+                case SQLITE_TEXT:
+                case SQLITE_BLOB:
+                    lua_pushlstring(L, v->data, v->len);
+                    break;
+                default:
+                    lua_pushnil(L);
+                    break;
+            }
+            lua_rawseti(L, -2, j + 1);
+        }
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_createtable(L, job->columns, 0);
+    for (j = 0; j < job->columns; ++j) {
+        lua_pushstring(L, job->names[j]);
+        lua_rawseti(L, -2, j + 1);
+    }
+    lua_setfield(L, -2, "names");
+    lua_pushnumber(L, job->changes);
+    lua_setfield(L, -2, "changes");
+    lua_pushnumber(L, job->rowid);
+    lua_setfield(L, -2, "last_insert_rowid");
+    return 1;
+}
+
+/*
+** Params: future
+** returns: true if the job had not completed yet. A queued job is failed
+** right away, a running one is interrupted at its next progress check.
+*/
+static int future_cancel(lua_State *L) {
+    sdb_async *as;
+    sdb_job *job = lsqlite_checkfuture(L, 1, &as);
+    int pending = 0;
+
+    if (as->open) {
+        pthread_mutex_lock(&as->lock);
+        pending = job->state != JOB_DONE;
+        if (job->state == JOB_QUEUED) {
+            sdb_job **link = &as->queue;
+            as->last = NULL;
+            while (*link) {
+                if (*link == job) *link = job->next;
+                else {
+                    as->last = *link;
+                    link = &(*link)->next;
+                }
+            }
+            job->next = NULL;
+            job->state = JOB_DONE;
+            job_fail(job, SQLITE_INTERRUPT, "interrupted");
+            pthread_cond_broadcast(&as->finished);
+            async_notify(as);
+        }
+        else if (job->state == JOB_RUNNING)
+            job->cancel = 1;
+        pthread_mutex_unlock(&as->lock);
+    }
+    lua_pushboolean(L, pending);
+    return 1;
+}
+
+static int future_tostring(lua_State *L) {
+    lua_pushfstring(L, "sqlite future (%p)", lua_touserdata(L, 1));
+    return 1;
+}
+
+static int future_gc(lua_State *L) {
+    sdb_async *as;
+    sdb_job *job = lsqlite_checkfuture(L, 1, &as);
+    if (job == NULL)
+        return 0;
+    if (as->open) {
+        /* only when the worker is being collected as well */
+        pthread_mutex_lock(&as->lock);
+        if (job->state == JOB_RUNNING) {
+            job->cancel = 1;
+            job->orphan = 1;
+            job = NULL;
+        }
+        else if (job->state == JOB_QUEUED) {
+            sdb_job **link = &as->queue;
+            as->last = NULL;
+            while (*link) {
+                if (*link == job) *link = job->next;
+                else {
+                    as->last = *link;
+                    link = &(*link)->next;
+                }
+            }
+        }
+        pthread_mutex_unlock(&as->lock);
+    }
+    if (job)
+        job_free(job);
+    return 0;
+}
+
+static const luaL_Reg asynclib[] = {
+    {"query",               async_query             },
+    {"poll",                async_poll              },
+    {"getfd",               async_getfd             },
+    {"busy_timeout",        async_busy_timeout      },
+    {"isopen",              async_isopen            },
+    {"close",               async_close_lua         },
+
+    {"__tostring",          async_tostring          },
+    {"__gc",                async_gc                },
+
+    {NULL, NULL}
+};
+
+static const luaL_Reg futurelib[] = {
+    {"done",                future_done             },
+    {"result",              future_result           },
+    {"cancel",              future_cancel           },
+
+    {"__tostring",          future_tostring         },
+    {"__gc",                future_gc               },
+
+    {NULL, NULL}
+};
+
+#else /* #ifndef WIN32 */
+
+static int db_async(lua_State *L) {
+    lua_pushliteral(L, "background workers are not supported on this platform");
+    lua_error(L);
+    return 0;
+}
+
+#endif /* #ifndef WIN32 */
+
+/*
+** =======================================================
+** General library functions
+** =======================================================
+*/
+
+static int lsqlite_version(lua_State *L) {
+    lua_pushstring(L, sqlite3_libversion());
+    return 1;
+}
+
+static int lsqlite_complete(lua_State *L) {
+    const char *sql = luaL_checkstring(L, 1);
+    lua_pushboolean(L, sqlite3_complete(sql));
+    return 1;
+}
+
+#ifndef WIN32
+static int lsqlite_temp_directory(lua_State *L) {
+    const char *oldtemp = sqlite3_temp_directory;
+
+    if (!lua_isnone(L, 1)) {
+        const char *temp = luaL_optstring(L, 1, NULL);
+        if (sqlite3_temp_directory) {
+            sqlite3_free((char*)sqlite3_temp_directory);
+        }
+        if (temp) {
+            sqlite3_temp_directory = sqlite3_mprintf("%s", temp);
+        }
+        else {
+            sqlite3_temp_directory = NULL;
+        }
+    }
+    lua_pushstring(L, oldtemp);
+    return 1;
+}
+#endif
 
 static int lsqlite_do_open(lua_State *L, const char *filename) {
     sdb *db = newdb(L); /* create and leave in stack */
@@ -1762,6 +3488,7 @@ static const luaL_Reg dblib[] = {
     {"busy_handler",        db_busy_handler         },
 
     {"prepare",             db_prepare              },
+    {"insert_many",         db_insert_many          },
     {"rows",                db_rows                 },
     {"urows",               db_urows                },
     {"nrows",               db_nrows                },
@@ -1770,6 +3497,15 @@ static const luaL_Reg dblib[] = {
     {"execute",             db_exec                 },
     {"close",               db_close                },
     {"close_vm",            db_close_vm             },
+    {"cache_size",          db_cache_size           },
+    {"cache_stats",         db_cache_stats          },
+    {"status",              db_status               },
+    {"mmap_size",           db_mmap_size            },
+    {"page_cache_size",     db_page_cache_size      },
+    {"journal_mode",        db_journal_mode         },
+    {"wal_checkpoint",      db_wal_checkpoint       },
+    {"async",               db_async                },
+    {"blob_open",           db_blob_open            },
 
     {"__tostring",          db_tostring             },
     {"__gc",                db_gc                   },
@@ -1785,6 +3521,7 @@ static const luaL_Reg vmlib[] = {
     {"finalize",            dbvm_finalize           },
 
     {"columns",             dbvm_columns            },
+    {"status",              dbvm_status             },
 
     {"bind",                dbvm_bind               },
     {"bind_values",         dbvm_bind_values        },
@@ -1792,6 +3529,7 @@ static const luaL_Reg vmlib[] = {
     {"bind_blob",           dbvm_bind_blob          },
     {"bind_parameter_count",dbvm_bind_parameter_count},
     {"bind_parameter_name", dbvm_bind_parameter_name},
+    {"executemany",         dbvm_executemany        },
 
     {"get_value",           dbvm_get_value          },
     {"get_values",          dbvm_get_values         },
@@ -1810,6 +3548,9 @@ static const luaL_Reg vmlib[] = {
     {"urows",               dbvm_urows              },
     {"nrows",               dbvm_nrows              },
 
+    {"fetch_columns",       dbvm_fetch_columns      },
+    {"fetch_into",          dbvm_fetch_into         },
+
     /* compatibility names (added by request) */
     {"idata",               dbvm_get_values         },
     {"inames",              dbvm_get_names          },
@@ -1823,6 +3564,22 @@ static const luaL_Reg vmlib[] = {
     { NULL, NULL }
 };
 
+static const luaL_Reg bloblib[] = {
+    {"read",                blob_read               },
+    {"write",               blob_write              },
+    {"reopen",              blob_reopen             },
+    {"bytes",               blob_bytes              },
+    {"source",              blob_source             },
+    {"sink",                blob_sink               },
+    {"isopen",              blob_isopen             },
+    {"close",               blob_close              },
+
+    {"__tostring",          blob_tostring           },
+    {"__gc",                blob_gc                 },
+
+    {NULL, NULL}
+};
+
 static const luaL_Reg ctxlib[] = {
     {"user_data",               lcontext_user_data              },
 
@@ -1877,6 +3634,11 @@ LUALIB_API int luaopen_lsqlite3(lua_State *L) {
     create_meta(L, sqlite_meta, dblib);
     create_meta(L, sqlite_vm_meta, vmlib);
     create_meta(L, sqlite_ctx_meta, ctxlib);
+    create_meta(L, sqlite_blob_meta, bloblib);
+#ifndef WIN32
+    create_meta(L, sqlite_async_meta, asynclib);
+    create_meta(L, sqlite_future_meta, futurelib);
+#endif
 
     luaL_getmetatable(L, sqlite_ctx_meta);
     sqlite_ctx_meta_ref = luaL_ref(L, LUA_REGISTRYINDEX);
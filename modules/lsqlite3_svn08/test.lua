@@ -146,7 +146,211 @@ if (true) then
     print('elapsed: '..(os.time() - t))
     do_query('select count(*) from t')
 
+    line(nil, '100000 insert executemany')
+    db:exec('delete from t')
+    local t = os.time()
+    local rows = {}
+    for i = 1, 100000 do
+        rows[i] = { i, i * 2 * -1^i }
+    end
+    vm = db:prepare('insert into t values(?, ?)')
+    assert(vm:executemany(rows) == sqlite3.OK)
+    vm:finalize()
+    print('elapsed: '..(os.time() - t))
+    do_query('select count(*) from t')
+
+end
+
+line(nil, 'executemany')
+
+db:exec('CREATE TABLE m(k UNIQUE, v)')
+vm = db:prepare('insert into m values(?, ?)')
+local code, n = vm:executemany{ {1, 'one'}, {2, 'two'}, {3} }
+assert(code == sqlite3.OK and n == 3)
+-- a failing row rolls back the whole batch
+local code, row, msg = vm:executemany{ {4, 'four'}, {5, 'five'}, {1, 'dup'} }
+assert_(code == sqlite3.CONSTRAINT and row == 3 and type(msg) == 'string')
+local code, row = vm:executemany{ {6}, {{}} }
+assert_(code == sqlite3.MISMATCH and row == 2)
+assert(vm:finalize() == sqlite3.OK)
+-- inside an open transaction the caller keeps control
+db:exec('begin')
+assert(db:insert_many('insert into m values(:k, :v)',
+    { {k = 7, v = 'seven'}, {k = 8} }) == sqlite3.OK)
+db:exec('rollback')
+assert(db:insert_many('insert into m values(:k, :v)',
+    { {k = 9, v = 'nine'} }) == sqlite3.OK)
+local code, row = db:insert_many('insert into nosuchtable values(?)', { {1} })
+assert_(code ~= sqlite3.OK and row == 0)
+for k, v in db:urows('select count(*), sum(k) from m') do
+    assert_(k == 4 and v == 15)
+end
+
+line(nil, 'statement cache')
+
+assert(db:cache_size() == 16)
+local hits, misses = db:cache_stats()
+for i = 1, 3 do
+    db:exec('insert into m values(100, 0)')
+    db:exec('delete from m where k = 100')
+end
+for i = 1, 3 do
+    for n in db:urows('select count(*) from m') do assert_(n == 4) end
+end
+vm = db:prepare('select k from m where v = ?')
+assert(vm:finalize() == sqlite3.OK)
+vm = db:prepare('select k from m where v = ?')
+assert(vm:bind_values('nine') == sqlite3.OK)
+assert(vm:step() == sqlite3.ROW and vm:get_value(0) == 9)
+assert(vm:finalize() == sqlite3.OK)
+local h, m, n = db:cache_stats()
+assert_(h - hits == 7 and m - misses == 4 and n == 16)
+-- a statement taken from the cache has no bindings left
+vm = db:prepare('select k from m where v = ?')
+assert(vm:step() == sqlite3.DONE)
+assert(vm:finalize() == sqlite3.OK)
+-- statements go stale when the schema changes
+db:exec('insert into m(v) values(0)')
+db:exec('alter table m add column w')
+db:exec('insert into m(v) values(0)')
+for n in db:urows('select count(*) from m') do assert_(n == 6) end
+assert(db:cache_size(2) == 16)
+assert(select(3, db:cache_stats()) == 2)
+assert(db:cache_size(0) == 2)
+assert(select(3, db:cache_stats()) == 0)
+db:exec('delete from m where v = 0')
+assert(select(3, db:cache_stats()) == 0)
+db:cache_size(16)
+-- statements cached by rows and insert_many keep their real tail
+for n in db:urows('select count(*) from m; ') do assert_(n == 4) end
+local tail
+vm, tail = db:prepare('select count(*) from m; ')
+assert_(vm and tail == ' ')
+assert(vm:finalize() == sqlite3.OK)
+assert(db:insert_many('insert into m(k, v) values(?, ?); ', {}) == sqlite3.OK)
+vm, tail = db:prepare('insert into m(k, v) values(?, ?); ')
+assert_(vm and tail == ' ')
+assert(vm:finalize() == sqlite3.OK)
+
+line(nil, 'fetch_columns / fetch_into')
+
+vm = db:prepare('select k, v from m order by k')
+local cols, n = vm:fetch_columns(3)
+assert_(n == 3 and cols.n == 3 and #cols == 2)
+assert_(cols[1][1] == 1 and cols[1][3] == 3 and cols[2][2] == 'two')
+assert_(cols[2][3] == nil)
+-- the next batch refills the same arrays and clears what is left over
+local k = cols[1]
+local again, n = vm:fetch_columns(3, cols)
+assert_(again == cols and cols[1] == k and n == 1)
+assert_(k[1] == 9 and k[2] == nil and cols[2][1] == 'nine')
+-- the statement was reset, so it starts over
+local cols, n = vm:fetch_columns(10)
+assert_(n == 4 and cols[1][4] == 9)
+local row, count = {}, 0
+while vm:fetch_into(row) do
+    count = count + 1
+    assert_(row[1] == ({1, 2, 3, 9})[count])
+end
+assert_(count == 4)
+assert_(vm:fetch_into(row, true) == row and row.k == 1 and row.v == 'one')
+assert(vm:finalize() == sqlite3.OK)
+
+line(nil, 'background worker')
+
+db:exec('CREATE TABLE a(x, y)')
+db:busy_timeout(1000)
+local w = db:async()
+assert_(w and type(w:getfd()) == 'number')
+local f1 = w:query('insert into a values(?, ?)', 1, 'one')
+local f2 = w:query('insert into a values(?, ?); select x, y from a order by x',
+    2, 'two')
+local rows = f2:result()
+assert_(#rows == 2 and rows[2][1] == 2 and rows[2][2] == 'two')
+assert_(rows.names[1] == 'x' and rows.names[2] == 'y')
+assert_(f1:done())
+rows = f1:result()
+assert_(#rows == 0 and rows.changes == 1 and rows.last_insert_rowid == 1)
+local r, code, msg = w:query('select * from nosuchtable'):result()
+assert_(r == nil and code == sqlite3.ERROR and msg:find('nosuchtable'))
+-- futures not collected through result() are handed out by poll
+local f3 = w:query('select count(*) from a')
+repeat until f3:done()
+local done = w:poll()
+assert_(#done == 1 and done[1] == f3 and f3:result()[1][1] == 2)
+assert_(#w:poll() == 0)
+-- cancelling stops a running query as well as a queued one
+local forever = w:query([[with recursive c(n) as (select 1 union all
+    select n + 1 from c) select count(*) from c]])
+local queued = w:query('select 1')
+assert_(queued:cancel() and forever:cancel())
+assert_(select(2, queued:result()) == sqlite3.INTERRUPT)
+assert_(select(2, forever:result()) == sqlite3.INTERRUPT)
+assert_(not forever:cancel())
+-- the worker gives up once the busy timeout is exceeded
+db:exec('begin exclusive')
+w:busy_timeout(50)
+assert_(select(2, w:query('select count(*) from a'):result()) == sqlite3.BUSY)
+db:exec('commit')
+for n in db:urows('select count(*) from a') do assert_(n == 2) end
+local last = w:query('select 1')
+assert(w:close() == sqlite3.OK)
+assert_(not w:isopen() and last:done())
+assert_(last:result() or select(2, last:result()) == sqlite3.ABORT)
+
+line(nil, 'status and tuning')
+
+assert_(db:page_cache_size(500) == 500 and db:page_cache_size() == 500)
+assert_(db:mmap_size(1048576) == 1048576)
+assert_(db:journal_mode('wal') == 'wal')
+assert_(db:wal_checkpoint('full') == sqlite3.OK)
+assert_(db:journal_mode('delete') == 'delete')
+assert_(not pcall(db.journal_mode, db, 'wal; drop table m'))
+db:status(true)
+vm = db:prepare('select count(*) from m where v = ?')
+assert(vm:bind_values('nine') == sqlite3.OK)
+assert(vm:step() == sqlite3.ROW and vm:get_value(0) == 1)
+local st = vm:status()
+assert_(st.fullscan_step > 0 and st.sort == 0 and st.vm_step > 0)
+assert_(vm:status(true).run == 1 and vm:status().vm_step == 0)
+assert(vm:finalize() == sqlite3.OK)
+st = db:status()
+assert_(st.cache_used > 0 and st.cache_hit > 0 and st.lookaside_used_max >= 0)
+assert_(db:status(true).cache_hit > 0 and db:status().cache_hit == 0)
+
+line(nil, 'blob streams')
+
+db:exec('CREATE TABLE b(data)')
+assert(db:exec('insert into b values(zeroblob(10000)); insert into b values(zeroblob(3))') == sqlite3.OK)
+local blob = db:blob_open('b', 'data', 1, true)
+assert_(blob and blob:bytes() == 10000)
+local sink = blob:sink()
+for i = 1, 10 do
+    assert_(sink(string.rep(string.char(64 + i), 1000)) == 1)
+end
+assert_(sink(nil) == 1)
+assert_(sink('x') == nil)
+assert_(blob:write('abc', 0) == sqlite3.OK and blob:write('d') == sqlite3.OK)
+assert_(blob:read(5, 0) == 'abcdA' and blob:read(2, 9998) == 'JJ')
+assert_(blob:read(1) == nil)
+assert_(blob:read(1, 0) == 'a')
+local chunks = {}
+for chunk in blob:source(3000) do chunks[#chunks + 1] = chunk end
+assert_(#chunks == 4 and #chunks[4] == 999 and #table.concat(chunks) == 9999)
+assert_(blob:reopen(2) == sqlite3.OK and blob:bytes() == 3)
+assert_(blob:write('xyz') == sqlite3.OK and blob:read(3, 0) == 'xyz')
+assert(blob:close() == sqlite3.OK and not blob:isopen())
+local v = db:blob_open('b', 'data', 1)
+assert_(v:write('q', 0) == sqlite3.READONLY)
+v:close()
+assert_(not v:isopen())
+for data in db:urows('select data from b where rowid = 1') do
+    assert_(data:sub(1, 6) == 'abcdAA' and #data == 10000)
 end
+local r, code = db:blob_open('b', 'data', 99)
+assert_(r == nil and code == sqlite3.ERROR)
+-- handles left open are closed with the database
+db:blob_open('b', 'data', 2)
 
 line(nil, "db:close")
 
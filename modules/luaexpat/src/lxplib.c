@@ -22,6 +22,14 @@
 
 
 
+/* how StartElement receives the attributes */
+enum XPAttrs {
+  XPAtable,  /* a new table of names and values */
+  XPAflat,   /* name, value, name, value, ... as arguments */
+  XPAview    /* a reusable view, valid during the callback only */
+};
+
+
 enum XPState {
   XPSpre,  /* parser just initialized */
   XPSok,   /* state while parsing */
@@ -37,11 +45,60 @@ struct lxp_userdata {
   int tableref;  /* table with callbacks for this parser */
   enum XPState state;
   luaL_Buffer *b;  /* to concatenate sequences of cdata pieces */
+  enum XPAttrs attrmode;
+  int namesref;  /* cache of element and attribute names */
+  int namecount;  /* entries in the cache */
+  int viewref;  /* attribute view, in XPAview mode */
+  /* batched delivery; batchref is LUA_REFNIL when not batching */
+  int batchref;  /* arrays of types, names and payloads */
+  char *events;  /* recorded events */
+  size_t evlen, evsize;
+  int nevents;  /* events recorded */
+  int lastn;  /* events in the last batch delivered */
+  long textpos;  /* offset of the length of a text event being extended */
+  int maxevents;
+  size_t maxbytes;
 };
 
 typedef struct lxp_userdata lxp_userdata;
 
 
+/* attributes of the element being started, for the attribute view */
+struct lxp_attrs {
+  const char **attrs;  /* NULL outside the StartElement callback */
+  int nspec;  /* number of attributes specified in the document */
+};
+
+typedef struct lxp_attrs lxp_attrs;
+
+
+/* stack index of the name cache while parsing */
+#define NAMESIDX	4
+
+/* the name cache is emptied when it grows beyond this */
+#define MAXNAMES	1024
+
+/* default limits of a batch */
+#define BATCHEVENTS	256
+#define BATCHBYTES	65536
+
+
+/*
+** Batched events are recorded as a type byte followed by the event's
+** data: start: attribute count, specified count, name, then attribute
+** names and values; end: name; text: length and bytes; comment: text;
+** pi: target and data. Strings are stored with their terminating zero.
+*/
+enum XPEvent {
+  XPEstart, XPEend, XPEtext, XPEcomment, XPEpi, XPEcdstart, XPEcdend
+};
+
+static const char *const eventnames[] = {
+  StartElementKey, EndElementKey, CharDataKey, CommentKey,
+  ProcessingInstructionKey, StartCdataKey, EndCdataKey
+};
+
+
 static int reporterror (lxp_userdata *xpu) {
   lua_State *L = xpu->L;
   XML_Parser p = xpu->parser;
@@ -54,10 +111,32 @@ static int reporterror (lxp_userdata *xpu) {
 }
 
 
+/*
+** Give a parser its name cache and, in XPAview mode, its attribute view
+*/
+static void initattrs (lua_State *L, lxp_userdata *xpu, enum XPAttrs mode) {
+  xpu->attrmode = mode;
+  lua_newtable(L);
+  xpu->namesref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if (mode == XPAview) {
+    lxp_attrs *view = (lxp_attrs *)lua_newuserdata(L, sizeof(lxp_attrs));
+    view->attrs = NULL;
+    view->nspec = 0;
+    luaL_getmetatable(L, AttributesType);
+    lua_setmetatable(L, -2);
+    xpu->viewref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+}
+
+
 static lxp_userdata *createlxp (lua_State *L) {
   lxp_userdata *xpu = (lxp_userdata *)lua_newuserdata(L, sizeof(lxp_userdata));
   memset(xpu, 0, sizeof(*xpu));
   xpu->tableref = LUA_REFNIL;  /* in case of errors... */
+  xpu->namesref = LUA_REFNIL;
+  xpu->viewref = LUA_REFNIL;
+  xpu->batchref = LUA_REFNIL;
+  xpu->textpos = -1;
   xpu->state = XPSpre;
   luaL_getmetatable(L, ParserType);
   lua_setmetatable(L, -2);
@@ -68,6 +147,16 @@ static lxp_userdata *createlxp (lua_State *L) {
 static void lxpclose (lua_State *L, lxp_userdata *xpu) {
   luaL_unref(L, LUA_REGISTRYINDEX, xpu->tableref);
   xpu->tableref = LUA_REFNIL;
+  luaL_unref(L, LUA_REGISTRYINDEX, xpu->namesref);
+  xpu->namesref = LUA_REFNIL;
+  luaL_unref(L, LUA_REGISTRYINDEX, xpu->viewref);
+  xpu->viewref = LUA_REFNIL;
+  luaL_unref(L, LUA_REGISTRYINDEX, xpu->batchref);
+  xpu->batchref = LUA_REFNIL;
+  free(xpu->events);
+  xpu->events = NULL;
+  xpu->evlen = xpu->evsize = 0;
+  xpu->nevents = 0;
   if (xpu->parser)
     XML_ParserFree(xpu->parser);
   xpu->parser = NULL;
@@ -101,6 +190,9 @@ static void dischargestring (lxp_userdata *xpu) {
 }
 
 
+static void flushbatch (lxp_userdata *xpu);
+
+
 /*
 ** Check whether there is a Lua handle for a given event: If so,
 ** put it on the stack (to be called later), and also push `self'
@@ -108,6 +200,7 @@ static void dischargestring (lxp_userdata *xpu) {
 static int getHandle (lxp_userdata *xpu, const char *handle) {
   lua_State *L = xpu->L;
   if (xpu->state == XPSstring) dischargestring(xpu);
+  if (xpu->nevents > 0) flushbatch(xpu);  /* keep events in order */
   if (xpu->state == XPSerror)
     return 0;  /* some error happened before; skip all handles */
   lua_pushstring(L, handle);
@@ -125,6 +218,35 @@ static int getHandle (lxp_userdata *xpu, const char *handle) {
 
 
 
+/*
+** Push an element or attribute name. Expat hands out names from its own
+** buffers, so the string pushed for a pointer is cached and reused as
+** long as the pointer still holds the same name.
+*/
+static void pushname (lxp_userdata *xpu, const char *name) {
+  lua_State *L = xpu->L;
+  lua_pushlightuserdata(L, (void *)name);
+  lua_rawget(L, NAMESIDX);
+  if (lua_isstring(L, -1) && strcmp(lua_tostring(L, -1), name) == 0)
+    return;
+  lua_pop(L, 1);
+  if (xpu->namecount >= MAXNAMES) {  /* start afresh */
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, LUA_REGISTRYINDEX, xpu->namesref);
+    lua_replace(L, NAMESIDX);
+    xpu->namecount = 0;
+  }
+  lua_pushlightuserdata(L, (void *)name);
+  lua_pushstring(L, name);
+  lua_pushvalue(L, -1);
+  lua_insert(L, -3);
+  lua_rawset(L, NAMESIDX);
+  xpu->namecount++;
+}
+
+
+
 /*
 ** {======================================================
 ** Handles
@@ -188,26 +310,53 @@ static void f_StartElement (void *ud, const char *name, const char **attrs) {
   int lastspec = XML_GetSpecifiedAttributeCount(xpu->parser) / 2;
   int i = 1;
   if (getHandle(xpu, StartElementKey) == 0) return;  /* no handle */
-  lua_pushstring(L, name);
-  lua_newtable(L);
-  while (*attrs) {
-    if (i <= lastspec) {
-      lua_pushnumber(L, i++);
-      lua_pushstring(L, *attrs);
-      lua_settable(L, -3);
+  pushname(xpu, name);
+  switch (xpu->attrmode) {
+    case XPAflat: {
+      int n = 0;
+      while (attrs[n]) n++;
+      luaL_checkstack(L, n + 4, "too many attributes");
+      for (i = 0; i < n; i += 2) {
+        pushname(xpu, attrs[i]);
+        lua_pushstring(L, attrs[i + 1]);
+      }
+      docall(xpu, 1 + n, 0);  /* call function with self, name, attributes */
+      break;
+    }
+    case XPAview: {
+      lxp_attrs *view;
+      lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->viewref);
+      view = (lxp_attrs *)lua_touserdata(L, -1);
+      view->attrs = attrs;
+      view->nspec = lastspec;
+      docall(xpu, 2, 0);  /* call function with self, name, and the view */
+      view->attrs = NULL;
+      break;
+    }
+    default: {
+      int n = 0;
+      while (attrs[n]) n += 2;
+      lua_createtable(L, lastspec, n / 2);
+      while (*attrs) {
+        if (i <= lastspec) {
+          pushname(xpu, *attrs);
+          lua_rawseti(L, -2, i++);
+        }
+        pushname(xpu, *attrs++);
+        lua_pushstring(L, *attrs++);
+        lua_rawset(L, -3);
+      }
+      docall(xpu, 2, 0);  /* call function with self, name, and attributes */
+      break;
     }
-    lua_pushstring(L, *attrs++);
-    lua_pushstring(L, *attrs++);
-    lua_settable(L, -3);
   }
-  docall(xpu, 2, 0);  /* call function with self, name, and attributes */
 }
 
 
 static void f_EndElement (void *ud, const char *name) {
   lxp_userdata *xpu = (lxp_userdata *)ud;
   if (getHandle(xpu, EndElementKey) == 0) return;  /* no handle */
-  lua_pushstring(xpu->L, name);
+  pushname(xpu, name);
   docall(xpu, 1, 0);
 }
 
@@ -227,6 +376,7 @@ static int f_ExternaEntity (XML_Parser p, const char *context,
     luaL_error(L, "XML_ParserCreate failed");
   lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->tableref);  /* child uses the same table of its father */
   child->tableref = luaL_ref(L, LUA_REGISTRYINDEX);
+  initattrs(L, child, xpu->attrmode);
   lua_pushstring(L, base);
   lua_pushstring(L, systemId);
   lua_pushstring(L, publicId);
@@ -315,6 +465,322 @@ static void f_UnparsedEntityDecl (void *ud, const char *entityName,
 
 
 
+/*
+** {======================================================
+** Batched events
+** =======================================================
+*/
+
+
+static char *reserve (lxp_userdata *xpu, size_t n) {
+  char *e;
+  if (xpu->evlen + n > xpu->evsize) {
+    size_t size = xpu->evsize ? xpu->evsize : 1024;
+    while (size < xpu->evlen + n) size *= 2;
+    e = (char *)realloc(xpu->events, size);
+    if (e == NULL)
+      luaL_error(xpu->L, "not enough memory for batched events");
+    xpu->events = e;
+    xpu->evsize = size;
+  }
+  e = xpu->events + xpu->evlen;
+  xpu->evlen += n;
+  return e;
+}
+
+
+static void addint (lxp_userdata *xpu, int i) {
+  memcpy(reserve(xpu, sizeof(int)), &i, sizeof(int));
+}
+
+
+static void addstring (lxp_userdata *xpu, const char *s) {
+  size_t l = strlen(s) + 1;
+  memcpy(reserve(xpu, l), s, l);
+}
+
+
+static int getint (const char **e) {
+  int i;
+  memcpy(&i, *e, sizeof(int));
+  *e += sizeof(int);
+  return i;
+}
+
+
+static const char *getstring (const char **e) {
+  const char *s = *e;
+  *e += strlen(s) + 1;
+  return s;
+}
+
+
+static int beginevent (lxp_userdata *xpu, enum XPEvent type) {
+  if (xpu->state == XPSerror)
+    return 0;  /* some error happened before; skip all events */
+  xpu->textpos = -1;
+  *reserve(xpu, 1) = (char)type;
+  xpu->nevents++;
+  return 1;
+}
+
+
+/* deliver the batch once it is full; text events are never split */
+static void endevent (lxp_userdata *xpu) {
+  if (xpu->nevents >= xpu->maxevents || xpu->evlen >= xpu->maxbytes)
+    flushbatch(xpu);
+}
+
+
+/*
+** Call the batch handler with self, the arrays of types, names and
+** payloads, and the number of events in them
+*/
+static void flushbatch (lxp_userdata *xpu) {
+  lua_State *L = xpu->L;
+  const char *e = xpu->events;
+  int n = xpu->nevents;
+  int i;
+  xpu->nevents = 0;
+  xpu->evlen = 0;
+  xpu->textpos = -1;
+  if (xpu->state == XPSerror || n == 0)
+    return;
+  luaL_checkstack(L, 12, "cannot deliver batch");
+  lua_pushstring(L, BatchKey);
+  lua_gettable(L, 3);
+  lua_pushvalue(L, 1);  /* self */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->batchref);
+  lua_rawgeti(L, -1, 1);
+  lua_rawgeti(L, -2, 2);
+  lua_rawgeti(L, -3, 3);
+  lua_remove(L, -4);  /* handler, self, types, names, payloads */
+  for (i = 1; i <= n; i++) {
+    enum XPEvent type = (enum XPEvent)*e++;
+    lua_pushstring(L, eventnames[type]);
+    lua_rawseti(L, -4, i);
+    switch (type) {
+      case XPEstart: {
+        int nattrs = getint(&e);
+        int nspec = getint(&e);
+        int j;
+        pushname(xpu, getstring(&e));
+        lua_rawseti(L, -3, i);
+        lua_createtable(L, nspec, nattrs);
+        for (j = 0; j < nattrs; j++) {
+          const char *name = getstring(&e);
+          if (j < nspec) {
+            pushname(xpu, name);
+            lua_rawseti(L, -2, j + 1);
+          }
+          pushname(xpu, name);
+          lua_pushstring(L, getstring(&e));
+          lua_rawset(L, -3);
+        }
+        lua_rawseti(L, -2, i);
+        continue;
+      }
+      case XPEend:
+        pushname(xpu, getstring(&e));
+        lua_rawseti(L, -3, i);
+        lua_pushnil(L);
+        break;
+      case XPEtext: {
+        int len = getint(&e);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, i);
+        lua_pushlstring(L, e, len);
+        e += len;
+        break;
+      }
+      case XPEpi:
+        lua_pushstring(L, getstring(&e));
+        lua_rawseti(L, -3, i);
+        lua_pushstring(L, getstring(&e));
+        break;
+      case XPEcomment:
+        lua_pushnil(L);
+        lua_rawseti(L, -3, i);
+        lua_pushstring(L, getstring(&e));
+        break;
+      default:
+        lua_pushnil(L);
+        lua_rawseti(L, -3, i);
+        lua_pushnil(L);
+        break;
+    }
+    lua_rawseti(L, -2, i);
+  }
+  for (i = n + 1; i <= xpu->lastn; i++) {  /* clear the last batch's tail */
+    lua_pushnil(L); lua_rawseti(L, -4, i);
+    lua_pushnil(L); lua_rawseti(L, -3, i);
+    lua_pushnil(L); lua_rawseti(L, -2, i);
+  }
+  xpu->lastn = n;
+  lua_pushnumber(L, n);
+  docall(xpu, 4, 0);
+}
+
+
+static void b_StartElement (void *ud, const char *name, const char **attrs) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  int nspec = XML_GetSpecifiedAttributeCount(xpu->parser) / 2;
+  int n = 0;
+  if (beginevent(xpu, XPEstart) == 0) return;
+  while (attrs[n]) n += 2;
+  addint(xpu, n / 2);
+  addint(xpu, nspec);
+  addstring(xpu, name);
+  while (*attrs)
+    addstring(xpu, *attrs++);
+  endevent(xpu);
+}
+
+
+static void b_EndElement (void *ud, const char *name) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  if (beginevent(xpu, XPEend) == 0) return;
+  addstring(xpu, name);
+  endevent(xpu);
+}
+
+
+/* consecutive pieces of character data make up one event */
+static void b_CharData (void *ud, const char *s, int len) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  int total;
+  if (xpu->textpos < 0) {
+    if (beginevent(xpu, XPEtext) == 0) return;
+    xpu->textpos = (long)xpu->evlen;
+    addint(xpu, 0);
+  }
+  memcpy(reserve(xpu, len), s, len);
+  memcpy(&total, xpu->events + xpu->textpos, sizeof(int));
+  total += len;
+  memcpy(xpu->events + xpu->textpos, &total, sizeof(int));
+}
+
+
+static void b_Comment (void *ud, const char *data) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  if (beginevent(xpu, XPEcomment) == 0) return;
+  addstring(xpu, data);
+  endevent(xpu);
+}
+
+
+static void b_ProcessingInstruction (void *ud, const char *target,
+                                               const char *data) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  if (beginevent(xpu, XPEpi) == 0) return;
+  addstring(xpu, target);
+  addstring(xpu, data);
+  endevent(xpu);
+}
+
+
+static void b_StartCdata (void *ud) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  if (beginevent(xpu, XPEcdstart) == 0) return;
+  endevent(xpu);
+}
+
+
+static void b_EndCdata (void *ud) {
+  lxp_userdata *xpu = (lxp_userdata *)ud;
+  if (beginevent(xpu, XPEcdend) == 0) return;
+  endevent(xpu);
+}
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Attribute view
+** =======================================================
+*/
+
+
+static lxp_attrs *checkattrs (lua_State *L) {
+  lxp_attrs *view = (lxp_attrs *)luaL_checkudata(L, 1, AttributesType);
+  if (view->attrs == NULL)
+    luaL_error(L, "attribute view used outside its StartElement callback");
+  return view;
+}
+
+
+/* view[i] is the name of the i-th specified attribute, view[name] its value */
+static int attrs_index (lua_State *L) {
+  lxp_attrs *view = checkattrs(L);
+  const char **a;
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    int i = (int)lua_tointeger(L, 2);
+    if (i >= 1 && i <= view->nspec)
+      lua_pushstring(L, view->attrs[2 * (i - 1)]);
+    else
+      lua_pushnil(L);
+    return 1;
+  }
+  if (lua_type(L, 2) == LUA_TSTRING) {
+    const char *name = lua_tostring(L, 2);
+    for (a = view->attrs; *a; a += 2) {
+      if (strcmp(*a, name) == 0) {
+        lua_pushstring(L, a[1]);
+        return 1;
+      }
+    }
+  }
+  lua_pushnil(L);
+  return 1;
+}
+
+
+static int attrs_len (lua_State *L) {
+  lxp_attrs *view = checkattrs(L);
+  lua_pushnumber(L, view->nspec);
+  return 1;
+}
+
+
+/* iterates over names and values, in document order */
+static int attrs_next (lua_State *L) {
+  lxp_attrs *view = checkattrs(L);
+  const char **a = view->attrs;
+  if (!lua_isnil(L, 2)) {
+    const char *name = luaL_checkstring(L, 2);
+    while (*a && strcmp(*a, name) != 0) a += 2;
+    if (*a) a += 2;
+  }
+  if (*a == NULL)
+    return 0;
+  lua_pushstring(L, a[0]);
+  lua_pushstring(L, a[1]);
+  return 2;
+}
+
+
+static int attrs_pairs (lua_State *L) {
+  checkattrs(L);
+  lua_pushcfunction(L, attrs_next);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  return 3;
+}
+
+
+static const struct luaL_Reg attrs_meths[] = {
+  {"__index", attrs_index},
+  {"__len", attrs_len},
+  {"__pairs", attrs_pairs},
+  {NULL, NULL}
+};
+
+/* }====================================================== */
+
+
+
 static int hasfield (lua_State *L, const char *fname) {
   int res;
   lua_pushstring(L, fname);
@@ -331,7 +797,8 @@ static void checkcallbacks (lua_State *L) {
     "Default", "DefaultExpand", "StartElement", "EndElement",
     "ExternalEntityRef", "StartNamespaceDecl", "EndNamespaceDecl",
     "NotationDecl", "NotStandalone", "ProcessingInstruction",
-    "UnparsedEntityDecl", NULL};
+    "UnparsedEntityDecl", "_attributes", BatchKey, "_batchevents",
+    "_batchbytes", NULL};
   if (hasfield(L, "_nonstrict")) return;
   lua_pushnil(L);
   while (lua_next(L, 1)) {
@@ -347,6 +814,55 @@ static void checkcallbacks (lua_State *L) {
 }
 
 
+static enum XPAttrs getattrmode (lua_State *L) {
+  static const char *const modes[] = {"table", "flat", "view", NULL};
+  enum XPAttrs mode;
+  lua_getfield(L, 1, "_attributes");
+  if (lua_isnil(L, -1))
+    mode = XPAtable;
+  else
+    mode = (enum XPAttrs)luaL_checkoption(L, -1, NULL, modes);
+  lua_pop(L, 1);
+  return mode;
+}
+
+
+/*
+** Set up batched delivery of the events that can be batched, which then
+** cannot have callbacks of their own
+*/
+static void initbatch (lua_State *L, lxp_userdata *xpu) {
+  static const char *const batched[] = {
+    StartElementKey, EndElementKey, CharDataKey, CommentKey,
+    ProcessingInstructionKey, StartCdataKey, EndCdataKey, NULL};
+  const char *const *key;
+  XML_Parser p = xpu->parser;
+  lua_getfield(L, 1, BatchKey);
+  if (!lua_isfunction(L, -1))
+    luaL_error(L, "lxp `%s' callback is not a function", BatchKey);
+  lua_pop(L, 1);
+  for (key = batched; *key; key++)
+    if (hasfield(L, *key))
+      luaL_error(L, "lxp `%s' callback cannot be used with `%s'", *key, BatchKey);
+  lua_getfield(L, 1, "_batchevents");
+  xpu->maxevents = (int)luaL_optinteger(L, -1, BATCHEVENTS);
+  lua_getfield(L, 1, "_batchbytes");
+  xpu->maxbytes = (size_t)luaL_optinteger(L, -1, BATCHBYTES);
+  lua_pop(L, 2);
+  luaL_argcheck(L, xpu->maxevents > 0, 1, "invalid `_batchevents'");
+  lua_createtable(L, 3, 0);
+  lua_newtable(L); lua_rawseti(L, -2, 1);
+  lua_newtable(L); lua_rawseti(L, -2, 2);
+  lua_newtable(L); lua_rawseti(L, -2, 3);
+  xpu->batchref = luaL_ref(L, LUA_REGISTRYINDEX);
+  XML_SetElementHandler(p, b_StartElement, b_EndElement);
+  XML_SetCharacterDataHandler(p, b_CharData);
+  XML_SetCommentHandler(p, b_Comment);
+  XML_SetProcessingInstructionHandler(p, b_ProcessingInstruction);
+  XML_SetCdataSectionHandler(p, b_StartCdata, b_EndCdata);
+}
+
+
 static int lxp_make_parser (lua_State *L) {
   XML_Parser p;
   char sep = *luaL_optstring(L, 2, "");
@@ -359,6 +875,7 @@ static int lxp_make_parser (lua_State *L) {
   checkcallbacks(L);
   lua_pushvalue(L, 1);
   xpu->tableref = luaL_ref(L, LUA_REGISTRYINDEX);
+  initattrs(L, xpu, getattrmode(L));
   XML_SetUserData(p, xpu);
   if (hasfield(L, StartCdataKey) || hasfield(L, EndCdataKey))
     XML_SetCdataSectionHandler(p, f_StartCdata, f_EndCdataKey);
@@ -384,6 +901,8 @@ static int lxp_make_parser (lua_State *L) {
     XML_SetProcessingInstructionHandler(p, f_ProcessingInstruction);
   if (hasfield(L, UnparsedEntityDeclKey))
     XML_SetUnparsedEntityDeclHandler(p, f_UnparsedEntityDecl);
+  if (hasfield(L, BatchKey))
+    initbatch(L, xpu);
   return 1;
 }
 
@@ -435,10 +954,12 @@ static int parse_aux (lua_State *L, lxp_userdata *xpu, const char *s,
   xpu->b = &b;
   lua_settop(L, 2);
   lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->tableref);  /* to be used by handlers */
+  lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->namesref);  /* at NAMESIDX */
   xpu->busy = 1;
   status = XML_Parse(xpu->parser, s, (int)len, s == NULL);
   xpu->busy = 0;
   if (xpu->state == XPSstring) dischargestring(xpu);
+  if (xpu->nevents > 0) flushbatch(xpu);
   if (xpu->state == XPSerror) {  /* callback error? */
     lua_rawgeti(L, LUA_REGISTRYINDEX, xpu->tableref);  /* get original msg. */
     lua_error(L);
@@ -536,6 +1057,13 @@ static void set_info (lua_State *L) {
 
 
 int luaopen_lxp (lua_State *L) {
+  luaL_newmetatable(L, AttributesType);
+#if LUA_VERSION_NUM > 501
+  luaL_setfuncs(L, attrs_meths, 0);
+#else
+  luaL_openlib(L, NULL, attrs_meths, 0);
+#endif
+  lua_pop(L, 1);
   luaL_newmetatable(L, ParserType);
   lua_pushliteral(L, "__index");
   lua_pushvalue(L, -2);
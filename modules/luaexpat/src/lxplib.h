@@ -3,6 +3,7 @@
 */
 
 #define ParserType	"Expat"
+#define AttributesType	"Expat attributes"
 
 #define StartCdataKey			"StartCdataSection"
 #define EndCdataKey			"EndCdataSection"
@@ -19,5 +20,6 @@
 #define NotStandaloneKey		"NotStandalone"
 #define ProcessingInstructionKey	"ProcessingInstruction"
 #define UnparsedEntityDeclKey		"UnparsedEntityDecl"
+#define BatchKey			"_batch"
 
 int luaopen_lxp (lua_State *L);
@@ -75,6 +75,111 @@ assert(p:parse())
 p:close()
 
 
+-------------------------------
+print("testing attribute modes")
+p = lxp.new{StartElement = getargs, _attributes = "flat"}
+assert(p:parse(preamble))
+assert(p:parse([[<to priority="10" xu = "hi">]]))
+assert(X.n == 8 and X[2] == "to" and X[3] == "priority" and X[4] == "10")
+assert(X[5] == "xu" and X[6] == "hi" and X[7] == "method" and X[8] == "POST")
+assert(p:parse("</to>"))
+p:close()
+
+local view, seen
+p = lxp.new{_attributes = "view", StartElement = function (p, name, attrs)
+  view = attrs
+  seen = {name, #attrs, attrs[1], attrs[2], attrs[3], attrs.xu, attrs.method,
+          attrs.none}
+  if pairs(attrs) ~= next then  -- __pairs is honoured
+    local names = {}
+    for k, v in pairs(attrs) do names[#names + 1] = k .. "=" .. v end
+    seen.all = table.concat(names, " ")
+  end
+end}
+assert(p:parse(preamble))
+assert(p:parse([[<to priority="10" xu = "hi">]]))
+assert(seen[1] == "to" and seen[2] == 2 and seen[3] == "priority")
+assert(seen[4] == "xu" and seen[5] == nil and seen[6] == "hi")
+assert(seen[7] == "POST" and seen[8] == nil)
+assert(seen.all == nil or seen.all == "priority=10 xu=hi method=POST")
+assert(not pcall(function () return view.xu end))
+local first = view
+assert(p:parse([[<hihi explanation="test-unparsed"/>]]))
+assert(view == first and seen[1] == "hihi" and seen[3] == "explanation")
+assert(p:parse("</to>"))
+p:close()
+assert(not pcall(lxp.new, {_attributes = "lazy"}))
+
+-- names are cached per parser, also across many distinct names
+local names = {}
+p = lxp.new{StartElement = function (p, name) names[#names + 1] = name end}
+local doc = {"<r>"}
+for i = 1, 3000 do doc[#doc + 1] = "<e" .. (i % 1500) .. "/>" end
+doc[#doc + 1] = "</r>"
+assert(p:parse(table.concat(doc)))
+assert(p:parse())
+p:close()
+assert(#names == 3001 and names[2] == "e1" and names[3001] == "e0")
+
+
+-------------------------------
+print("testing batched events")
+local events = {}
+local function batch (p, types, names, payloads, n)
+  events.batches = (events.batches or 0) + 1
+  for i = 1, n do
+    events[#events + 1] = {types[i], names[i], payloads[i]}
+  end
+  assert(types[n + 1] == nil and names[n + 1] == nil)
+end
+p = lxp.new{_batch = batch, _batchevents = 4}
+assert(p:parse(preamble))
+assert(p:parse([[<to priority="10"><!-- c -->te]]))
+assert(p:parse([=[xt<![CDATA[<cd>]]><?pi data?></to>]=]))
+assert(p:parse())
+p:close()
+local expect = {
+  {"StartElement", "to"}, {"Comment", nil, " c "},
+  {"CharacterData", nil, "te"}, {"CharacterData", nil, "xt"},
+  {"StartCdataSection"},
+  {"CharacterData", nil, "<cd>"}, {"EndCdataSection"},
+  {"ProcessingInstruction", "pi", "data"}, {"EndElement", "to"},
+}
+assert(#events == #expect)
+for i, e in ipairs(expect) do
+  assert(events[i][1] == e[1] and events[i][2] == e[2])
+  if i > 1 then assert(events[i][3] == e[3]) end
+end
+local attrs = events[1][3]
+assert(attrs.priority == "10" and attrs.method == "POST")
+assert(attrs[1] == "priority" and #attrs == 1)
+-- as with CharacterData, each parse call delivers what it has recorded
+assert(events.batches == 3)
+
+-- other callbacks get the events recorded before them first
+events = {}
+p = lxp.new({_batch = batch,
+              StartNamespaceDecl = function (p, prefix)
+                events[#events + 1] = {"ns", prefix}
+              end}, "?")
+assert(p:parse[[<a><b xmlns:x="u"/></a>]])
+p:close()
+assert(events[1][1] == "StartElement" and events[1][2] == "a")
+assert(events[2][1] == "ns" and events[2][2] == "x")
+assert(events[3][1] == "StartElement" and events[3][2] == "b")
+-- the byte limit flushes after each event here
+events = {batches = 0}
+p = lxp.new{_batch = batch, _batchbytes = 1}
+assert(p:parse[[<a><b/></a>]])
+p:close()
+assert(#events == 4 and events.batches == 4)
+assert(not pcall(lxp.new, {_batch = batch, StartElement = print}))
+assert(not pcall(lxp.new, {_batch = 1}))
+p = lxp.new{_batch = function () error("batch error") end}
+local status, err = pcall(p.parse, p, "<a/>")
+assert(not status and string.find(err, "batch error"))
+
+
 -------------------------------
 print("testing CharacterData/Cdata")
 callbacks = {
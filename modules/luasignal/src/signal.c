@@ -1,59 +1,91 @@
-#include "queue.h"
 #include "signames.h"
 #include <lua.h>
 #include <lauxlib.h>
+#include <errno.h>
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 
 #define REG_TABLE "luasignal"
+#define SIGNALFD_MT "luasignal.signalfd"
 #define VERSION "LuaSignal 0.1"
 
+/* hardcoding 256 here is not great... is there a better way to get the highest
+ * numbered signal? */
+#define MAXSIG 256
+
+/* The C handler only touches these counters and the hook, both of which are
+ * safe from a signal handler; Lua handlers run later, from the hook. */
+#if defined(__GNUC__)
+typedef volatile sig_atomic_t sigcount;
+#define atomic_inc(p)      __sync_fetch_and_add((p), 1)
+#define atomic_swap(p, v)  __sync_lock_test_and_set((p), (v))
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+      !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_int sigcount;
+#define atomic_inc(p)      atomic_fetch_add((p), 1)
+#define atomic_swap(p, v)  atomic_exchange((p), (v))
+#else
+#error "luasignal needs __sync builtins or C11 atomics"
+#endif
+
 static lua_State* gL = NULL;
 static lua_Hook old_hook = NULL;
 static int old_mask = 0;
 static int old_count = 0;
-static queue q;
-/* hardcoding 256 here is not great... is there a better way to get the highest
- * numbered signal? */
-static struct sigaction lua_handlers[256];
+/* deliveries not yet passed on to Lua, per signal */
+static sigcount pending[MAXSIG];
+/* set while the hook is installed */
+static sigcount armed = 0;
+static struct sigaction lua_handlers[MAXSIG];
 
 static void lua_signal_handler(lua_State* L, lua_Debug* D)
 {
-    sigset_t sset, oldset;
     int sig;
 
     lua_sethook(gL, old_hook, old_mask, old_count);
+    /* anything arriving from now on installs the hook again */
+    atomic_swap(&armed, 0);
 
-    sigfillset(&sset);
-    sigprocmask(SIG_BLOCK, &sset, &oldset);
-
-    while ((sig = dequeue(&q)) != -1) {
-        const char* signame;
-
-        signame = sig_to_name(sig);
-        lua_getfield(gL, LUA_REGISTRYINDEX, REG_TABLE);
-        lua_getfield(gL, -1, signame);
-        lua_pushstring(gL, signame);
-        sigprocmask(SIG_SETMASK, &oldset, NULL);
-        lua_call(gL, 1, 0);
-        sigprocmask(SIG_BLOCK, &sset, &oldset);
-    }
+    for (sig = 1; sig < MAXSIG; ++sig) {
+        int n;
 
-    sigprocmask(SIG_SETMASK, &oldset, NULL);
+        if (pending[sig] == 0 || (n = atomic_swap(&pending[sig], 0)) == 0) {
+            continue;
+        }
+        while (n-- > 0) {
+            const char* signame;
+
+            signame = sig_to_name(sig);
+            lua_getfield(gL, LUA_REGISTRYINDEX, REG_TABLE);
+            lua_getfield(gL, -1, signame);
+            lua_remove(gL, -2);
+            if (!lua_isfunction(gL, -1)) {
+                /* the handler was replaced meanwhile; a later delivery may
+                 * find a new one */
+                lua_pop(gL, 1);
+                continue;
+            }
+            lua_pushstring(gL, signame);
+            lua_call(gL, 1, 0);
+        }
+    }
 }
 
 static void signal_handler(int sig)
 {
-    if (q.size == 0) {
+    atomic_inc(&pending[sig]);
+    if (atomic_swap(&armed, 1) == 0) {
         old_hook  = lua_gethook(gL);
         old_mask  = lua_gethookmask(gL);
         old_count = lua_gethookcount(gL);
         lua_sethook(gL, lua_signal_handler,
                     LUA_MASKCALL | LUA_MASKRET | LUA_MASKCOUNT, 1);
     }
-
-    enqueue(&q, sig);
 }
 
 static int l_signal(lua_State* L)
@@ -69,7 +101,7 @@ static int l_signal(lua_State* L)
     luaL_checktype(L, 1, LUA_TSTRING);
     signame = lua_tostring(L, 1);
     sig = name_to_sig(signame);
-    if (sig == -1) {
+    if (sig <= 0 || sig >= MAXSIG) {
         lua_pushfstring(L, "signal() called with invalid signal name: %s", signame);
         lua_error(L);
     }
@@ -134,8 +166,8 @@ static int l_alarm(lua_State* L)
 static int check_signal_name(lua_State *L, int idx) {
     const char* signame;
     int sig;
-    luaL_checktype(L, 2, LUA_TSTRING);
-    signame = lua_tostring(L, 2);
+    luaL_checktype(L, idx, LUA_TSTRING);
+    signame = lua_tostring(L, idx);
     if ((sig = name_to_sig(signame)) == -1) {
         if (strcmp(signame, "test") == 0) {
             sig = 0;
@@ -171,17 +203,149 @@ static int l_raise(lua_State* L)
     return 1;
 }
 
+#ifdef __linux__
+typedef struct {
+    int fd;
+    sigset_t mask;
+    sigset_t unblock;   /* signals of mask that were not blocked before */
+} lsignalfd;
+
+static lsignalfd* check_signalfd(lua_State* L)
+{
+    lsignalfd* s = (lsignalfd*)luaL_checkudata(L, 1, SIGNALFD_MT);
+    luaL_argcheck(L, s->fd != -1, 1, "closed signalfd");
+    return s;
+}
+
+static int l_signalfd(lua_State* L)
+{
+    lsignalfd* s;
+    sigset_t mask, old;
+    int i, top;
+
+    top = lua_gettop(L);
+    sigemptyset(&mask);
+    for (i = 1; i <= top; ++i) {
+        int sig = check_signal_name(L, i);
+        luaL_argcheck(L, sig > 0, i, "invalid signal name");
+        sigaddset(&mask, sig);
+    }
+
+    s = (lsignalfd*)lua_newuserdata(L, sizeof(lsignalfd));
+    s->fd = -1;
+    luaL_getmetatable(L, SIGNALFD_MT);
+    lua_setmetatable(L, -2);
+    if ((s->fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    /* the signals now queue up on the descriptor instead of being delivered */
+    sigprocmask(SIG_BLOCK, &mask, &old);
+    s->mask = mask;
+    sigemptyset(&s->unblock);
+    for (i = 1; i < MAXSIG; ++i) {
+        if (sigismember(&mask, i) == 1 && sigismember(&old, i) == 0) {
+            sigaddset(&s->unblock, i);
+        }
+    }
+
+    return 1;
+}
+
+static int sfd_read(lua_State* L)
+{
+    struct signalfd_siginfo info[16];
+    lsignalfd* s = check_signalfd(L);
+    ssize_t bytes;
+    int i, n = 0;
+
+    lua_newtable(L);
+    do {
+        if ((bytes = read(s->fd, info, sizeof(info))) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                break;
+            }
+            lua_pushnil(L);
+            lua_pushstring(L, strerror(errno));
+            return 2;
+        }
+        for (i = 0; i < bytes / (ssize_t)sizeof(info[0]); ++i) {
+            lua_pushstring(L, sig_to_name(info[i].ssi_signo));
+            lua_rawseti(L, -2, ++n);
+        }
+    } while (bytes == -1 || bytes == sizeof(info));
+
+    return 1;
+}
+
+static int sfd_getfd(lua_State* L)
+{
+    lua_pushinteger(L, check_signalfd(L)->fd);
+
+    return 1;
+}
+
+static int sfd_dirty(lua_State* L)
+{
+    check_signalfd(L);
+    lua_pushboolean(L, 0);
+
+    return 1;
+}
+
+static int sfd_close(lua_State* L)
+{
+    lsignalfd* s = (lsignalfd*)luaL_checkudata(L, 1, SIGNALFD_MT);
+
+    if (s->fd != -1) {
+        close(s->fd);
+        s->fd = -1;
+        /* leave blocked what the caller had blocked already */
+        sigprocmask(SIG_UNBLOCK, &s->unblock, NULL);
+    }
+
+    return 0;
+}
+
+static const luaL_Reg sfd_methods[] = {
+    { "read",    sfd_read  },
+    { "getfd",   sfd_getfd },
+    { "dirty",   sfd_dirty },
+    { "close",   sfd_close },
+    {  NULL,     NULL      },
+};
+#endif
+
 const luaL_Reg reg[] = {
     { "signal",  l_signal  },
     { "alarm",   l_alarm   },
     { "kill",    l_kill    },
     { "raise",   l_raise   },
+#ifdef __linux__
+    { "signalfd", l_signalfd },
+#endif
     {  NULL,     NULL      },
 };
 
 int luaopen_signal(lua_State* L)
 {
-    queue_init(&q, 4);
+#ifdef __linux__
+    luaL_newmetatable(L, SIGNALFD_MT);
+    lua_newtable(L);
+#if LUA_VERSION_NUM > 501
+    luaL_setfuncs(L, sfd_methods, 0);
+#else
+    luaL_register(L, NULL, sfd_methods);
+#endif
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, sfd_close);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+#endif
 
     lua_newtable(L);
     lua_setfield(L, LUA_REGISTRYINDEX, REG_TABLE);
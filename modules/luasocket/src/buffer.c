@@ -2,6 +2,8 @@
 * Input/Output interface for Lua programs
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <string.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 
@@ -161,6 +163,29 @@ int buffer_isempty(p_buffer buf) {
     return buf->first >= buf->last;
 }
 
+/*-------------------------------------------------------------------------*\
+* Sends a whole block of data, for C callers
+\*-------------------------------------------------------------------------*/
+int buffer_send(p_buffer buf, const char *data, size_t count, size_t *sent) {
+    return sendraw(buf, data, count, sent);
+}
+
+/*-------------------------------------------------------------------------*\
+* Copies at most 'wanted' bytes into data, for C callers. Only goes to the
+* transport layer if nothing is buffered, so it returns as soon as any
+* data is available.
+\*-------------------------------------------------------------------------*/
+int buffer_recvsome(p_buffer buf, char *data, size_t wanted, size_t *got) {
+    const char *avail;
+    size_t count;
+    int err = buffer_get(buf, &avail, &count);
+    count = MIN(count, wanted);
+    memcpy(data, avail, count);
+    buffer_skip(buf, count);
+    *got = count;
+    return count > 0? IO_DONE: err;
+}
+
 /*=========================================================================*\
 * Internal functions
 \*=========================================================================*/
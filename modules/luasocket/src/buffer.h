@@ -41,5 +41,7 @@ int buffer_meth_receive(lua_State *L, p_buffer buf);
 int buffer_meth_getstats(lua_State *L, p_buffer buf);
 int buffer_meth_setstats(lua_State *L, p_buffer buf);
 int buffer_isempty(p_buffer buf);
+int buffer_send(p_buffer buf, const char *data, size_t count, size_t *sent);
+int buffer_recvsome(p_buffer buf, char *data, size_t wanted, size_t *got);
 
 #endif /* BUF_H */
@@ -26,6 +26,12 @@ TIMEOUT = 60
 PORT = 80
 -- user agent field sent in request
 USERAGENT = socket._VERSION
+-- keep connections open between requests to the same server
+KEEPALIVE = false
+-- maximum number of idle connections kept open
+POOLSIZE = 16
+-- seconds an idle connection is kept open
+IDLETIMEOUT = 30
 
 -----------------------------------------------------------------------------
 -- Reads MIME headers from a connection, unfolding where needed
@@ -143,7 +149,10 @@ function metat.__index:sendbody(headers, source, step)
 end
 
 function metat.__index:receivestatusline()
-    local status = self.try(self.c:receive(5))
+    local status, err, partial = self.c:receive(5)
+    -- remember whether the server said anything at all
+    self.replied = status ~= nil or partial ~= ""
+    self.try(status, err)
     -- identify HTTP/0.9 responses, which do not contain a status line
     -- this is just a heuristic, but is what the RFC recommends
     if status ~= "HTTP/" then return nil, status end
@@ -165,7 +174,10 @@ function metat.__index:receivebody(headers, sink, step)
     local mode = "default" -- connection close
     if t and t ~= "identity" then mode = "http-chunked"
     elseif base.tonumber(headers["content-length"]) then mode = "by-length" end
-    return self.try(ltn12.pump.all(socket.source(mode, self.c, length),
+    -- chunked sources read the trailers into the reply headers
+    local extra = length
+    if mode == "http-chunked" then extra = headers end
+    return self.try(ltn12.pump.all(socket.source(mode, self.c, extra),
         sink, step))
 end
 
@@ -179,6 +191,104 @@ function metat.__index:close()
     return self.c:close()
 end
 
+-----------------------------------------------------------------------------
+-- Keep-alive connection pool
+-----------------------------------------------------------------------------
+-- idle connections by "scheme://host:port", most recently used last
+local pool = {}
+local nidle = 0
+
+local function poolkey(reqt)
+    return string.format("%s://%s:%s", reqt.scheme or "http", reqt.host,
+        base.tostring(reqt.port or PORT))
+end
+
+local function discard(list, i)
+    local h = table.remove(list, i)
+    nidle = nidle - 1
+    h:close()
+end
+
+-- closes connections that have been idle for too long
+local function expire(now)
+    for key, list in base.pairs(pool) do
+        for i = #list, 1, -1 do
+            if list[i].expires <= now then discard(list, i) end
+        end
+        if not list[1] then pool[key] = nil end
+    end
+end
+
+-- takes an idle connection to the server out of the pool, if any
+local function acquire(key)
+    expire(socket.timer.now())
+    local list = pool[key]
+    while list and list[1] do
+        local h = table.remove(list)
+        nidle = nidle - 1
+        if not list[1] then pool[key] = nil end
+        -- anything readable on an idle connection means the server
+        -- closed it or sent something we did not ask for
+        local r = socket.select({h.c}, nil, 0)
+        if not r[1] and not h.c:dirty() then return h end
+        h:close()
+    end
+end
+
+-- puts a connection back in the pool, evicting the least recently used
+-- idle connection if the pool is full
+local function release(key, h, headers)
+    if POOLSIZE <= 0 then return h:close() end
+    while nidle >= POOLSIZE do
+        local oldest
+        for k, list in base.pairs(pool) do
+            if not oldest or list[1].used < pool[oldest][1].used then
+                oldest = k
+            end
+        end
+        discard(pool[oldest], 1)
+        if not pool[oldest][1] then pool[oldest] = nil end
+    end
+    -- the server may tell us how long it keeps idle connections
+    local idle = IDLETIMEOUT
+    local hint = socket.skip(2,
+        string.find(headers["keep-alive"] or "", "timeout%s*=%s*(%d+)"))
+    if hint and base.tonumber(hint) < idle then idle = base.tonumber(hint) end
+    h.used = socket.timer.now()
+    h.expires = h.used + idle
+    local list = pool[key] or {}
+    pool[key] = list
+    list[#list+1] = h
+    nidle = nidle + 1
+end
+
+-- closes all idle connections
+function closeidle()
+    for key, list in base.pairs(pool) do
+        for i = #list, 1, -1 do discard(list, i) end
+        pool[key] = nil
+    end
+end
+
+-- can the connection carry another request after this reply?
+local function persistent(reqt, status, headers, body)
+    local req = string.lower(reqt.headers["connection"] or "")
+    local rep = string.lower(headers["connection"] or "")
+    if string.find(req, "close") or string.find(rep, "close") then
+        return false
+    end
+    -- HTTP/1.0 servers close unless they say otherwise
+    if string.find(status, "^HTTP/1%.0") and
+        not string.find(rep, "keep%-alive") then return false end
+    -- a body that runs until the connection closes can't be followed
+    if body then
+        local t = headers["transfer-encoding"]
+        return (t and t ~= "identity") or
+            base.tonumber(headers["content-length"]) ~= nil
+    end
+    return true
+end
+
 -----------------------------------------------------------------------------
 -- High level HTTP API
 -----------------------------------------------------------------------------
@@ -211,7 +321,7 @@ local function adjustheaders(reqt)
     local lower = {
         ["user-agent"] = USERAGENT,
         ["host"] = reqt.host,
-        ["connection"] = "close, TE",
+        ["connection"] = reqt.keepalive and "keep-alive, TE" or "close, TE",
         ["te"] = "trailers"
     }
     -- if we have authentication information, pass it along
@@ -240,6 +350,7 @@ local function adjustrequest(reqt)
     -- explicit components override url
     for i,v in base.pairs(reqt) do nreqt[i] = v end
     if nreqt.port == "" then nreqt.port = 80 end
+    if nreqt.keepalive == nil then nreqt.keepalive = KEEPALIVE end
     socket.try(nreqt.host and nreqt.host ~= "", 
         "invalid host '" .. base.tostring(nreqt.host) .. "'")
     -- compute uri if user hasn't overriden
@@ -280,7 +391,8 @@ function tredirect(reqt, location)
         headers = reqt.headers,
         proxy = reqt.proxy, 
         nredirects = (reqt.nredirects or 0) + 1,
-        create = reqt.create
+        create = reqt.create,
+        keepalive = reqt.keepalive
     }   
     -- pass location header back as a hint we redirected
     headers = headers or {}
@@ -288,22 +400,57 @@ function tredirect(reqt, location)
     return result, code, headers, status
 end
 
-function trequest(reqt)
-    -- we loop until we get what we want, or
-    -- until we are sure there is no way to get it
-    local nreqt = adjustrequest(reqt)
-    local h = open(nreqt.host, nreqt.port, nreqt.create)
-    -- send request line and headers
+-- methods that can safely be sent twice (RFC 7230 section 6.3.1)
+local idempotent = {
+    GET = true, HEAD = true, OPTIONS = true, TRACE = true,
+    PUT = true, DELETE = true
+}
+
+-- a request on a reused connection is sent again only if the server
+-- closed that connection before any byte of the reply came back, which
+-- is what happens when it drops an idle connection
+local function shouldretry(h, nreqt, err)
+    return base.type(err) == "table" and err[1] == "closed" and
+        not h.replied and not nreqt.source and
+        idempotent[nreqt.method or "GET"]
+end
+
+-- sends the request and reads the status line of the reply
+local function sendrequest(h, nreqt)
+    h.replied = nil
     h:sendrequestline(nreqt.method, nreqt.uri)
     h:sendheaders(nreqt.headers)
     -- if there is a body, send it
     if nreqt.source then
         h:sendbody(nreqt.headers, nreqt.source, nreqt.step) 
     end
-    local code, status = h:receivestatusline()
+    return h:receivestatusline()
+end
+
+function trequest(reqt)
+    -- we loop until we get what we want, or
+    -- until we are sure there is no way to get it
+    local nreqt = adjustrequest(reqt)
+    local key = nreqt.keepalive and poolkey(nreqt)
+    local h = key and acquire(key)
+    local code, status, ok
+    if h then
+        -- the server may have dropped the idle connection just now. if so,
+        -- try again on a new one when that is safe
+        ok, code, status = base.pcall(sendrequest, h, nreqt)
+        if not ok then
+            if not shouldretry(h, nreqt, code) then base.error(code, 0) end
+            h = nil
+        end
+    end
+    if not h then
+        h = open(nreqt.host, nreqt.port, nreqt.create)
+        code, status = sendrequest(h, nreqt)
+    end
     -- if it is an HTTP/0.9 server, simply get the body and we are done
     if not code then
         h:receive09body(status, nreqt.sink, nreqt.step)
+        h:close()
         return 1, 200
     end
     local headers
@@ -320,10 +467,13 @@ function trequest(reqt)
         return tredirect(reqt, headers.location)
     end
     -- here we are finally done
-    if shouldreceivebody(nreqt, code) then
+    local body = shouldreceivebody(nreqt, code)
+    if body then
         h:receivebody(headers, nreqt.sink, nreqt.step)
     end
-    h:close()
+    if key and persistent(nreqt, status, headers, body) then
+        release(key, h, headers)
+    else h:close() end
     return 1, code, headers, status
 end
 
@@ -3,6 +3,7 @@
 * LuaSocket toolkit
 \*=========================================================================*/
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifndef _WIN32
@@ -30,6 +31,33 @@ const char *inet_ntop(int af, const void *src, char *dst, socklen_t cnt);
 int inet_pton(int af, const char *src, void *dst);
 #endif
 
+/* one cached resolver answer */
+typedef struct t_dnsentry_ {
+    char *key;              /* what was asked, NULL if the slot is free */
+    struct addrinfo *ai;    /* private copy of a getaddrinfo answer */
+    struct hostent *hp;     /* private copy of a gethostby* answer */
+    int err;                /* resolver error, for negative entries */
+    double expires;         /* when the entry stops being valid */
+    double used;            /* last hit, to find the least recently used */
+    unsigned int hash;      /* hash of key */
+    int next;               /* next entry in the same bucket, or -1 */
+} t_dnsentry;
+typedef t_dnsentry *p_dnsentry;
+
+/* the cache of a Lua state, kept in the registry */
+typedef struct t_dnscache_ {
+    p_dnsentry entry;
+    int *bucket;            /* first entry of each hash chain, or -1 */
+    int size;
+    double ttl, negttl;
+    double hits, misses;
+    struct addrinfo *scratch; /* last answer that was not cached */
+} t_dnscache;
+typedef t_dnscache *p_dnscache;
+
+/* longest node and service names we cache */
+#define INET_DNSKEYLEN (NI_MAXHOST + NI_MAXSERV + 64)
+
 
 /*=========================================================================*\
 * Internal function prototypes.
@@ -41,6 +69,20 @@ static int inet_global_getnameinfo(lua_State *L);
 static int inet_global_local_addresses(lua_State *L);
 static void inet_pushresolved(lua_State *L, struct hostent *hp);
 static int inet_global_gethostname(lua_State *L);
+static int inet_global_setcache(lua_State *L);
+static int inet_global_flushcache(lua_State *L);
+static int inet_global_getcachestats(lua_State *L);
+static int cache_gc(lua_State *L);
+static p_dnscache cache_get(lua_State *L);
+static int cache_resize(p_dnscache c, int size);
+static p_dnsentry cache_lookup(p_dnscache c, const char *key);
+static p_dnsentry cache_store(p_dnscache c, const char *key, int err);
+static void cache_setport(struct addrinfo *ai, int port);
+static struct addrinfo *copyaddrinfo(const struct addrinfo *ai);
+static struct hostent *copyhost(const struct hostent *hp);
+
+/* registry key of the resolver cache */
+static char cachekey;
 
 /* DNS functions */
 static luaL_Reg dns[] = {
@@ -49,6 +91,9 @@ static luaL_Reg dns[] = {
     { "tohostname", inet_global_tohostname},
     { "getnameinfo", inet_global_getnameinfo},
     { "gethostname", inet_global_gethostname},
+    { "setcache", inet_global_setcache},
+    { "flushcache", inet_global_flushcache},
+    { "getcachestats", inet_global_getcachestats},
     { NULL, NULL}
 };
 
@@ -66,6 +111,17 @@ static luaL_Reg func[] = {
 \*-------------------------------------------------------------------------*/
 int inet_open(lua_State *L)
 {
+    p_dnscache c = (p_dnscache) lua_newuserdata(L, sizeof(t_dnscache));
+    memset(c, 0, sizeof(t_dnscache));
+    c->ttl = INET_DNSCACHE_TTL;
+    c->negttl = INET_DNSCACHE_NEGTTL;
+    cache_resize(c, INET_DNSCACHE_SIZE);
+    lua_newtable(L);
+    lua_pushcfunction(L, cache_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &cachekey);
+
     lua_pushstring(L, "dns");
     lua_newtable(L);
     luaL_setfuncs(L,dns,0);
@@ -84,12 +140,37 @@ int inet_open(lua_State *L)
 * Returns all information provided by the resolver given a host name
 * or ip address
 \*-------------------------------------------------------------------------*/
-static int inet_gethost(const char *address, struct hostent **hp) {
+static int inet_gethost(lua_State *L, const char *address,
+        struct hostent **hp) {
     struct in_addr addr;
+    p_dnscache c = cache_get(L);
+    char key[INET_DNSKEYLEN];
+    p_dnsentry e;
+    int err, cached;
+    /* numeric addresses are not cached */
     if (inet_aton(address, &addr))
         return socket_gethostbyaddr((char *) &addr, sizeof(addr), hp);
-    else
-        return socket_gethostbyname(address, hp);
+    cached = c->size > 0 && strlen(address) < sizeof(key) - 1;
+    if (cached) {
+        key[0] = 'h';
+        strcpy(key + 1, address);
+        e = cache_lookup(c, key);
+        if (e) {
+            *hp = e->hp;
+            return e->err;
+        }
+    }
+    err = socket_gethostbyname(address, hp);
+    /* only resolver answers are kept. socket_gethostbyname returns errno
+     * values for local trouble, and those overlap the h_errno codes */
+    if (cached && (err == IO_DONE || (err == h_errno &&
+            (err == HOST_NOT_FOUND || err == NO_DATA || err == TRY_AGAIN)))) {
+        struct hostent *copy = err == IO_DONE? copyhost(*hp): NULL;
+        if ((err != IO_DONE || copy) && (e = cache_store(c, key, err)))
+            e->hp = copy;
+        else free(copy);
+    }
+    return err;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -99,7 +180,7 @@ static int inet_gethost(const char *address, struct hostent **hp) {
 static int inet_global_tohostname(lua_State *L) {
     const char *address = luaL_checkstring(L, 1);
     struct hostent *hp = NULL;
-    int err = inet_gethost(address, &hp);
+    int err = inet_gethost(L, address, &hp);
     if (err != IO_DONE) {
         lua_pushnil(L);
         lua_pushstring(L, socket_hoststrerror(err));
@@ -164,7 +245,7 @@ static int inet_global_toip(lua_State *L)
 {
     const char *address = luaL_checkstring(L, 1);
     struct hostent *hp = NULL;
-    int err = inet_gethost(address, &hp);
+    int err = inet_gethost(L, address, &hp);
     if (err != IO_DONE) {
         lua_pushnil(L);
         lua_pushstring(L, socket_hoststrerror(err));
@@ -200,7 +281,7 @@ static int inet_global_getaddrinfo(lua_State *L)
     memset(&hints, 0, sizeof(hints));
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_family = PF_UNSPEC;
-    ret = getaddrinfo(hostname, NULL, &hints, &resolved);
+    ret = inet_getaddrinfo(L, hostname, NULL, &hints, &resolved);
     if (ret != 0) {
         lua_pushnil(L);
         lua_pushstring(L, socket_gaistrerror(ret));
@@ -231,7 +312,6 @@ static int inet_global_getaddrinfo(lua_State *L)
         lua_settable(L, -3);
         i++;
     }
-    freeaddrinfo(resolved);
     return 1;
 }
 
@@ -253,6 +333,54 @@ static int inet_global_gethostname(lua_State *L)
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Configures the resolver cache: number of entries (0 turns it off),
+* seconds answers are kept, seconds failures are kept
+\*-------------------------------------------------------------------------*/
+static int inet_global_setcache(lua_State *L)
+{
+    p_dnscache c = cache_get(L);
+    int size = (int) luaL_checknumber(L, 1);
+    double ttl = luaL_optnumber(L, 2, c->ttl);
+    double negttl = luaL_optnumber(L, 3, c->negttl);
+    luaL_argcheck(L, size >= 0, 1, "invalid cache size");
+    c->ttl = ttl;
+    c->negttl = negttl;
+    if (!cache_resize(c, size)) {
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Forgets everything in the resolver cache
+\*-------------------------------------------------------------------------*/
+static int inet_global_flushcache(lua_State *L)
+{
+    p_dnscache c = cache_get(L);
+    cache_resize(c, c->size);
+    lua_pushnumber(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns cache hits, misses and the number of entries in use
+\*-------------------------------------------------------------------------*/
+static int inet_global_getcachestats(lua_State *L)
+{
+    p_dnscache c = cache_get(L);
+    int i, n = 0;
+    for (i = 0; i < c->size; i++)
+        if (c->entry[i].key) n++;
+    lua_pushnumber(L, c->hits);
+    lua_pushnumber(L, c->misses);
+    lua_pushnumber(L, n);
+    return 3;
+}
+
 /*-------------------------------------------------------------------------*\
 * Enumerate all locally configured IP addresses
 \*-------------------------------------------------------------------------*/
@@ -466,6 +594,282 @@ static void inet_pushresolved(lua_State *L, struct hostent *hp)
     lua_settable(L, resolved);
 }
 
+/*-------------------------------------------------------------------------*\
+* Resolver cache
+\*-------------------------------------------------------------------------*/
+static p_dnscache cache_get(lua_State *L)
+{
+    p_dnscache c;
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &cachekey);
+    c = (p_dnscache) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return c;
+}
+
+static void freeaddrinfocopy(struct addrinfo *ai)
+{
+    while (ai) {
+        struct addrinfo *next = ai->ai_next;
+        free(ai);
+        ai = next;
+    }
+}
+
+static unsigned int cache_hash(const char *key)
+{
+    unsigned int h = 2166136261u;
+    while (*key) h = (h ^ (unsigned char) *key++) * 16777619u;
+    return h;
+}
+
+/* frees an entry and takes it off its hash chain */
+static void cache_clear(p_dnscache c, p_dnsentry e)
+{
+    if (e->key) {
+        int *p = &c->bucket[e->hash % (unsigned int) c->size];
+        int i = (int) (e - c->entry);
+        while (*p != i) p = &c->entry[*p].next;
+        *p = e->next;
+    }
+    free(e->key);
+    freeaddrinfocopy(e->ai);
+    free(e->hp);
+    memset(e, 0, sizeof(t_dnsentry));
+    e->next = -1;
+}
+
+/* drops every entry and makes room for size new ones */
+static int cache_resize(p_dnscache c, int size)
+{
+    int i;
+    for (i = 0; i < c->size; i++) cache_clear(c, &c->entry[i]);
+    if (size != c->size) {
+        free(c->entry);
+        free(c->bucket);
+        c->entry = NULL;
+        c->bucket = NULL;
+        if (size > 0) {
+            c->entry = (p_dnsentry) calloc((size_t) size, sizeof(t_dnsentry));
+            c->bucket = (int *) malloc((size_t) size*sizeof(int));
+            if (!c->entry || !c->bucket) {
+                free(c->entry);
+                free(c->bucket);
+                c->entry = NULL;
+                c->bucket = NULL;
+            }
+        }
+        c->size = c->entry? size: 0;
+    }
+    for (i = 0; i < c->size; i++) {
+        c->entry[i].next = -1;
+        c->bucket[i] = -1;
+    }
+    return c->size == size;
+}
+
+static int cache_gc(lua_State *L)
+{
+    p_dnscache c = (p_dnscache) lua_touserdata(L, 1);
+    cache_resize(c, 0);
+    if (c->scratch) freeaddrinfo(c->scratch);
+    c->scratch = NULL;
+    return 0;
+}
+
+/* finds a live entry for key, counting the hit or the miss */
+static p_dnsentry cache_lookup(p_dnscache c, const char *key)
+{
+    double now = timeout_gettime();
+    unsigned int h = cache_hash(key);
+    int i;
+    for (i = c->bucket[h % (unsigned int) c->size]; i >= 0;
+            i = c->entry[i].next) {
+        p_dnsentry e = &c->entry[i];
+        if (e->hash == h && strcmp(e->key, key) == 0) {
+            if (e->expires > now) {
+                e->used = now;
+                c->hits++;
+                return e;
+            }
+            cache_clear(c, e);
+            break;
+        }
+    }
+    c->misses++;
+    return NULL;
+}
+
+/* takes a free or expired slot, or else the least recently used one.
+ * The scan is linear, but it only runs after a real resolver query */
+static p_dnsentry cache_store(p_dnscache c, const char *key, int err)
+{
+    double now = timeout_gettime();
+    p_dnsentry e = NULL;
+    char *copy;
+    int i, *b;
+    for (i = 0; i < c->size; i++) {
+        p_dnsentry t = &c->entry[i];
+        if (!t->key || t->expires <= now) {
+            e = t;
+            break;
+        }
+        if (!e || t->used < e->used) e = t;
+    }
+    if (!e || !(copy = (char *) malloc(strlen(key) + 1))) return NULL;
+    cache_clear(c, e);
+    e->key = strcpy(copy, key);
+    e->hash = cache_hash(key);
+    b = &c->bucket[e->hash % (unsigned int) c->size];
+    e->next = *b;
+    *b = (int) (e - c->entry);
+    e->err = err;
+    e->used = now;
+    e->expires = now + (err? c->negttl: c->ttl);
+    return e;
+}
+
+static struct addrinfo *copyaddrinfo(const struct addrinfo *ai)
+{
+    struct addrinfo *head = NULL, **tail = &head;
+    for ( ; ai; ai = ai->ai_next) {
+        size_t canon = ai->ai_canonname? strlen(ai->ai_canonname) + 1: 0;
+        struct addrinfo *c = (struct addrinfo *) malloc(sizeof(struct addrinfo)
+            + ai->ai_addrlen + canon);
+        if (!c) {
+            freeaddrinfocopy(head);
+            return NULL;
+        }
+        *c = *ai;
+        c->ai_addr = (struct sockaddr *) (c + 1);
+        memcpy(c->ai_addr, ai->ai_addr, ai->ai_addrlen);
+        if (canon) {
+            c->ai_canonname = (char *) c->ai_addr + ai->ai_addrlen;
+            memcpy(c->ai_canonname, ai->ai_canonname, canon);
+        }
+        c->ai_next = NULL;
+        *tail = c;
+        tail = &c->ai_next;
+    }
+    return head;
+}
+
+/* copies a hostent into a single block that can be freed at once */
+static struct hostent *copyhost(const struct hostent *hp)
+{
+    size_t size = sizeof(struct hostent) + strlen(hp->h_name) + 1;
+    size_t nalias = 0, naddr = 0, i;
+    struct hostent *c;
+    char *p;
+    if (hp->h_aliases)
+        for ( ; hp->h_aliases[nalias]; nalias++)
+            size += strlen(hp->h_aliases[nalias]) + 1;
+    if (hp->h_addr_list)
+        for ( ; hp->h_addr_list[naddr]; naddr++)
+            size += (size_t) hp->h_length;
+    size += (nalias + naddr + 2)*sizeof(char *);
+    c = (struct hostent *) malloc(size);
+    if (!c) return NULL;
+    *c = *hp;
+    c->h_aliases = (char **) (c + 1);
+    c->h_addr_list = c->h_aliases + nalias + 1;
+    /* addresses go first, so they stay aligned */
+    p = (char *) (c->h_addr_list + naddr + 1);
+    for (i = 0; i < naddr; i++) {
+        c->h_addr_list[i] = p;
+        memcpy(p, hp->h_addr_list[i], (size_t) hp->h_length);
+        p += hp->h_length;
+    }
+    c->h_addr_list[naddr] = NULL;
+    for (i = 0; i < nalias; i++) {
+        c->h_aliases[i] = strcpy(p, hp->h_aliases[i]);
+        p += strlen(p) + 1;
+    }
+    c->h_aliases[nalias] = NULL;
+    c->h_name = strcpy(p, hp->h_name);
+    return c;
+}
+
+static int isnumeric(const char *node)
+{
+    struct in6_addr addr;
+    return inet_pton(AF_INET, node, &addr) == 1 ||
+        inet_pton(AF_INET6, node, &addr) == 1;
+}
+
+/* returns the port a numeric service names, or -1 */
+static int numericport(const char *serv)
+{
+    int port = 0;
+    if (!*serv) return -1;
+    for ( ; *serv; serv++) {
+        if (*serv < '0' || *serv > '9') return -1;
+        port = port*10 + (*serv - '0');
+        if (port > 65535) return -1;
+    }
+    return port;
+}
+
+/* stores port in every address of an answer */
+static void cache_setport(struct addrinfo *ai, int port)
+{
+    for ( ; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET)
+            ((struct sockaddr_in *) ai->ai_addr)->sin_port =
+                htons((unsigned short) port);
+        else if (ai->ai_family == AF_INET6)
+            ((struct sockaddr_in6 *) ai->ai_addr)->sin6_port =
+                htons((unsigned short) port);
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* getaddrinfo through the resolver cache. The answer belongs to the cache
+* and is only good until the next call, so callers must not free it.
+* Numeric services share one entry per node, with the port patched in
+\*-------------------------------------------------------------------------*/
+int inet_getaddrinfo(lua_State *L, const char *node, const char *serv,
+        struct addrinfo *hints, struct addrinfo **res)
+{
+    p_dnscache c = cache_get(L);
+    char key[INET_DNSKEYLEN];
+    p_dnsentry e;
+    int port = serv? numericport(serv): -1;
+    int err, cached = c->size > 0 && node && !isnumeric(node) &&
+        strlen(node) + (serv? strlen(serv): 0) < sizeof(key) - 64;
+    if (c->scratch) freeaddrinfo(c->scratch);
+    c->scratch = *res = NULL;
+    if (cached) {
+        if (port >= 0)
+            sprintf(key, "a%d %d %d %d # %s", hints->ai_family,
+                hints->ai_socktype, hints->ai_protocol, hints->ai_flags, node);
+        else
+            sprintf(key, "a%d %d %d %d %c%s %s", hints->ai_family,
+                hints->ai_socktype, hints->ai_protocol, hints->ai_flags,
+                serv? '+': '-', serv? serv: "", node);
+        e = cache_lookup(c, key);
+        if (e) {
+            if (port >= 0) cache_setport(e->ai, port);
+            *res = e->ai;
+            return e->err;
+        }
+    }
+    err = getaddrinfo(node, serv, hints, res);
+    if (err != 0) *res = NULL;
+    c->scratch = *res;
+    /* only keep answers, not local trouble */
+    if (cached && (err == 0 || err == EAI_NONAME || err == EAI_AGAIN ||
+#ifdef EAI_NODATA
+            err == EAI_NODATA ||
+#endif
+            err == EAI_FAIL)) {
+        struct addrinfo *copy = err == 0? copyaddrinfo(*res): NULL;
+        if ((err != 0 || copy) && (e = cache_store(c, key, err)))
+            e->ai = copy;
+        else freeaddrinfocopy(copy);
+    }
+    return err;
+}
+
 /*-------------------------------------------------------------------------*\
 * Tries to create a new inet socket
 \*-------------------------------------------------------------------------*/
@@ -504,18 +908,15 @@ fprintf(stderr, "disconnecting\n");
 /*-------------------------------------------------------------------------*\
 * Tries to connect to remote address (address, port)
 \*-------------------------------------------------------------------------*/
-const char *inet_tryconnect(p_socket ps, const char *address,
+const char *inet_tryconnect(lua_State *L, p_socket ps, const char *address,
         const char *serv, p_timeout tm, struct addrinfo *connecthints)
 {
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(address, serv,
+    err = socket_gaistrerror(inet_getaddrinfo(L, address, serv,
                 connecthints, &resolved));
-    if (err != NULL) {
-        if (resolved) freeaddrinfo(resolved);
-        return err;
-    }
+    if (err != NULL) return err;
     for (iterator = resolved; iterator; iterator = iterator->ai_next) {
         timeout_markstart(tm);
         /* try connecting to remote address */
@@ -524,7 +925,6 @@ const char *inet_tryconnect(p_socket ps, const char *address,
         /* if success, break out of loop */
         if (err == NULL) break;
     }
-    freeaddrinfo(resolved);
     /* here, if err is set, we failed */
     return err;
 }
@@ -547,18 +947,16 @@ const char *inet_tryaccept(p_socket server, int family, p_socket client, p_timeo
 /*-------------------------------------------------------------------------*\
 * Tries to bind socket to (address, port)
 \*-------------------------------------------------------------------------*/
-const char *inet_trybind(p_socket ps, const char *address, const char *serv,
-        struct addrinfo *bindhints)
+const char *inet_trybind(lua_State *L, p_socket ps, const char *address,
+        const char *serv, struct addrinfo *bindhints)
 {
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
     t_socket sock = *ps;
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(address, serv, bindhints, &resolved));
-    if (err) {
-        if (resolved) freeaddrinfo(resolved);
-        return err;
-    }
+    err = socket_gaistrerror(inet_getaddrinfo(L, address, serv, bindhints,
+                &resolved));
+    if (err) return err;
     /* iterate over resolved addresses until one is good */
     for (iterator = resolved; iterator; iterator = iterator->ai_next) {
         if(sock == SOCKET_INVALID) {
@@ -582,8 +980,7 @@ const char *inet_trybind(p_socket ps, const char *address, const char *serv,
             break;
         }
     }
-    /* cleanup and return error */
-    freeaddrinfo(resolved);
+    /* return error */
     *ps = sock;
     return err;
 }
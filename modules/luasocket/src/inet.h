@@ -13,6 +13,11 @@
 * getpeername and getsockname functions as seen by Lua programs.
 *
 * The Lua functions toip and tohostname are also implemented here.
+*
+* Answers from the resolver are kept in a small per-state cache, so that
+* repeated lookups of the same name do not pay resolver latency each time.
+* Failures are cached too, for a shorter time. Numeric addresses never
+* reach the cache.
 \*=========================================================================*/
 #include "lua.h"
 #include "socket.h"
@@ -22,13 +27,22 @@
 #define INET_ATON
 #endif
 
+/* resolver cache defaults: number of entries, seconds answers and
+ * failures are kept */
+#define INET_DNSCACHE_SIZE 256
+#define INET_DNSCACHE_TTL 30
+#define INET_DNSCACHE_NEGTTL 5
+
 int inet_open(lua_State *L);
 
+int inet_getaddrinfo(lua_State *L, const char *node, const char *serv,
+        struct addrinfo *hints, struct addrinfo **res);
+
 const char *inet_trycreate(p_socket ps, int family, int type);
-const char *inet_tryconnect(p_socket ps, const char *address,
+const char *inet_tryconnect(lua_State *L, p_socket ps, const char *address,
         const char *serv, p_timeout tm, struct addrinfo *connecthints);
-const char *inet_trybind(p_socket ps, const char *address, const char *serv,
-        struct addrinfo *bindhints);
+const char *inet_trybind(lua_State *L, p_socket ps, const char *address,
+        const char *serv, struct addrinfo *bindhints);
 const char *inet_trydisconnect(p_socket ps, int family, p_timeout tm);
 const char *inet_tryaccept(p_socket server, int family, p_socket client, p_timeout tm);
 
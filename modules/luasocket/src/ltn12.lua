@@ -10,6 +10,9 @@
 local string = require("string")
 local table = require("table")
 local base = _G
+-- the native pump lives in socket.core, but ltn12 works without it
+local ok, core = base.pcall(require, "socket.core")
+local pumpall = ok and core.pumpall
 module("ltn12")
 
 filter = {}
@@ -17,6 +20,10 @@ source = {}
 sink = {}
 pump = {}
 
+-- sources, sinks and filters that the native pump can drive describe
+-- themselves here; any state they keep lives in the description
+native = base.setmetatable({}, {__mode = "k"})
+
 -- 2048 seems to be better in windows...
 BLOCKSIZE = 2048
 _VERSION = "LTN12 1.0.2"
@@ -27,11 +34,14 @@ _VERSION = "LTN12 1.0.2"
 -- returns a high level filter that cycles a low-level filter
 function filter.cycle(low, ctx, extra)
     base.assert(low)
-    return function(chunk)
+    local state = {kind = "cycle", low = low, ctx = ctx, extra = extra}
+    local f = function(chunk)
         local ret
-        ret, ctx = low(ctx, chunk, extra)
+        ret, state.ctx = low(state.ctx, chunk, extra)
         return ret
     end
+    native[f] = state
+    return f
 end
 
 -- chains a bunch of filters together
@@ -88,11 +98,13 @@ end
 -- creates a file source
 function source.file(handle, io_err)
     if handle then
-        return function()
+        local f = function()
             local chunk = handle:read(BLOCKSIZE)
             if not chunk then handle:close() end
             return chunk
         end
+        native[f] = {kind = "file", handle = handle}
+        return f
     else return source.error(io_err or "unable to open file") end
 end
 
@@ -140,7 +152,10 @@ function source.chain(src, f)
     local last_in, last_out = "", ""
     local state = "feeding"
     local err
-    return function()
+    local chain
+    chain = function()
+        -- once we hold state of our own, the native pump can't take over
+        native[chain] = nil
         if not last_out then
             base.error('source is empty!', 2)
         end
@@ -180,6 +195,8 @@ function source.chain(src, f)
             end
         end
     end
+    native[chain] = {kind = "chain", src = src, filter = f}
+    return chain
 end
 
 -- creates a source that produces contents of several sources, one after the
@@ -208,6 +225,7 @@ function sink.table(t)
         if chunk then table.insert(t, chunk) end
         return 1
     end
+    native[f] = {kind = "table", t = t}
     return f, t
 end
 
@@ -225,12 +243,14 @@ end
 -- creates a file sink
 function sink.file(handle, io_err)
     if handle then
-        return function(chunk, err)
+        local f = function(chunk, err)
             if not chunk then
                 handle:close()
                 return 1
             else return handle:write(chunk) end
         end
+        native[f] = {kind = "file", handle = handle}
+        return f
     else return sink.error(io_err or "unable to open file") end
 end
 
@@ -238,6 +258,7 @@ end
 local function null()
     return 1
 end
+native[null] = {kind = "null"}
 
 function sink.null()
     return null
@@ -253,7 +274,7 @@ end
 -- chains a sink with a filter
 function sink.chain(f, snk)
     base.assert(f and snk)
-    return function(chunk, err)
+    local chain = function(chunk, err)
         if chunk ~= "" then
             local filtered = f(chunk)
             local done = chunk and ""
@@ -265,6 +286,8 @@ function sink.chain(f, snk)
             end
         else return 1 end
     end
+    native[chain] = {kind = "chain", filter = f, snk = snk}
+    return chain
 end
 
 -----------------------------------------------------------------------------
@@ -279,8 +302,13 @@ function pump.step(src, snk)
 end
 
 -- pumps all data from a source to a sink, using a step function
+-- (without one, the native pump is tried first)
 function pump.all(src, snk, step)
     base.assert(src and snk)
+    if not step and pumpall then
+        local ret, err = pumpall(src, snk, native, BLOCKSIZE)
+        if ret ~= false then return ret, err end
+    end
     step = step or pump.step
     while true do
         local ret, err = step(src, snk)
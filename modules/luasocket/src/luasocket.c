@@ -34,6 +34,8 @@
 #include "tcp.h"
 #include "udp.h"
 #include "select.h"
+#include "pump.h"
+#include "timer.h"
 
 /*-------------------------------------------------------------------------*\
 * Internal function prototypes
@@ -54,6 +56,8 @@ static const luaL_Reg mod[] = {
     {"tcp", tcp_open},
     {"udp", udp_open},
     {"select", select_open},
+    {"pump", pump_open},
+    {"timer", timer_open},
     {NULL, NULL}
 };
 
@@ -13,6 +13,16 @@
 
 #include "mime.h"
 
+/*-------------------------------------------------------------------------*\
+* On x86 with GCC-compatible compilers, Base64 blocks are handled with
+* SSSE3 when the CPU supports it. Define MIME_NO_SIMD to disable.
+\*-------------------------------------------------------------------------*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+        && !defined(MIME_NO_SIMD)
+#define MIME_SSSE3
+#include <tmmintrin.h>
+#endif
+
 /*=========================================================================*\
 * Don't want to trust escape character constants
 \*=========================================================================*/
@@ -37,6 +47,10 @@ static void b64setup(UC *base);
 static size_t b64encode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
 static size_t b64pad(const UC *input, size_t size, luaL_Buffer *buffer);
 static size_t b64decode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
+static void b64encodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer);
+static void b64decodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer);
 
 static void qpsetup(UC *class, UC *unbase);
 static void qpquote(UC c, luaL_Buffer *buffer);
@@ -44,6 +58,10 @@ static size_t qpdecode(UC c, UC *input, size_t size, luaL_Buffer *buffer);
 static size_t qpencode(UC c, UC *input, size_t size, 
         const char *marker, luaL_Buffer *buffer);
 static size_t qppad(UC *input, size_t size, luaL_Buffer *buffer);
+static void qpencodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, const char *marker, luaL_Buffer *buffer);
+static void qpdecodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer);
 
 /* code support functions */
 static luaL_Reg func[] = {
@@ -72,6 +90,9 @@ enum {QP_PLAIN, QP_QUOTED, QP_CR, QP_IF_LAST};
 static const UC b64base[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static UC b64unbase[256];
+#ifdef MIME_SSSE3
+static int b64ssse3 = 0;
+#endif
 
 /*=========================================================================*\
 * Exported functions
@@ -91,6 +112,10 @@ MIME_API int luaopen_mime_core(lua_State *L)
     /* initialize lookup tables */
     qpsetup(qpclass, qpunbase);
     b64setup(b64unbase);
+#ifdef MIME_SSSE3
+    __builtin_cpu_init();
+    b64ssse3 = __builtin_cpu_supports("ssse3");
+#endif
     return 1;
 }
 
@@ -243,6 +268,168 @@ static size_t b64decode(UC c, UC *input, size_t size,
     } else return size;
 }
 
+#ifdef MIME_SSSE3
+/*-------------------------------------------------------------------------*\
+* SSSE3 Base64 kernels, after Wojciech Mula and Alfred Klomp.
+* Encoding turns 12 bytes into 16 characters per step, decoding does the
+* reverse. Both return the number of input bytes consumed. Decoding stops
+* at the first block holding anything but the 64 alphabet characters,
+* so line breaks and padding are left to the scalar code.
+\*-------------------------------------------------------------------------*/
+__attribute__((target("ssse3")))
+static size_t b64encodessse3(const UC *input, size_t size, UC *output)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+        4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i shift = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i = 0;
+    /* we load 16 bytes but only use 12 */
+    for ( ; i + 16 <= size; i += 12, output += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (input + i));
+        __m128i t0, t1, t2, t3, index, code;
+        in = _mm_shuffle_epi8(in, shuffle);
+        t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        index = _mm_or_si128(t1, t3);
+        /* map 6-bit values to the offset of their alphabet range */
+        code = _mm_subs_epu8(index, _mm_set1_epi8(51));
+        code = _mm_or_si128(code, _mm_and_si128(
+            _mm_cmpgt_epi8(_mm_set1_epi8(26), index), _mm_set1_epi8(13)));
+        code = _mm_add_epi8(_mm_shuffle_epi8(shift, code), index);
+        _mm_storeu_si128((__m128i *) output, code);
+    }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t b64decodessse3(const UC *input, size_t size, UC *output)
+{
+    const __m128i lutlo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m128i luthi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+        0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lutroll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+        0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+        14, 13, 12, -1, -1, -1, -1);
+    const __m128i mask = _mm_set1_epi8(0x2f);
+    size_t i = 0;
+    /* we store 16 bytes but only 12 are valid */
+    for ( ; i + 16 <= size; i += 16, output += 12) {
+        __m128i in = _mm_loadu_si128((const __m128i *) (input + i));
+        __m128i hinib = _mm_and_si128(_mm_srli_epi32(in, 4), mask);
+        __m128i lonib = _mm_and_si128(in, mask);
+        __m128i hi = _mm_shuffle_epi8(luthi, hinib);
+        __m128i lo = _mm_shuffle_epi8(lutlo, lonib);
+        __m128i roll;
+        if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                _mm_setzero_si128())) != 0)
+            break;
+        roll = _mm_add_epi8(_mm_cmpeq_epi8(in, mask), hinib);
+        in = _mm_add_epi8(in, _mm_shuffle_epi8(lutroll, roll));
+        in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+        in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(in, pack));
+    }
+    return i;
+}
+#endif
+
+/*-------------------------------------------------------------------------*\
+* Encodes as many whole 3-byte atoms as there are in input, writing
+* straight into the buffer. Returns number of input bytes consumed.
+\*-------------------------------------------------------------------------*/
+static size_t b64encodeblock(const UC *input, size_t size, 
+        luaL_Buffer *buffer)
+{
+    size_t i = 0, atoms = size/3;
+    UC *code;
+    if (atoms == 0) return 0;
+    code = (UC *) luaL_prepbuffsize(buffer, 4*atoms);
+#ifdef MIME_SSSE3
+    if (b64ssse3) i = b64encodessse3(input, size, code);
+#endif
+    for ( ; i + 3 <= size; i += 3) {
+        unsigned long value = ((unsigned long) input[i] << 16) |
+            ((unsigned long) input[i+1] << 8) | input[i+2];
+        UC *c = code + i/3*4;
+        c[0] = b64base[(value >> 18) & 0x3f];
+        c[1] = b64base[(value >> 12) & 0x3f];
+        c[2] = b64base[(value >> 6) & 0x3f];
+        c[3] = b64base[value & 0x3f];
+    }
+    luaL_addsize(buffer, 4*atoms);
+    return i;
+}
+
+/*-------------------------------------------------------------------------*\
+* Decodes whole 4-character atoms for as long as they hold nothing but
+* Base64 alphabet characters, writing straight into the buffer.
+* Returns number of input bytes consumed.
+\*-------------------------------------------------------------------------*/
+static size_t b64decodeblock(const UC *input, size_t size, 
+        luaL_Buffer *buffer)
+{
+    size_t i = 0, o = 0;
+    UC *decoded;
+    if (size < 4) return 0;
+    /* SSSE3 kernel may write 4 bytes past its output */
+    decoded = (UC *) luaL_prepbuffsize(buffer, size/4*3 + 4);
+#ifdef MIME_SSSE3
+    if (b64ssse3) {
+        i = b64decodessse3(input, size, decoded);
+        o = i/4*3;
+    }
+#endif
+    for ( ; i + 4 <= size; i += 4, o += 3) {
+        UC a = b64unbase[input[i]], b = b64unbase[input[i+1]];
+        UC c = b64unbase[input[i+2]], d = b64unbase[input[i+3]];
+        unsigned long value;
+        if ((a | b | c | d) > 63 || input[i+2] == '=' || input[i+3] == '=')
+            break;
+        value = ((unsigned long) a << 18) | ((unsigned long) b << 12) |
+            ((unsigned long) c << 6) | d;
+        decoded[o] = (UC) (value >> 16);
+        decoded[o+1] = (UC) (value >> 8);
+        decoded[o+2] = (UC) value;
+    }
+    luaL_addsize(buffer, o);
+    return i;
+}
+
+/*-------------------------------------------------------------------------*\
+* Encodes a whole input range, continuing from a partial atom. Bytes are
+* fed one at a time only until the atom is empty, and then whole blocks
+* are encoded at once.
+\*-------------------------------------------------------------------------*/
+static void b64encodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer)
+{
+    while (input < last && *asize > 0)
+        *asize = b64encode(*input++, atom, *asize, buffer);
+    input += b64encodeblock(input, last - input, buffer);
+    while (input < last)
+        *asize = b64encode(*input++, atom, *asize, buffer);
+}
+
+/*-------------------------------------------------------------------------*\
+* Decodes a whole input range, continuing from a partial atom. Blocks are
+* decoded at once whenever the atom is empty. Characters that stop a
+* block (line breaks, padding, garbage) go through b64decode as before.
+\*-------------------------------------------------------------------------*/
+static void b64decodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer)
+{
+    while (input < last) {
+        if (*asize == 0) input += b64decodeblock(input, last - input, buffer);
+        if (input < last) *asize = b64decode(*input++, atom, *asize, buffer);
+    }
+}
+
 /*-------------------------------------------------------------------------*\
 * Incrementally applies the Base64 transfer content encoding to a string
 * A, B = b64(C, D)
@@ -269,8 +456,7 @@ static int mime_global_b64(lua_State *L)
     lua_settop(L, 2);
     /* process first part of the input */
     luaL_buffinit(L, &buffer);
-    while (input < last) 
-        asize = b64encode(*input++, atom, asize, &buffer);
+    b64encodeall(input, last, atom, &asize, &buffer);
     input = (UC *) luaL_optlstring(L, 2, NULL, &isize);
     /* if second part is nil, we are done */
     if (!input) {
@@ -285,8 +471,7 @@ static int mime_global_b64(lua_State *L)
     }
     /* otherwise process the second part */
     last = input + isize;
-    while (input < last) 
-        asize = b64encode(*input++, atom, asize, &buffer);
+    b64encodeall(input, last, atom, &asize, &buffer);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -315,8 +500,7 @@ static int mime_global_unb64(lua_State *L)
     lua_settop(L, 2);
     /* process first part of the input */
     luaL_buffinit(L, &buffer);
-    while (input < last) 
-        asize = b64decode(*input++, atom, asize, &buffer);
+    b64decodeall(input, last, atom, &asize, &buffer);
     input = (UC *) luaL_optlstring(L, 2, NULL, &isize);
     /* if second is nil, we are done */
     if (!input) {
@@ -330,8 +514,7 @@ static int mime_global_unb64(lua_State *L)
     }
     /* otherwise, process the rest of the input */
     last = input + isize;
-    while (input < last) 
-        asize = b64decode(*input++, atom, asize, &buffer);
+    b64decodeall(input, last, atom, &asize, &buffer);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -427,6 +610,22 @@ static size_t qpencode(UC c, UC *input, size_t size,
     return 0;
 }
 
+/*-------------------------------------------------------------------------*\
+* Encodes a whole input range. Whenever nothing is pending, runs of
+* plain characters are copied to the buffer in one go.
+\*-------------------------------------------------------------------------*/
+static void qpencodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, const char *marker, luaL_Buffer *buffer)
+{
+    while (input < last) {
+        if (*asize == 0 && qpclass[*input] == QP_PLAIN) {
+            const UC *run = input;
+            while (input < last && qpclass[*input] == QP_PLAIN) input++;
+            luaL_addlstring(buffer, (const char *) run, input - run);
+        } else *asize = qpencode(*input++, atom, *asize, marker, buffer);
+    }
+}
+
 /*-------------------------------------------------------------------------*\
 * Deal with the final characters 
 \*-------------------------------------------------------------------------*/
@@ -468,8 +667,7 @@ static int mime_global_qp(lua_State *L)
     lua_settop(L, 3);
     /* process first part of input */
     luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = qpencode(*input++, atom, asize, marker, &buffer);
+    qpencodeall(input, last, atom, &asize, marker, &buffer);
     input = (UC *) luaL_optlstring(L, 2, NULL, &isize);
     /* if second part is nil, we are done */
     if (!input) {
@@ -481,8 +679,7 @@ static int mime_global_qp(lua_State *L)
     }
     /* otherwise process rest of input */
     last = input + isize;
-    while (input < last)
-        asize = qpencode(*input++, atom, asize, marker, &buffer);
+    qpencodeall(input, last, atom, &asize, marker, &buffer);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -519,6 +716,23 @@ static size_t qpdecode(UC c, UC *input, size_t size, luaL_Buffer *buffer) {
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Decodes a whole input range. Whenever nothing is pending, runs of
+* printable characters other than '=' are copied to the buffer in one go.
+\*-------------------------------------------------------------------------*/
+#define qpliteral(c) ((c) == '\t' || ((c) > 31 && (c) < 127 && (c) != '='))
+static void qpdecodeall(const UC *input, const UC *last, UC *atom,
+        size_t *asize, luaL_Buffer *buffer)
+{
+    while (input < last) {
+        if (*asize == 0 && qpliteral(*input)) {
+            const UC *run = input;
+            while (input < last && qpliteral(*input)) input++;
+            luaL_addlstring(buffer, (const char *) run, input - run);
+        } else *asize = qpdecode(*input++, atom, *asize, buffer);
+    }
+}
+
 /*-------------------------------------------------------------------------*\
 * Incrementally decodes a string in quoted-printable
 * A, B = qp(C, D)
@@ -543,8 +757,7 @@ static int mime_global_unqp(lua_State *L)
     lua_settop(L, 2);
     /* process first part of input */
     luaL_buffinit(L, &buffer);
-    while (input < last)
-        asize = qpdecode(*input++, atom, asize, &buffer);
+    qpdecodeall(input, last, atom, &asize, &buffer);
     input = (UC *) luaL_optlstring(L, 2, NULL, &isize);
     /* if second part is nil, we are done */
     if (!input) {
@@ -555,8 +768,7 @@ static int mime_global_unqp(lua_State *L)
     } 
     /* otherwise process rest of input */
     last = input + isize;
-    while (input < last)
-        asize = qpdecode(*input++, atom, asize, &buffer);
+    qpdecodeall(input, last, atom, &asize, &buffer);
     luaL_pushresult(&buffer);
     lua_pushlstring(L, (char *) atom, asize);
     return 2;
@@ -13,6 +13,10 @@ local mime = require("mime.core")
 local string = require("string")
 module("mime")
 
+-- mime.core no longer registers itself as the global 'mime' table,
+-- so bring its functions into this module
+for name, f in base.pairs(mime) do _M[name] = f end
+
 -- encode, decode and wrap algorithm tables
 encodet = {}
 decodet = {}
@@ -0,0 +1,135 @@
+-----------------------------------------------------------------------------
+-- Pre-forking TCP server support for the Lua language.
+-- LuaSocket toolkit.
+--
+-- A supervisor process forks a fixed number of workers and restarts any
+-- worker that dies. Each worker either opens its own SO_REUSEPORT listener
+-- on the shared address, so the kernel spreads connections among them, or
+-- accepts from a single listener opened by the supervisor before forking.
+-- SIGTERM and SIGINT sent to the supervisor are forwarded to the workers.
+-- Requires luaposix.
+-----------------------------------------------------------------------------
+
+-----------------------------------------------------------------------------
+-- Declare module and import dependencies
+-----------------------------------------------------------------------------
+local socket = require("socket")
+local posix = require("posix")
+local io = require("io")
+local base = _G
+module("socket.prefork")
+
+-----------------------------------------------------------------------------
+-- Program constants
+-----------------------------------------------------------------------------
+-- number of worker processes
+WORKERS = 4
+-- backlog of each listening socket
+BACKLOG = 128
+-- workers that die younger than this many seconds are restarted only
+-- after waiting that long, so a failing handler can't fork in a loop
+MINLIFE = 1
+
+-----------------------------------------------------------------------------
+-- Listening sockets
+-----------------------------------------------------------------------------
+-- creates a socket bound to host:port, listening unless backlog is nil
+local function bind(host, port, reuseport, backlog)
+    local s
+    if base.string.find(host, ":", 1, true) then s = socket.try(socket.tcp6())
+    else s = socket.try(socket.tcp()) end
+    local try = socket.newtry(function() s:close() end)
+    try(s:setoption("reuseaddr", true))
+    if reuseport then try(s:setoption("reuseport", true)) end
+    try(s:bind(host, port))
+    if backlog then try(s:listen(backlog)) end
+    return s
+end
+
+-----------------------------------------------------------------------------
+-- Workers
+-----------------------------------------------------------------------------
+-- body of a worker process; never returns
+local function work(t, shared, index)
+    posix.signal(posix.SIGTERM, "SIG_DFL")
+    posix.signal(posix.SIGINT, "SIG_DFL")
+    local ok, err = base.pcall(function()
+        local server = shared or bind(t.host, t.port, true, t.backlog)
+        t.handler(server, index)
+    end)
+    if not ok then
+        -- errors thrown by socket.try come wrapped in a table
+        if base.type(err) == "table" then err = err[1] end
+        io.stderr:write("prefork worker ", index, ": ",
+            base.tostring(err), "\n")
+    end
+    io.stdout:flush()
+    posix._exit(ok and 0 or 1)
+end
+
+-----------------------------------------------------------------------------
+-- Supervisor
+-----------------------------------------------------------------------------
+-- runs workers until the supervisor gets SIGTERM or SIGINT. Fields of t:
+-- host, port, handler(server, index), and optionally workers, backlog,
+-- reuseport and onready(port), called once the workers are forked
+serve = socket.protect(function(t)
+    t = base.setmetatable({}, {__index = t})
+    t.host = t.host or "*"
+    if t.host == "*" then t.host = "0.0.0.0" end
+    t.workers = t.workers or WORKERS
+    t.backlog = t.backlog or BACKLOG
+    socket.try(base.type(t.handler) == "function", "handler missing")
+    socket.try(t.port, "port missing")
+    -- the supervisor always holds the address: bound but not listening
+    -- when workers bring their own listeners, so that port 0 and address
+    -- errors are resolved once, up front
+    local held
+    if t.reuseport then
+        held = bind(t.host, t.port, true)
+        local _, port = held:getsockname()
+        t.port = base.tonumber(port)
+    else held = bind(t.host, t.port, false, t.backlog) end
+    local shared = not t.reuseport and held or nil
+    local pids, born = {}, {}
+    local stopping, signalled = false, false
+    local function stop() stopping = true end
+    local oldterm = posix.signal(posix.SIGTERM, stop)
+    local oldint = posix.signal(posix.SIGINT, stop)
+    local function spawn(index)
+        io.stdout:flush()
+        local pid = posix.fork()
+        if pid == 0 then work(t, shared, index) end
+        if pid then
+            pids[pid] = index
+            born[index] = socket.timer.now()
+        end
+        return pid
+    end
+    for index = 1, t.workers do
+        if not spawn(index) then stopping = true break end
+    end
+    if t.onready then t.onready(t.port) end
+    while base.next(pids) do
+        if stopping and not signalled then
+            for pid in base.pairs(pids) do posix.kill(pid, posix.SIGTERM) end
+            signalled = true
+        end
+        -- interrupted by a signal, wait returns nil and we loop around
+        local pid = posix.wait(-1)
+        local index = pid and pids[pid]
+        if index then
+            pids[pid] = nil
+            if not stopping then
+                if socket.timer.now() - born[index] < MINLIFE then
+                    socket.sleep(MINLIFE)
+                end
+                if not stopping and not spawn(index) then stopping = true end
+            end
+        end
+    end
+    posix.signal(posix.SIGTERM, oldterm or "SIG_DFL")
+    posix.signal(posix.SIGINT, oldint or "SIG_DFL")
+    held:close()
+    return 1
+end)
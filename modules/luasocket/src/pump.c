@@ -0,0 +1,398 @@
+/*=========================================================================*\
+* Native LTN12 pump
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "auxiliar.h"
+#include "tcp.h"
+#include "pump.h"
+
+/* kinds of source and sink we can drive ourselves */
+enum {PUMP_FILE, PUMP_SOCKET, PUMP_TABLE, PUMP_NULL};
+
+/* one end of the pump */
+typedef struct t_end_ {
+    int kind;
+    int desc;               /* stack index of the description table */
+    int obj;                /* stack index of the handle, socket or table */
+    FILE *file;
+    p_tcp tcp;
+} t_end;
+
+/* one cycle filter, whose low-level C function is called directly */
+typedef struct t_filter_ {
+    int desc;               /* stack index of the cycle description */
+    int low, extra;         /* stack indices of cycle low function and extra */
+} t_filter;
+
+typedef struct t_pump_ {
+    int native;             /* stack index of the ltn12.native table */
+    t_end src, snk;
+    t_filter filter[PUMP_MAXFILTERS];
+    int n;                  /* number of filters */
+    int nsrc;               /* how many of them belong to the source */
+} t_pump;
+typedef t_pump *p_pump;
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_pumpall(lua_State *L);
+
+/* functions in library namespace */
+static luaL_Reg func[] = {
+    {"pumpall", global_pumpall},
+    {NULL, NULL}
+};
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int pump_open(lua_State *L) {
+    luaL_setfuncs(L, func, 0);
+    return 0;
+}
+
+/*=========================================================================*\
+* Planning
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Pushes the description of obj and returns its kind, or returns NULL
+* with nothing pushed if obj has no description with a kind
+\*-------------------------------------------------------------------------*/
+static const char *describe(lua_State *L, p_pump p, int obj) {
+    const char *kind;
+    luaL_checkstack(L, 8, "too many pump stages");
+    lua_pushvalue(L, obj);
+    lua_rawget(L, p->native);
+    if (!lua_istable(L, -1)) {
+        lua_pop(L, 1);
+        return NULL;
+    }
+    lua_getfield(L, -1, "kind");
+    /* the description table keeps the string alive */
+    kind = lua_tostring(L, -1);
+    lua_pop(L, kind? 1: 2);
+    return kind;
+}
+
+/*-------------------------------------------------------------------------*\
+* Adds the filter at the top of the stack to the plan. Only cycle filters
+* with a C low-level function are taken: a Lua function called from here
+* could not yield, so any other filter leaves the transfer to the Lua pump
+\*-------------------------------------------------------------------------*/
+static int addfilter(lua_State *L, p_pump p) {
+    t_filter *f;
+    const char *kind;
+    int func = lua_gettop(L);
+    if (p->n >= PUMP_MAXFILTERS || lua_isnil(L, func)) return 0;
+    kind = describe(L, p, func);
+    if (!kind || strcmp(kind, "cycle") != 0) return 0;
+    f = &p->filter[p->n++];
+    f->desc = lua_gettop(L);
+    lua_getfield(L, f->desc, "low");
+    f->low = lua_gettop(L);
+    if (!lua_iscfunction(L, f->low)) return 0;
+    lua_getfield(L, f->desc, "extra");
+    f->extra = lua_gettop(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Fills in a file or socket end from the description at the top of stack
+\*-------------------------------------------------------------------------*/
+static int setend(lua_State *L, t_end *e, const char *kind) {
+    e->desc = lua_gettop(L);
+    if (strcmp(kind, "file") == 0) {
+        luaL_Stream *stream;
+        lua_getfield(L, e->desc, "handle");
+        stream = (luaL_Stream *) luaL_testudata(L, -1, LUA_FILEHANDLE);
+        /* closed handles are left for the Lua pump to complain about */
+        if (!stream || !stream->closef) return 0;
+        e->kind = PUMP_FILE;
+        e->file = stream->f;
+    } else if (strcmp(kind, "socket") == 0) {
+        lua_getfield(L, e->desc, "sock");
+        e->tcp = (p_tcp) luaL_testudata(L, -1, "tcp{client}");
+        if (!e->tcp) return 0;
+        e->kind = PUMP_SOCKET;
+    } else if (strcmp(kind, "table") == 0) {
+        lua_getfield(L, e->desc, "t");
+        if (!lua_istable(L, -1)) return 0;
+        e->kind = PUMP_TABLE;
+    } else if (strcmp(kind, "null") == 0) {
+        lua_pushnil(L);
+        e->kind = PUMP_NULL;
+    } else return 0;
+    e->obj = lua_gettop(L);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Unwraps source.chain layers down to a file or socket source. The
+* filters are found outermost first, so they are reversed at the end.
+\*-------------------------------------------------------------------------*/
+static int plansource(lua_State *L, p_pump p, int src) {
+    int i;
+    for ( ;; ) {
+        int desc;
+        const char *kind = describe(L, p, src);
+        if (!kind) return 0;
+        if (strcmp(kind, "chain") != 0) {
+            if (strcmp(kind, "file") && strcmp(kind, "socket")) return 0;
+            if (!setend(L, &p->src, kind)) return 0;
+            break;
+        }
+        desc = lua_gettop(L);
+        lua_getfield(L, desc, "filter");
+        if (!addfilter(L, p)) return 0;
+        lua_getfield(L, desc, "src");
+        src = lua_gettop(L);
+    }
+    for (i = 0; i < p->n/2; i++) {
+        t_filter f = p->filter[i];
+        p->filter[i] = p->filter[p->n-1-i];
+        p->filter[p->n-1-i] = f;
+    }
+    p->nsrc = p->n;
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Unwraps sink.chain layers down to a file, socket, table or null sink
+\*-------------------------------------------------------------------------*/
+static int plansink(lua_State *L, p_pump p, int snk) {
+    for ( ;; ) {
+        int desc;
+        const char *kind = describe(L, p, snk);
+        if (!kind) return 0;
+        if (strcmp(kind, "chain") != 0) return setend(L, &p->snk, kind);
+        desc = lua_gettop(L);
+        lua_getfield(L, desc, "filter");
+        if (!addfilter(L, p)) return 0;
+        lua_getfield(L, desc, "snk");
+        snk = lua_gettop(L);
+    }
+}
+
+/*=========================================================================*\
+* Pumping
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Calls obj:close()
+\*-------------------------------------------------------------------------*/
+static void closeobj(lua_State *L, int obj) {
+    lua_getfield(L, obj, "close");
+    lua_pushvalue(L, obj);
+    lua_call(L, 1, 0);
+}
+
+/*-------------------------------------------------------------------------*\
+* Reads the next chunk from the source into data. Returns IO_DONE,
+* IO_CLOSED at the end of the data, or an error with its message in *err
+\*-------------------------------------------------------------------------*/
+static int readchunk(lua_State *L, p_pump p, char *data, size_t size,
+        size_t *got, const char **err) {
+    t_end *src = &p->src;
+    int ret;
+    if (src->kind == PUMP_FILE) {
+        *got = fread(data, 1, size, src->file);
+        if (*got > 0) return IO_DONE;
+        closeobj(L, src->obj);
+        return IO_CLOSED;
+    } else {
+        p_tcp tcp = src->tcp;
+        int bylength;
+        double length = 0;
+        lua_getfield(L, src->desc, "length");
+        bylength = lua_isnumber(L, -1);
+        length = lua_tonumber(L, -1);
+        lua_getfield(L, src->desc, "done");
+        ret = lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        if (ret || (bylength && length <= 0)) return IO_CLOSED;
+        if (bylength && length < size) size = (size_t) length;
+        timeout_markstart(&tcp->tm);
+        ret = buffer_recvsome(&tcp->buf, data, size, got);
+        if (ret == IO_DONE) {
+            if (bylength) {
+                lua_pushnumber(L, length - *got);
+                lua_setfield(L, src->desc, "length");
+            }
+            return IO_DONE;
+        }
+        /* until-closed sources end quietly when the peer closes */
+        if (ret == IO_CLOSED && !bylength) {
+            closeobj(L, src->obj);
+            lua_pushboolean(L, 1);
+            lua_setfield(L, src->desc, "done");
+            return IO_CLOSED;
+        }
+        *err = tcp->io.error(tcp->io.ctx, ret);
+        return ret == IO_CLOSED? IO_UNKNOWN: ret;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Writes a chunk to the sink. For table sinks, the chunk must also be at
+* the top of the stack. Returns an error message or NULL.
+\*-------------------------------------------------------------------------*/
+static const char *writechunk(lua_State *L, p_pump p, const char *data,
+        size_t count) {
+    t_end *snk = &p->snk;
+    switch (snk->kind) {
+        case PUMP_FILE:
+            if (fwrite(data, 1, count, snk->file) != count)
+                return strerror(errno);
+            break;
+        case PUMP_SOCKET: {
+            p_tcp tcp = snk->tcp;
+            size_t sent;
+            int err;
+            timeout_markstart(&tcp->tm);
+            err = buffer_send(&tcp->buf, data, count, &sent);
+            if (err != IO_DONE) return tcp->io.error(tcp->io.ctx, err);
+            break;
+        }
+        case PUMP_TABLE:
+            lua_pushvalue(L, -1);
+            lua_rawseti(L, snk->obj, (int) lua_rawlen(L, snk->obj) + 1);
+            break;
+        default:
+            break;
+    }
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Replaces the chunk at the top of the stack with the output of filter i
+\*-------------------------------------------------------------------------*/
+static void callfilter(lua_State *L, p_pump p, int i) {
+    t_filter *f = &p->filter[i];
+    lua_pushvalue(L, f->low);
+    lua_insert(L, -2);
+    lua_getfield(L, f->desc, "ctx");
+    lua_insert(L, -2);
+    lua_pushvalue(L, f->extra);
+    lua_call(L, 3, 2);
+    lua_setfield(L, f->desc, "ctx");
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes the chunk at the top of the stack (a string, or nil for the end of
+* the data) through filters i to n-1 and into the sink, and pops it.
+* Follows the source.chain and sink.chain protocol: after a non-empty
+* output the filter is called again with "" until it has nothing left, and
+* at the end it is called with nil until it returns nil.
+* Returns a sink error message or NULL.
+\*-------------------------------------------------------------------------*/
+static const char *feed(lua_State *L, p_pump p, int i) {
+    const char *err = NULL;
+    luaL_checkstack(L, 8, "too many pump stages");
+    if (i == p->n) {
+        size_t count;
+        const char *data = lua_tolstring(L, -1, &count);
+        if (data && count > 0) err = writechunk(L, p, data, count);
+        lua_pop(L, 1);
+        return err;
+    }
+    if (lua_isnil(L, -1)) {
+        for ( ;; ) {
+            lua_pushnil(L);
+            callfilter(L, p, i);
+            if (lua_isnil(L, -1)) break;
+            if ((err = feed(L, p, i+1)) != NULL) break;
+        }
+        lua_pop(L, 1);
+        return err? err: feed(L, p, i+1);
+    }
+    lua_pushvalue(L, -1);
+    callfilter(L, p, i);
+    for ( ;; ) {
+        if (lua_isnil(L, -1)) luaL_error(L, "filter returned inappropriate nil");
+        if (lua_rawlen(L, -1) == 0) break;
+        if ((err = feed(L, p, i+1)) != NULL) {
+            lua_pop(L, 1);
+            return err;
+        }
+        lua_pushliteral(L, "");
+        callfilter(L, p, i);
+    }
+    lua_pop(L, 2);
+    return NULL;
+}
+
+/*-------------------------------------------------------------------------*\
+* Lets the sink know there is no more data
+\*-------------------------------------------------------------------------*/
+static void finish(lua_State *L, p_pump p) {
+    int close = p->snk.kind == PUMP_FILE;
+    if (p->snk.kind == PUMP_SOCKET) {
+        lua_getfield(L, p->snk.desc, "close");
+        close = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+    if (close) closeobj(L, p->snk.obj);
+}
+
+/*-------------------------------------------------------------------------*\
+* Pumps all data from source to sink
+* ret, err = pumpall(src, snk, native, blocksize)
+* Returns false if the source, the sink or any filter in their chains can't
+* be handled here
+\*-------------------------------------------------------------------------*/
+static int global_pumpall(lua_State *L) {
+    t_pump pump, *p = &pump;
+    size_t size = (size_t) luaL_optnumber(L, 4, 2048);
+    char *data;
+    luaL_checktype(L, 3, LUA_TTABLE);
+    luaL_argcheck(L, size > 0, 4, "invalid block size");
+    lua_settop(L, 4);
+    memset(p, 0, sizeof(*p));
+    p->native = 3;
+    if (!plansource(L, p, 1) || !plansink(L, p, 2)) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    /* the source chain might otherwise be resumed by its Lua closure */
+    lua_pushvalue(L, 1);
+    lua_pushnil(L);
+    lua_rawset(L, p->native);
+    data = (char *) lua_newuserdata(L, size);
+    for ( ;; ) {
+        const char *err = NULL;
+        size_t got = 0;
+        int ret = readchunk(L, p, data, size, &got, &err);
+        if (ret == IO_DONE) {
+            /* unfiltered transfers need not create Lua strings */
+            if (p->n == 0 && p->snk.kind != PUMP_TABLE) {
+                err = writechunk(L, p, data, got);
+            } else {
+                lua_pushlstring(L, data, got);
+                err = feed(L, p, 0);
+            }
+        } else {
+            /* the source is done: flush what the filters still hold */
+            lua_pushnil(L);
+            if (ret == IO_CLOSED) err = feed(L, p, 0);
+            else feed(L, p, p->nsrc);
+            if (ret == IO_CLOSED && !err) {
+                finish(L, p);
+                lua_pushnumber(L, 1);
+                return 1;
+            }
+            if (ret != IO_CLOSED) finish(L, p);
+        }
+        if (err) {
+            lua_pushnil(L);
+            lua_pushstring(L, err);
+            return 2;
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef PUMP_H
+#define PUMP_H
+/*=========================================================================*\
+* Native LTN12 pump
+* LuaSocket toolkit
+*
+* ltn12.pump.all offers its source and sink to this module first. The
+* sources and sinks created by ltn12.lua and socket.lua describe
+* themselves in the ltn12.native table. When both ends of a transfer are
+* described, the whole loop runs in C with one reusable chunk buffer.
+* Anything else is handed back to the Lua pump.
+\*=========================================================================*/
+#include "lua.h"
+
+/* maximum number of filters between source and sink */
+#define PUMP_MAXFILTERS 32
+
+int pump_open(lua_State *L);
+
+#endif /* PUMP_H */
@@ -31,6 +31,22 @@
 /* we are lazy... */
 typedef struct sockaddr SA;
 
+/* one datagram in a batched send or receive */
+typedef struct t_dgram_ {
+    char *data;                 /* payload buffer */
+    size_t count;               /* buffer size (recv) or payload size (send) */
+    size_t got;                 /* number of bytes received */
+    t_sockaddr_storage addr;    /* peer address */
+    socklen_t addr_len;         /* zero sends to the connected peer */
+} t_dgram;
+typedef t_dgram *p_dgram;
+
+/* maximum number of datagrams moved by a single batched call */
+#define SOCKET_MAXBATCH 64
+
+/* bytes read per call when a file has to be copied to a socket by hand */
+#define SOCKET_FILECHUNK 16384
+
 /*=========================================================================*\
 * Functions bellow implement a comfortable platform independent 
 * interface to sockets
@@ -43,6 +59,10 @@ int socket_sendto(p_socket ps, const char *data, size_t count,
         size_t *sent, SA *addr, socklen_t addr_len, p_timeout tm);
 int socket_recvfrom(p_socket ps, char *data, size_t count, 
         size_t *got, SA *addr, socklen_t *addr_len, p_timeout tm);
+int socket_sendmany(p_socket ps, p_dgram dg, int n, int *sent, p_timeout tm);
+int socket_recvmany(p_socket ps, p_dgram dg, int n, int *got, p_timeout tm);
+int socket_sendfile(p_socket ps, int fd, double offset, size_t count,
+        size_t *sent, p_timeout tm);
 
 void socket_setnonblocking(p_socket ps);
 void socket_setblocking(p_socket ps);
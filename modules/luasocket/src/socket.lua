@@ -10,6 +10,7 @@ local base = _G
 local string = require("string")
 local math = require("math")
 local socket = require("socket.core")
+local ltn12 = require("ltn12")
 
 -----------------------------------------------------------------------------
 -- Exported auxiliar functions
@@ -81,13 +82,21 @@ end
 local sourcet = {}
 local sinkt = {}
 
-socket.sourct = sourcet
+socket.sourcet = sourcet
 socket.sinkt = sinkt
 
 socket.BLOCKSIZE = 2048
 
+-- sources and sinks describe themselves to the native ltn12 pump, and keep
+-- their state in that description so either pump can resume them
+local function describe(obj, desc)
+    desc.kind = "socket"
+    ltn12.native[obj] = desc
+    return obj
+end
+
 sinkt["close-when-done"] = function(sock)
-    return base.setmetatable({
+    return describe(base.setmetatable({
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
@@ -97,11 +106,11 @@ sinkt["close-when-done"] = function(sock)
                 return 1
             else return sock:send(chunk) end
         end
-    })
+    }), {sock = sock, close = true})
 end
 
 sinkt["keep-open"] = function(sock)
-    return base.setmetatable({
+    return describe(base.setmetatable({
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
@@ -109,51 +118,52 @@ sinkt["keep-open"] = function(sock)
             if chunk then return sock:send(chunk)
             else return 1 end
         end
-    })
+    }), {sock = sock})
 end
 
 sinkt["default"] = sinkt["keep-open"]
 
-sink = socket.choose(sinkt)
+socket.sink = socket.choose(sinkt)
 
 sourcet["by-length"] = function(sock, length)
-    return base.setmetatable({
+    local state = {sock = sock, length = length}
+    return describe(base.setmetatable({
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
         __call = function()
-            if length <= 0 then return nil end
-            local size = math.min(socket.BLOCKSIZE, length)
+            if state.length <= 0 then return nil end
+            local size = math.min(socket.BLOCKSIZE, state.length)
             local chunk, err = sock:receive(size)
             if err then return nil, err end
-            length = length - string.len(chunk)
+            state.length = state.length - string.len(chunk)
             return chunk
         end
-    })
+    }), state)
 end
 
 sourcet["until-closed"] = function(sock)
-    local done
-    return base.setmetatable({
+    local state = {sock = sock}
+    return describe(base.setmetatable({
         getfd = function() return sock:getfd() end,
         dirty = function() return sock:dirty() end
     }, {
         __call = function()
-            if done then return nil end
+            if state.done then return nil end
             local chunk, err, partial = sock:receive(socket.BLOCKSIZE)
             if not err then return chunk
             elseif err == "closed" then
                 sock:close()
-                done = 1
+                state.done = 1
                 return partial
             else return nil, err end
         end
-    })
+    }), state)
 end
 
 
 sourcet["default"] = sourcet["until-closed"]
 
-source = socket.choose(sourcet)
+socket.source = socket.choose(sourcet)
 
 return socket
@@ -2,6 +2,7 @@
 * TCP object
 * LuaSocket toolkit
 \*=========================================================================*/
+#include <stdio.h>
 #include <string.h>
 
 #include "lua.h"
@@ -24,6 +25,7 @@ static int meth_listen(lua_State *L);
 static int meth_getfamily(lua_State *L);
 static int meth_bind(lua_State *L);
 static int meth_send(lua_State *L);
+static int meth_sendfile(lua_State *L);
 static int meth_getstats(lua_State *L);
 static int meth_setstats(lua_State *L);
 static int meth_getsockname(lua_State *L);
@@ -58,6 +60,7 @@ static luaL_Reg tcp_methods[] = {
     {"listen",      meth_listen},
     {"receive",     meth_receive},
     {"send",        meth_send},
+    {"sendfile",    meth_sendfile},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
     {"setpeername", meth_connect},
@@ -71,6 +74,7 @@ static luaL_Reg tcp_methods[] = {
 static t_opt optget[] = {
     {"keepalive",   opt_get_keepalive},
     {"reuseaddr",   opt_get_reuseaddr},
+    {"reuseport",   opt_get_reuseport},
     {"tcp-nodelay", opt_get_tcp_nodelay},
     {"linger",      opt_get_linger},
     {NULL,          NULL}
@@ -79,6 +83,7 @@ static t_opt optget[] = {
 static t_opt optset[] = {
     {"keepalive",   opt_set_keepalive},
     {"reuseaddr",   opt_set_reuseaddr},
+    {"reuseport",   opt_set_reuseport},
     {"tcp-nodelay", opt_set_tcp_nodelay},
     {"ipv6-v6only", opt_set_ip6_v6only},
     {"linger",      opt_set_linger},
@@ -127,6 +132,52 @@ static int meth_receive(lua_State *L) {
     return buffer_meth_receive(L, &tcp->buf);
 }
 
+/*-------------------------------------------------------------------------*\
+* Sends length bytes of a file (a Lua file handle or a descriptor) starting
+* at offset, without bringing them into Lua. Without a length, sends until
+* the end of the file. Returns the number of bytes sent, or nil, the error
+* and the number of bytes sent, like send
+\*-------------------------------------------------------------------------*/
+static int meth_sendfile(lua_State *L) {
+    p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
+    luaL_Stream *stream = (luaL_Stream *) luaL_testudata(L, 2, LUA_FILEHANDLE);
+    double offset = luaL_optnumber(L, 3, 0);
+    double length = luaL_optnumber(L, 4, -1);
+    size_t total = 0, wanted = length < 0? (size_t) -1: (size_t) length;
+    int fd, err = IO_DONE, top = lua_gettop(L);
+    p_timeout tm = timeout_markstart(&tcp->tm);
+    if (stream) {
+        luaL_argcheck(L, stream->closef, 2, "attempt to use a closed file");
+        /* whatever was written through the handle must reach the file */
+        fflush(stream->f);
+        fd = fileno(stream->f);
+    } else fd = (int) luaL_checknumber(L, 2);
+    luaL_argcheck(L, offset >= 0, 3, "invalid offset");
+    while (total < wanted) {
+        size_t sent = 0;
+        err = socket_sendfile(&tcp->sock, fd, offset + (double) total,
+            wanted - total, &sent, tm);
+        total += sent;
+        tcp->buf.sent += sent;
+        /* nothing sent means end of file */
+        if (err != IO_DONE || sent == 0) break;
+    }
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, tcp->io.error(tcp->io.ctx, err));
+        lua_pushnumber(L, (lua_Number) total);
+    } else {
+        lua_pushnumber(L, (lua_Number) total);
+        lua_pushnil(L);
+        lua_pushnil(L);
+    }
+#ifdef LUASOCKET_DEBUG
+    /* push time elapsed during operation as the last return value */
+    lua_pushnumber(L, timeout_gettime() - timeout_getstart(tm));
+#endif
+    return lua_gettop(L) - top;
+}
+
 static int meth_getstats(lua_State *L) {
     p_tcp tcp = (p_tcp) auxiliar_checkclass(L, "tcp{client}", 1);
     return buffer_meth_getstats(L, &tcp->buf);
@@ -223,7 +274,7 @@ static int meth_bind(lua_State *L)
     bindhints.ai_family = tcp->family;
     bindhints.ai_flags = AI_PASSIVE;
     address = strcmp(address, "*")? address: NULL;
-    err = inet_trybind(&tcp->sock, address, port, &bindhints);
+    err = inet_trybind(L, &tcp->sock, address, port, &bindhints);
     if (err) {
         lua_pushnil(L);
         lua_pushstring(L, err);
@@ -248,7 +299,7 @@ static int meth_connect(lua_State *L)
     /* make sure we try to connect only to the same family */
     connecthints.ai_family = tcp->family;
     timeout_markstart(&tcp->tm);
-    err = inet_tryconnect(&tcp->sock, address, port, &tcp->tm, &connecthints);
+    err = inet_tryconnect(L, &tcp->sock, address, port, &tcp->tm, &connecthints);
     /* have to set the class even if it failed due to non-blocking connects */
     auxiliar_setclass(L, "tcp{client}", 1);
     if (err) {
@@ -388,17 +439,14 @@ static int global_create6(lua_State *L) {
     return tcp_create(L, AF_INET6);
 }
 
-static const char *tryconnect6(const char *remoteaddr, const char *remoteserv,
-    struct addrinfo *connecthints, p_tcp tcp) {
+static const char *tryconnect6(lua_State *L, const char *remoteaddr,
+    const char *remoteserv, struct addrinfo *connecthints, p_tcp tcp) {
     struct addrinfo *iterator = NULL, *resolved = NULL;
     const char *err = NULL;
     /* try resolving */
-    err = socket_gaistrerror(getaddrinfo(remoteaddr, remoteserv,
+    err = socket_gaistrerror(inet_getaddrinfo(L, remoteaddr, remoteserv,
                 connecthints, &resolved));
-    if (err != NULL) {
-        if (resolved) freeaddrinfo(resolved);
-        return err;
-    }
+    if (err != NULL) return err;
     /* iterate over all returned addresses trying to connect */
     for (iterator = resolved; iterator; iterator = iterator->ai_next) {
         p_timeout tm = timeout_markstart(&tcp->tm);
@@ -407,10 +455,7 @@ static const char *tryconnect6(const char *remoteaddr, const char *remoteserv,
             err = socket_strerror(socket_create(&tcp->sock,
                 iterator->ai_family, iterator->ai_socktype,
                 iterator->ai_protocol));
-            if (err != NULL) {
-                freeaddrinfo(resolved);
-                return err;
-            }
+            if (err != NULL) return err;
             tcp->family = iterator->ai_family;
             /* all sockets initially non-blocking */
             socket_setnonblocking(&tcp->sock);
@@ -422,8 +467,6 @@ static const char *tryconnect6(const char *remoteaddr, const char *remoteserv,
         /* if success, break out of loop */
         if (err == NULL) break;
     }
-
-    freeaddrinfo(resolved);
     /* here, if err is set, we failed */
     return err;
 }
@@ -450,7 +493,7 @@ static int global_connect(lua_State *L) {
     bindhints.ai_family = family;
     bindhints.ai_flags = AI_PASSIVE;
     if (localaddr) {
-        err = inet_trybind(&tcp->sock, localaddr, localserv, &bindhints);
+        err = inet_trybind(L, &tcp->sock, localaddr, localserv, &bindhints);
         if (err) {
             lua_pushnil(L);
             lua_pushstring(L, err);
@@ -463,7 +506,7 @@ static int global_connect(lua_State *L) {
     connecthints.ai_socktype = SOCK_STREAM;
     /* make sure we try to connect only to the same family */
     connecthints.ai_family = bindhints.ai_family;
-    err = tryconnect6(remoteaddr, remoteserv, &connecthints, tcp);
+    err = tryconnect6(L, remoteaddr, remoteserv, &connecthints, tcp);
     if (err) {
         socket_destroy(&tcp->sock);
         lua_pushnil(L);
@@ -7,3 +7,6 @@ else
 end
 os.execute (lua..' ../test/testclnt.lua')
 
+os.execute (lua..' ../test/ltn12test.lua')
+os.execute (lua..' ../test/httptest.lua')
+os.execute (lua..' ../test/preforktest.lua')
@@ -117,12 +117,36 @@ p_timeout timeout_markstart(p_timeout tm) {
 }
 
 /*-------------------------------------------------------------------------*\
-* Gets time in s, relative to January 1, 1970 (UTC) 
+* Gets time in s from an arbitrary origin, on a clock that never jumps.
+* Timeouts use this, so changes to the wall clock do not affect them
 * Returns
 *   time in s.
 \*-------------------------------------------------------------------------*/
 #ifdef _WIN32
 double timeout_gettime(void) {
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double) c.QuadPart/(double) f.QuadPart;
+}
+#else
+double timeout_gettime(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec t;
+    if (clock_gettime(CLOCK_MONOTONIC, &t) == 0)
+        return t.tv_sec + t.tv_nsec/1.0e9;
+#endif
+    return timeout_getwalltime();
+}
+#endif
+
+/*-------------------------------------------------------------------------*\
+* Gets time in s, relative to January 1, 1970 (UTC) 
+* Returns
+*   time in s.
+\*-------------------------------------------------------------------------*/
+#ifdef _WIN32
+double timeout_getwalltime(void) {
     FILETIME ft;
     double t;
     GetSystemTimeAsFileTime(&ft);
@@ -132,7 +156,7 @@ double timeout_gettime(void) {
     return (t - 11644473600.0);
 }
 #else
-double timeout_gettime(void) {
+double timeout_getwalltime(void) {
     struct timeval v;
     gettimeofday(&v, (struct timezone *) NULL);
     /* Unix Epoch time (time since January 1, 1970 (UTC)) */
@@ -176,11 +200,12 @@ int timeout_meth_settimeout(lua_State *L, p_timeout tm) {
 * Test support functions
 \*=========================================================================*/
 /*-------------------------------------------------------------------------*\
-* Returns the time the system has been up, in secconds.
+* Returns the wall-clock time in seconds. Scripts have always been able
+* to use it as a Unix timestamp, so it does not follow the monotonic clock
 \*-------------------------------------------------------------------------*/
 static int timeout_lua_gettime(lua_State *L)
 {
-    lua_pushnumber(L, timeout_gettime());
+    lua_pushnumber(L, timeout_getwalltime());
     return 1;
 }
 
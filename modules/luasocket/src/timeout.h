@@ -21,6 +21,7 @@ double timeout_getretry(p_timeout tm);
 p_timeout timeout_markstart(p_timeout tm);
 double timeout_getstart(p_timeout tm);
 double timeout_gettime(void);
+double timeout_getwalltime(void);
 int timeout_meth_settimeout(lua_State *L, p_timeout tm);
 
 #define timeout_iszero(tm)   ((tm)->block == 0.0)
@@ -0,0 +1,364 @@
+/*=========================================================================*\
+* Timer wheel
+* LuaSocket toolkit
+\*=========================================================================*/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "auxiliar.h"
+#include "timeout.h"
+#include "timer.h"
+
+/* one deadline; nodes are linked by index so the array can grow */
+typedef struct t_tnode_ {
+    int next, prev;         /* neighbours in the slot, or next free node */
+    int slot;               /* slot holding the node, -1 if not pending */
+    unsigned long gen;      /* bumped each time the node is reused */
+    unsigned long expires;  /* tick the deadline falls on */
+} t_tnode;
+typedef t_tnode *p_tnode;
+
+typedef struct t_wheel_ {
+    double origin;          /* time of tick 0 */
+    double tick;            /* seconds per tick */
+    unsigned long now;      /* last tick processed */
+    int head[TIMER_LEVELS*TIMER_SLOTS]; /* first node in each slot */
+    p_tnode node;
+    int size;               /* nodes allocated */
+    int free;               /* first free node, -1 if none */
+    int count;              /* pending deadlines */
+} t_wheel;
+typedef t_wheel *p_wheel;
+
+/*=========================================================================*\
+* Internal function prototypes
+\*=========================================================================*/
+static int global_wheel(lua_State *L);
+static int global_now(lua_State *L);
+static int meth_schedule(lua_State *L);
+static int meth_cancel(lua_State *L);
+static int meth_expire(lua_State *L);
+static int meth_timeout(lua_State *L);
+static int meth_count(lua_State *L);
+static int meth_gc(lua_State *L);
+
+/* wheel object methods */
+static luaL_Reg wheel_methods[] = {
+    {"__gc",        meth_gc},
+    {"__tostring",  auxiliar_tostring},
+    {"cancel",      meth_cancel},
+    {"count",       meth_count},
+    {"expire",      meth_expire},
+    {"schedule",    meth_schedule},
+    {"timeout",     meth_timeout},
+    {NULL,          NULL}
+};
+
+/* functions in the socket.timer namespace */
+static luaL_Reg func[] = {
+    {"wheel", global_wheel},
+    {"now",   global_now},
+    {NULL,    NULL}
+};
+
+/*-------------------------------------------------------------------------*\
+* Initializes module
+\*-------------------------------------------------------------------------*/
+int timer_open(lua_State *L) {
+    auxiliar_newclass(L, "timer{wheel}", wheel_methods);
+    lua_pushstring(L, "timer");
+    lua_newtable(L);
+    luaL_setfuncs(L, func, 0);
+    lua_settable(L, -3);
+    return 0;
+}
+
+/*=========================================================================*\
+* Wheel internals
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Finds the slot for a deadline, given the last tick processed. Deadlines
+* already due go to the next tick; deadlines beyond the last level wait in
+* its furthest slot and are placed again when that slot cascades
+\*-------------------------------------------------------------------------*/
+static int slotof(p_wheel w, unsigned long expires) {
+    unsigned long delta = expires - w->now;
+    int level;
+    if ((long) delta <= 0) return (int) ((w->now + 1) & (TIMER_SLOTS-1));
+    for (level = 0; level < TIMER_LEVELS - 1; level++)
+        if (delta < 1UL << (TIMER_BITS*(level+1))) break;
+    if (level == TIMER_LEVELS - 1 &&
+            delta >= 1UL << (TIMER_BITS*TIMER_LEVELS - 1))
+        expires = w->now + (1UL << (TIMER_BITS*TIMER_LEVELS - 1));
+    return level*TIMER_SLOTS +
+        (int) ((expires >> (TIMER_BITS*level)) & (TIMER_SLOTS-1));
+}
+
+static void wheel_link(p_wheel w, int n) {
+    p_tnode t = &w->node[n];
+    int s = slotof(w, t->expires);
+    t->slot = s;
+    t->prev = -1;
+    t->next = w->head[s];
+    if (t->next >= 0) w->node[t->next].prev = n;
+    w->head[s] = n;
+}
+
+static void wheel_unlink(p_wheel w, int n) {
+    p_tnode t = &w->node[n];
+    if (t->prev >= 0) w->node[t->prev].next = t->next;
+    else w->head[t->slot] = t->next;
+    if (t->next >= 0) w->node[t->next].prev = t->prev;
+    t->slot = -1;
+}
+
+static void release(p_wheel w, int n) {
+    w->node[n].gen++;
+    w->node[n].next = w->free;
+    w->free = n;
+    w->count--;
+}
+
+/*-------------------------------------------------------------------------*\
+* Takes a free node, growing the array if needed. Returns -1 when out
+* of memory
+\*-------------------------------------------------------------------------*/
+static int acquire(p_wheel w) {
+    int n;
+    if (w->free < 0) {
+        int i, size = w->size? 2*w->size: 64;
+        p_tnode node;
+        if (size > TIMER_MAXNODES) size = TIMER_MAXNODES;
+        if (size <= w->size) return -1;
+        node = (p_tnode) realloc(w->node, size*sizeof(t_tnode));
+        if (!node) return -1;
+        for (i = w->size; i < size; i++) {
+            node[i].gen = 0;
+            node[i].slot = -1;
+            node[i].next = i + 1 < size? i + 1: -1;
+        }
+        w->free = w->size;
+        w->node = node;
+        w->size = size;
+    }
+    n = w->free;
+    w->free = w->node[n].next;
+    w->count++;
+    return n;
+}
+
+/*-------------------------------------------------------------------------*\
+* Moves every node of a slot down to where it belongs now
+\*-------------------------------------------------------------------------*/
+static void cascade(p_wheel w, int s) {
+    int n = w->head[s];
+    w->head[s] = -1;
+    while (n >= 0) {
+        int next = w->node[n].next;
+        wheel_link(w, n);
+        n = next;
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Advances the wheel to tick, appending the values of due deadlines to
+* the table at the top of the stack. Values live in the table at index
+* values
+\*-------------------------------------------------------------------------*/
+static void advance(lua_State *L, p_wheel w, unsigned long tick, int values) {
+    int out = lua_gettop(L), k = (int) lua_rawlen(L, out);
+    while ((long) (tick - w->now) > 0) {
+        int level, n;
+        /* nothing pending: jump straight there */
+        if (w->count == 0) {
+            w->now = tick;
+            break;
+        }
+        w->now++;
+        /* refill lower levels when their index wraps around */
+        for (level = 1; level < TIMER_LEVELS; level++) {
+            unsigned long low = w->now >> (TIMER_BITS*(level-1));
+            if (low & (TIMER_SLOTS-1)) break;
+            cascade(w, level*TIMER_SLOTS + (int) ((low >> TIMER_BITS)
+                & (TIMER_SLOTS-1)));
+        }
+        /* everything in the current first level slot is due */
+        n = w->head[w->now & (TIMER_SLOTS-1)];
+        w->head[w->now & (TIMER_SLOTS-1)] = -1;
+        while (n >= 0) {
+            int next = w->node[n].next;
+            w->node[n].slot = -1;
+            lua_rawgeti(L, values, n + 1);
+            lua_rawseti(L, out, ++k);
+            lua_pushnil(L);
+            lua_rawseti(L, values, n + 1);
+            release(w, n);
+            n = next;
+        }
+    }
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the first tick at which something may be due. This is exact for
+* deadlines in the first level and a lower bound for the others, which is
+* what a poller needs
+\*-------------------------------------------------------------------------*/
+static unsigned long nextdue(p_wheel w) {
+    unsigned long best = w->now + (1UL << (TIMER_BITS*TIMER_LEVELS - 1));
+    int level, j;
+    for (j = 1; j <= TIMER_SLOTS; j++)
+        if (w->head[(w->now + j) & (TIMER_SLOTS-1)] >= 0) return w->now + j;
+    for (level = 1; level < TIMER_LEVELS; level++) {
+        unsigned long base = w->now >> (TIMER_BITS*level);
+        for (j = 1; j <= TIMER_SLOTS; j++) {
+            int s = level*TIMER_SLOTS + (int) ((base + j) & (TIMER_SLOTS-1));
+            if (w->head[s] >= 0) {
+                unsigned long t = (base + j) << (TIMER_BITS*level);
+                if ((long) (t - best) < 0) best = t;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+static unsigned long toticks(p_wheel w, double t) {
+    double ticks = ceil((t - w->origin)/w->tick);
+    return ticks > 0? (unsigned long) ticks: 0;
+}
+
+/*=========================================================================*\
+* Lua methods
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Schedules value to expire in delay seconds; returns an id for cancel
+\*-------------------------------------------------------------------------*/
+static int meth_schedule(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    double delay = luaL_checknumber(L, 2);
+    int n;
+    luaL_checkany(L, 3);
+    luaL_argcheck(L, !lua_isnil(L, 3), 3, "value expected");
+    n = acquire(w);
+    if (n < 0) {
+        lua_pushnil(L);
+        lua_pushstring(L, "out of memory");
+        return 2;
+    }
+    w->node[n].expires = toticks(w, timeout_gettime() + delay);
+    wheel_link(w, n);
+    lua_getuservalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_rawseti(L, -2, n + 1);
+    lua_pushnumber(L, (double) w->node[n].gen*TIMER_MAXNODES + n);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Cancels a pending deadline; returns true if it was still pending
+\*-------------------------------------------------------------------------*/
+static int meth_cancel(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    double id = luaL_checknumber(L, 2);
+    double gen = floor(id/TIMER_MAXNODES);
+    int n = (int) (id - gen*TIMER_MAXNODES);
+    if (id < 0 || n >= w->size || w->node[n].slot < 0 ||
+            (double) w->node[n].gen != gen) {
+        lua_pushboolean(L, 0);
+        return 1;
+    }
+    wheel_unlink(w, n);
+    release(w, n);
+    lua_getuservalue(L, 1);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, n + 1);
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns a list with the values of all deadlines due by now, grouped by
+* the tick they fell due on. The current time can be given for testing
+\*-------------------------------------------------------------------------*/
+static int meth_expire(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    double now = luaL_optnumber(L, 2, timeout_gettime());
+    double ticks = floor((now - w->origin)/w->tick);
+    lua_settop(L, 1);
+    lua_getuservalue(L, 1);
+    lua_newtable(L);
+    if (ticks > 0) advance(L, w, (unsigned long) ticks, 2);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns how many seconds a poller may wait before calling expire, or
+* nil if nothing is pending
+\*-------------------------------------------------------------------------*/
+static int meth_timeout(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    double t;
+    if (w->count == 0) {
+        lua_pushnil(L);
+        return 1;
+    }
+    t = w->origin + nextdue(w)*w->tick - timeout_gettime();
+    lua_pushnumber(L, t > 0? t: 0);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the number of pending deadlines
+\*-------------------------------------------------------------------------*/
+static int meth_count(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    lua_pushnumber(L, w->count);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Releases the node array
+\*-------------------------------------------------------------------------*/
+static int meth_gc(lua_State *L) {
+    p_wheel w = (p_wheel) auxiliar_checkclass(L, "timer{wheel}", 1);
+    free(w->node);
+    w->node = NULL;
+    w->size = w->count = 0;
+    w->free = -1;
+    return 0;
+}
+
+/*=========================================================================*\
+* Library functions
+\*=========================================================================*/
+/*-------------------------------------------------------------------------*\
+* Creates a wheel with the given tick in seconds (default 10ms)
+\*-------------------------------------------------------------------------*/
+static int global_wheel(lua_State *L) {
+    double tick = luaL_optnumber(L, 1, 0.01);
+    p_wheel w;
+    int i;
+    luaL_argcheck(L, tick > 0, 1, "tick must be positive");
+    w = (p_wheel) lua_newuserdata(L, sizeof(t_wheel));
+    memset(w, 0, sizeof(t_wheel));
+    w->origin = timeout_gettime();
+    w->tick = tick;
+    w->free = -1;
+    for (i = 0; i < TIMER_LEVELS*TIMER_SLOTS; i++) w->head[i] = -1;
+    auxiliar_setclass(L, "timer{wheel}", -1);
+    lua_newtable(L);
+    lua_setuservalue(L, -2);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Returns the monotonic time the wheels use
+\*-------------------------------------------------------------------------*/
+static int global_now(lua_State *L) {
+    lua_pushnumber(L, timeout_gettime());
+    return 1;
+}
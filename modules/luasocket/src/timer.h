@@ -0,0 +1,27 @@
+#ifndef TIMER_H
+#define TIMER_H
+/*=========================================================================*\
+* Timer wheel
+* LuaSocket toolkit
+*
+* A hierarchical timing wheel keeps any number of deadlines, each holding
+* a Lua value. Scheduling and cancelling a deadline take constant time;
+* expiring the wheel costs time proportional to the ticks elapsed and the
+* deadlines found due. Time comes from the monotonic clock behind
+* timeout_gettime, so wall-clock jumps do not move deadlines. A poller can
+* sleep for wheel:timeout() seconds and then call wheel:expire().
+\*=========================================================================*/
+#include "lua.h"
+
+/* slots per level is 2^TIMER_BITS; deadlines further than
+ * 2^(TIMER_BITS*TIMER_LEVELS) ticks away wait in the last level */
+#define TIMER_BITS 6
+#define TIMER_SLOTS (1 << TIMER_BITS)
+#define TIMER_LEVELS 4
+
+/* maximum number of pending deadlines per wheel */
+#define TIMER_MAXNODES (1 << 24)
+
+int timer_open(lua_State *L);
+
+#endif /* TIMER_H */
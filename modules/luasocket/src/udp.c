@@ -30,6 +30,8 @@ static int meth_send(lua_State *L);
 static int meth_sendto(lua_State *L);
 static int meth_receive(lua_State *L);
 static int meth_receivefrom(lua_State *L);
+static int meth_sendmany(lua_State *L);
+static int meth_receivemany(lua_State *L);
 static int meth_getfamily(lua_State *L);
 static int meth_getsockname(lua_State *L);
 static int meth_getpeername(lua_State *L);
@@ -55,7 +57,9 @@ static luaL_Reg udp_methods[] = {
     {"getsockname", meth_getsockname},
     {"receive",     meth_receive},
     {"receivefrom", meth_receivefrom},
+    {"receivemany", meth_receivemany},
     {"send",        meth_send},
+    {"sendmany",    meth_sendmany},
     {"sendto",      meth_sendto},
     {"setfd",       meth_setfd},
     {"setoption",   meth_setoption},
@@ -285,6 +289,155 @@ static int meth_receivefrom(lua_State *L) {
     return 2;
 }
 
+/*-------------------------------------------------------------------------*\
+* Fills a datagram address from an ip string and port number
+\*-------------------------------------------------------------------------*/
+static int udp_setaddr(p_udp udp, p_dgram d, const char *ip,
+        unsigned short port) {
+    memset(&d->addr, 0, sizeof(d->addr));
+    if (udp->family == PF_INET6) {
+        struct sockaddr_in6 *addr = (struct sockaddr_in6 *) &d->addr;
+        if (!inet_pton(AF_INET6, ip, &addr->sin6_addr)) return 0;
+        addr->sin6_family = AF_INET6;
+        addr->sin6_port = htons(port);
+        d->addr_len = sizeof(*addr);
+    } else {
+        struct sockaddr_in *addr = (struct sockaddr_in *) &d->addr;
+        if (!inet_pton(AF_INET, ip, &addr->sin_addr)) return 0;
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(port);
+        d->addr_len = sizeof(*addr);
+    }
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Pushes the ip string and port number of a datagram address
+\*-------------------------------------------------------------------------*/
+static int udp_pushaddr(lua_State *L, p_dgram d) {
+    char addrstr[INET6_ADDRSTRLEN];
+    unsigned short port;
+    if (d->addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *addr = (struct sockaddr_in6 *) &d->addr;
+        if (!inet_ntop(AF_INET6, &addr->sin6_addr, addrstr, sizeof(addrstr)))
+            return 0;
+        port = ntohs(addr->sin6_port);
+    } else {
+        struct sockaddr_in *addr = (struct sockaddr_in *) &d->addr;
+        if (!inet_ntop(AF_INET, &addr->sin_addr, addrstr, sizeof(addrstr)))
+            return 0;
+        port = ntohs(addr->sin_port);
+    }
+    lua_pushstring(L, addrstr);
+    lua_pushnumber(L, port);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Sends an array of datagrams. Connected sockets take an array of strings,
+* unconnected sockets an array of {data, ip, port} triples.
+\*-------------------------------------------------------------------------*/
+static int meth_sendmany(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    int connected = luaL_testudata(L, 1, "udp{connected}") != NULL;
+    p_timeout tm = &udp->tm;
+    int i, n, sent, err;
+    p_dgram dg;
+    luaL_checktype(L, 2, LUA_TTABLE);
+    n = (int) lua_rawlen(L, 2);
+    if (n == 0) {
+        lua_pushnumber(L, 0);
+        return 1;
+    }
+    dg = (p_dgram) lua_newuserdata(L, n*sizeof(t_dgram));
+    for (i = 0; i < n; i++) {
+        p_dgram d = dg + i;
+        lua_rawgeti(L, 2, i+1);
+        if (connected) {
+            if (lua_type(L, -1) != LUA_TSTRING)
+                return luaL_error(L, "datagram %d: string expected", i+1);
+            d->data = (char *) lua_tolstring(L, -1, &d->count);
+            d->addr_len = 0;
+        } else {
+            const char *ip;
+            unsigned short port;
+            if (!lua_istable(L, -1))
+                return luaL_error(L, "datagram %d: table expected", i+1);
+            lua_rawgeti(L, -1, 1);
+            lua_rawgeti(L, -2, 2);
+            lua_rawgeti(L, -3, 3);
+            d->data = (char *) lua_tolstring(L, -3, &d->count);
+            ip = lua_tostring(L, -2);
+            port = (unsigned short) lua_tonumber(L, -1);
+            if (lua_type(L, -3) != LUA_TSTRING || !ip
+                    || !udp_setaddr(udp, d, ip, port))
+                return luaL_error(L, "datagram %d: invalid data or address", i+1);
+            lua_pop(L, 3);
+        }
+        /* the array keeps the string alive while we hold its pointer */
+        lua_pop(L, 1);
+    }
+    timeout_markstart(tm);
+    err = socket_sendmany(&udp->sock, dg, n, &sent, tm);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, udp_strerror(err));
+        lua_pushnumber(L, sent);
+        return 3;
+    }
+    lua_pushnumber(L, sent);
+    return 1;
+}
+
+/*-------------------------------------------------------------------------*\
+* Receives up to n datagrams, waiting only for the first one. Connected
+* sockets return an array of strings, unconnected sockets an array of
+* {data, ip, port} triples.
+\*-------------------------------------------------------------------------*/
+static int meth_receivemany(lua_State *L) {
+    p_udp udp = (p_udp) auxiliar_checkgroup(L, "udp{any}", 1);
+    int connected = luaL_testudata(L, 1, "udp{connected}") != NULL;
+    int i, got, err, n = (int) luaL_optnumber(L, 2, SOCKET_MAXBATCH);
+    size_t count = (size_t) luaL_optnumber(L, 3, UDP_DATAGRAMSIZE);
+    p_timeout tm = &udp->tm;
+    p_dgram dg;
+    char *buffer;
+    n = MAX(1, MIN(n, SOCKET_MAXBATCH));
+    count = MIN(count, UDP_DATAGRAMSIZE);
+    dg = (p_dgram) lua_newuserdata(L, n*(sizeof(t_dgram) + count));
+    buffer = (char *) (dg + n);
+    for (i = 0; i < n; i++) {
+        dg[i].data = buffer + i*count;
+        dg[i].count = count;
+    }
+    timeout_markstart(tm);
+    err = socket_recvmany(&udp->sock, dg, n, &got, tm);
+    if (err != IO_DONE) {
+        lua_pushnil(L);
+        lua_pushstring(L, udp_strerror(err));
+        return 2;
+    }
+    lua_createtable(L, got, 0);
+    for (i = 0; i < got; i++) {
+        if (connected) {
+            lua_pushlstring(L, dg[i].data, dg[i].got);
+        } else {
+            lua_createtable(L, 3, 0);
+            lua_pushlstring(L, dg[i].data, dg[i].got);
+            lua_rawseti(L, -2, 1);
+            if (!udp_pushaddr(L, dg + i)) {
+                lua_pushnil(L);
+                lua_pushstring(L, "invalid source address");
+                return 2;
+            }
+            lua_rawseti(L, -3, 3);
+            lua_rawseti(L, -2, 2);
+        }
+        lua_rawseti(L, -2, i+1);
+    }
+    return 1;
+}
+
 /*-------------------------------------------------------------------------*\
 * Returns family as string
 \*-------------------------------------------------------------------------*/
@@ -376,7 +529,7 @@ static int meth_setpeername(lua_State *L) {
     /* make sure we try to connect only to the same family */
     connecthints.ai_family = udp->family;
     if (connecting) {
-        err = inet_tryconnect(&udp->sock, address, port, tm, &connecthints);
+        err = inet_tryconnect(L, &udp->sock, address, port, tm, &connecthints);
         if (err) {
             lua_pushnil(L);
             lua_pushstring(L, err);
@@ -417,7 +570,7 @@ static int meth_setsockname(lua_State *L) {
     bindhints.ai_socktype = SOCK_DGRAM;
     bindhints.ai_family = udp->family;
     bindhints.ai_flags = AI_PASSIVE;
-    err = inet_trybind(&udp->sock, address, port, &bindhints);
+    err = inet_trybind(L, &udp->sock, address, port, &bindhints);
     if (err) {
         lua_pushnil(L);
         lua_pushstring(L, err);
@@ -6,8 +6,14 @@
 * The penalty of calling select to avoid busy-wait is only paid when
 * the I/O call fail in the first place. 
 \*=========================================================================*/
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE     /* recvmmsg and sendmmsg */
+#endif
 #include <string.h> 
 #include <signal.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "socket.h"
 
@@ -250,6 +256,53 @@ int socket_sendto(p_socket ps, const char *data, size_t count, size_t *sent,
     return IO_UNKNOWN;
 }
 
+/*-------------------------------------------------------------------------*\
+* Sends up to count bytes of file fd starting at offset. On Linux the data
+* goes through sendfile(2) and never leaves the kernel. Elsewhere, or for
+* files sendfile can't handle, one chunk is read and sent in full.
+* Nothing is sent at the end of the file
+\*-------------------------------------------------------------------------*/
+int socket_sendfile(p_socket ps, int fd, double offset, size_t count,
+        size_t *sent, p_timeout tm)
+{
+    char data[SOCKET_FILECHUNK];
+    size_t total = 0;
+    long got;
+    int err;
+    *sent = 0;
+    /* avoid making system calls on closed sockets */
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+#ifdef __linux__
+    for ( ;; ) {
+        off_t start = (off_t) offset;
+        long put = (long) sendfile(*ps, fd, &start, count);
+        if (put >= 0) {
+            *sent = put;
+            return IO_DONE;
+        }
+        err = errno;
+        if (err == EPIPE) return IO_CLOSED;
+        if (err == EINTR) continue;
+        /* this kind of file has to be copied by hand */
+        if (err == EINVAL || err == ENOSYS) break;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_W, tm)) != IO_DONE) return err;
+    }
+#endif
+    if (count > sizeof(data)) count = sizeof(data);
+    do got = (long) pread(fd, data, count, (off_t) offset);
+    while (got < 0 && errno == EINTR);
+    if (got < 0) return errno;
+    while (total < (size_t) got) {
+        size_t put = 0;
+        err = socket_send(ps, data + total, (size_t) got - total, &put, tm);
+        total += put;
+        if (err != IO_DONE) break;
+    }
+    *sent = total;
+    return total < (size_t) got? err: IO_DONE;
+}
+
 /*-------------------------------------------------------------------------*\
 * Receive with timeout
 \*-------------------------------------------------------------------------*/
@@ -296,6 +349,118 @@ int socket_recvfrom(p_socket ps, char *data, size_t count, size_t *got,
 }
 
 
+/*-------------------------------------------------------------------------*\
+* Batched datagram I/O with timeout
+* On Linux a whole batch is moved with a single system call. Elsewhere we
+* loop over sendto/recvfrom. Either way, receiving waits only for the first
+* datagram and then takes whatever else is already queued.
+\*-------------------------------------------------------------------------*/
+#ifdef MSG_WAITFORONE
+static void setupmsgs(struct mmsghdr *msgs, struct iovec *iovs, p_dgram dg,
+        int n, int recving) {
+    int i;
+    memset(msgs, 0, n*sizeof(*msgs));
+    for (i = 0; i < n; i++) {
+        iovs[i].iov_base = dg[i].data;
+        iovs[i].iov_len = dg[i].count;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        if (recving) dg[i].addr_len = sizeof(dg[i].addr);
+        if (dg[i].addr_len > 0) {
+            msgs[i].msg_hdr.msg_name = &dg[i].addr;
+            msgs[i].msg_hdr.msg_namelen = dg[i].addr_len;
+        }
+    }
+}
+
+int socket_sendmany(p_socket ps, p_dgram dg, int n, int *sent, p_timeout tm) {
+    struct mmsghdr msgs[SOCKET_MAXBATCH];
+    struct iovec iovs[SOCKET_MAXBATCH];
+    int err;
+    *sent = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    while (*sent < n) {
+        int count = n - *sent;
+        if (count > SOCKET_MAXBATCH) count = SOCKET_MAXBATCH;
+        setupmsgs(msgs, iovs, dg + *sent, count, 0);
+        for ( ;; ) {
+            int put = sendmmsg(*ps, msgs, count, 0);
+            if (put > 0) {
+                *sent += put;
+                break;
+            }
+            err = errno;
+            if (err == EPIPE) return IO_CLOSED;
+            if (err == EINTR) continue;
+            if (err != EAGAIN) return err;
+            if ((err = socket_waitfd(ps, WAITFD_W, tm)) != IO_DONE) return err;
+        }
+    }
+    return IO_DONE;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dg, int n, int *got, p_timeout tm) {
+    struct mmsghdr msgs[SOCKET_MAXBATCH];
+    struct iovec iovs[SOCKET_MAXBATCH];
+    int err;
+    *got = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    if (n > SOCKET_MAXBATCH) n = SOCKET_MAXBATCH;
+    setupmsgs(msgs, iovs, dg, n, 1);
+    for ( ;; ) {
+        int i, taken = recvmmsg(*ps, msgs, n, MSG_WAITFORONE, NULL);
+        if (taken > 0) {
+            for (i = 0; i < taken; i++) {
+                dg[i].got = msgs[i].msg_len;
+                dg[i].addr_len = msgs[i].msg_hdr.msg_namelen;
+            }
+            *got = taken;
+            return IO_DONE;
+        }
+        err = errno;
+        if (err == EINTR) continue;
+        if (err != EAGAIN) return err;
+        if ((err = socket_waitfd(ps, WAITFD_R, tm)) != IO_DONE) return err;
+    }
+    return IO_UNKNOWN;
+}
+#else
+int socket_sendmany(p_socket ps, p_dgram dg, int n, int *sent, p_timeout tm) {
+    int err = IO_DONE;
+    *sent = 0;
+    while (*sent < n && err == IO_DONE) {
+        p_dgram d = dg + *sent;
+        size_t put;
+        if (d->addr_len > 0)
+            err = socket_sendto(ps, d->data, d->count, &put, (SA *) &d->addr,
+                d->addr_len, tm);
+        else err = socket_send(ps, d->data, d->count, &put, tm);
+        if (err == IO_DONE) (*sent)++;
+    }
+    return err;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dg, int n, int *got, p_timeout tm) {
+    t_timeout zero;
+    int err = IO_DONE;
+    *got = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    timeout_init(&zero, 0.0, -1.0);
+    while (*got < n) {
+        p_dgram d = dg + *got;
+        d->addr_len = sizeof(d->addr);
+        err = socket_recvfrom(ps, d->data, d->count, &d->got, (SA *) &d->addr,
+            &d->addr_len, *got > 0? &zero: tm);
+        /* recvfrom() of zero is an empty datagram, not a closed socket */
+        if (err == IO_CLOSED) err = IO_DONE;
+        if (err != IO_DONE) break;
+        (*got)++;
+    }
+    return *got > 0? IO_DONE: err;
+}
+#endif
+
+
 /*-------------------------------------------------------------------------*\
 * Write with timeout
 *
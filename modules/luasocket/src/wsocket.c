@@ -6,6 +6,7 @@
 * the I/O call fail in the first place. 
 \*=========================================================================*/
 #include <string.h>
+#include <io.h>
 
 #include "socket.h"
 
@@ -235,6 +236,33 @@ int socket_sendto(p_socket ps, const char *data, size_t count, size_t *sent,
     } 
 }
 
+/*-------------------------------------------------------------------------*\
+* Sends up to count bytes of file fd starting at offset, one chunk at a
+* time. Nothing is sent at the end of the file
+\*-------------------------------------------------------------------------*/
+int socket_sendfile(p_socket ps, int fd, double offset, size_t count,
+        size_t *sent, p_timeout tm)
+{
+    char data[SOCKET_FILECHUNK];
+    size_t total = 0;
+    int got, err = IO_DONE;
+    *sent = 0;
+    /* avoid making system calls on closed sockets */
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    if (count > sizeof(data)) count = sizeof(data);
+    if (_lseeki64(fd, (__int64) offset, SEEK_SET) < 0) return errno;
+    got = _read(fd, data, (unsigned int) count);
+    if (got < 0) return errno;
+    while (total < (size_t) got) {
+        size_t put = 0;
+        err = socket_send(ps, data + total, (size_t) got - total, &put, tm);
+        total += put;
+        if (err != IO_DONE) break;
+    }
+    *sent = total;
+    return total < (size_t) got? err: IO_DONE;
+}
+
 /*-------------------------------------------------------------------------*\
 * Receive with timeout
 \*-------------------------------------------------------------------------*/
@@ -276,6 +304,45 @@ int socket_recvfrom(p_socket ps, char *data, size_t count, size_t *got,
     }
 }
 
+/*-------------------------------------------------------------------------*\
+* Batched datagram I/O with timeout
+* WinSock has no batched calls, so we loop over sendto/recvfrom. Receiving
+* waits only for the first datagram and then takes whatever is queued.
+\*-------------------------------------------------------------------------*/
+int socket_sendmany(p_socket ps, p_dgram dg, int n, int *sent, p_timeout tm) {
+    int err = IO_DONE;
+    *sent = 0;
+    while (*sent < n && err == IO_DONE) {
+        p_dgram d = dg + *sent;
+        size_t put;
+        if (d->addr_len > 0)
+            err = socket_sendto(ps, d->data, d->count, &put, (SA *) &d->addr,
+                d->addr_len, tm);
+        else err = socket_send(ps, d->data, d->count, &put, tm);
+        if (err == IO_DONE) (*sent)++;
+    }
+    return err;
+}
+
+int socket_recvmany(p_socket ps, p_dgram dg, int n, int *got, p_timeout tm) {
+    t_timeout zero;
+    int err = IO_DONE;
+    *got = 0;
+    if (*ps == SOCKET_INVALID) return IO_CLOSED;
+    timeout_init(&zero, 0.0, -1.0);
+    while (*got < n) {
+        p_dgram d = dg + *got;
+        d->addr_len = sizeof(d->addr);
+        err = socket_recvfrom(ps, d->data, d->count, &d->got, (SA *) &d->addr,
+            &d->addr_len, *got > 0? &zero: tm);
+        /* recvfrom() of zero is an empty datagram, not a closed socket */
+        if (err == IO_CLOSED) err = IO_DONE;
+        if (err != IO_DONE) break;
+        (*got)++;
+    }
+    return *got > 0? IO_DONE: err;
+}
+
 /*-------------------------------------------------------------------------*\
 * Put socket into blocking mode
 \*-------------------------------------------------------------------------*/
@@ -0,0 +1,173 @@
+-- checks the keep-alive connection pool of socket.http against a
+-- loopback server started as a separate process
+local socket = require("socket")
+local http = require("socket.http")
+local ltn12 = require("ltn12")
+
+local host, port = "127.0.0.1", 8384
+
+local function check(cond, msg)
+    if not cond then
+        io.stderr:write("ERROR: ", msg, "!\n")
+        os.exit(1)
+    end
+end
+
+-----------------------------------------------------------------------------
+-- Server side
+-----------------------------------------------------------------------------
+local function reply(c, status, headers, body)
+    local t = { "HTTP/1.1 " .. status .. "\r\n" }
+    for i, v in ipairs(headers) do t[#t+1] = v .. "\r\n" end
+    t[#t+1] = "\r\n"
+    t[#t+1] = body or ""
+    c:send(table.concat(t))
+end
+
+local function serve()
+    local server = assert(socket.bind(host, port))
+    local clients = {}
+    local doomed = {}
+    local accepted = 0
+    while true do
+        -- give up if the client goes away without saying so
+        local readable = socket.select({server,
+            (table.unpack or unpack)(clients)}, nil, 10)
+        if not readable[1] then return end
+        for _, c in ipairs(readable) do
+            if c == server then
+                local client = server:accept()
+                if client then
+                    accepted = accepted + 1
+                    clients[#clients+1] = client
+                end
+            else
+                local keep = true
+                local line = c:receive()
+                local path = line and string.match(line, "^%u+ (%S+)")
+                -- skip request headers
+                while line and line ~= "" do line = c:receive() end
+                if not path or doomed[c] then keep = false
+                elseif path == "/length" then
+                    reply(c, "200 OK", {"Content-Length: 5"}, "hello")
+                elseif path == "/chunked" then
+                    reply(c, "200 OK", {"Transfer-Encoding: chunked"},
+                        "3\r\nhel\r\n2;ext=1\r\nlo\r\n0\r\nX-Trailer: yes\r\n\r\n")
+                elseif path == "/empty" then
+                    reply(c, "204 No Content", {})
+                elseif path == "/close" then
+                    reply(c, "200 OK", {"Connection: close"}, "bye")
+                    keep = false
+                elseif path == "/drop" then
+                    -- answers as if it would keep the connection, then drops it
+                    reply(c, "200 OK", {"Content-Length: 4"}, "drop")
+                    keep = false
+                elseif path == "/linger" then
+                    -- keeps the connection, but hangs up on the next
+                    -- request without answering it
+                    reply(c, "200 OK", {"Content-Length: 6"}, "linger")
+                    doomed[c] = true
+                elseif path == "/count" then
+                    local n = tostring(accepted)
+                    reply(c, "200 OK", {"Content-Length: " .. #n}, n)
+                elseif path == "/quit" then
+                    reply(c, "200 OK", {"Content-Length: 0"})
+                    return
+                end
+                if not keep then
+                    doomed[c] = nil
+                    c:close()
+                    for i, v in ipairs(clients) do
+                        if v == c then table.remove(clients, i) break end
+                    end
+                end
+            end
+        end
+    end
+end
+
+if arg[1] == "server" then return serve() end
+
+-----------------------------------------------------------------------------
+-- Client side
+-----------------------------------------------------------------------------
+os.execute(arg[-1] .. " " .. arg[0] .. " server &")
+-- wait for the server to come up
+for i = 1, 50 do
+    local c = socket.connect(host, port)
+    if c then c:close() break end
+    socket.sleep(0.1)
+end
+-- that probe counts as one connection
+local probes = 1
+
+local base = "http://" .. host .. ":" .. port
+
+local function get(path, keepalive, method)
+    local t = {}
+    local r, code, headers = http.request {
+        url = base .. path,
+        sink = ltn12.sink.table(t),
+        keepalive = keepalive,
+        method = method
+    }
+    check(r, "request for " .. path .. " failed: " .. tostring(code))
+    return table.concat(t), code, headers
+end
+
+local function count()
+    return tonumber((get("/count", true))) - probes
+end
+
+io.stderr:write("testing keep-alive reuse: ")
+http.closeidle()
+check(get("/length", true) == "hello", "content-length body mismatch")
+local body, code, headers = get("/chunked", true)
+check(body == "hello", "chunked body mismatch")
+check(headers["x-trailer"] == "yes", "chunked trailers lost")
+local _, code = get("/empty", true)
+check(code == 204, "wrong code for empty reply")
+check(get("/length", true) == "hello", "reused connection mismatch")
+check(count() == 1, "connection was not reused")
+print("ok")
+
+io.stderr:write("testing connections that can't be reused: ")
+check(get("/close", true) == "bye", "close body mismatch")
+check(count() == 2, "closed connection should not be pooled")
+check(get("/length") == "hello", "non keep-alive request failed")
+check(count() == 3, "keep-alive is opt-in")
+print("ok")
+
+io.stderr:write("testing stale connections: ")
+check(get("/drop", true) == "drop", "drop body mismatch")
+check(get("/length", true) == "hello", "request after drop failed")
+check(count() == 4, "dropped connection was reused")
+print("ok")
+
+io.stderr:write("testing retries after a hang-up: ")
+check(get("/linger", true) == "linger", "linger body mismatch")
+check(get("/length", true) == "hello", "idempotent request was not retried")
+check(count() == 5, "retry did not open a new connection")
+check(get("/linger", true) == "linger", "linger body mismatch")
+local r, err = http.request {
+    url = base .. "/length",
+    method = "POST",
+    keepalive = true
+}
+check(r == nil and err == "closed", "non-idempotent request was retried")
+check(count() == 6, "hang-up was not on a reused connection")
+print("ok")
+
+io.stderr:write("testing idle timeout and pool size: ")
+http.IDLETIMEOUT = 0
+check(get("/length", true) == "hello", "request failed")
+http.IDLETIMEOUT = 30
+check(count() == 7, "expired connection was reused")
+http.POOLSIZE = 0
+check(get("/length", true) == "hello", "request failed")
+http.POOLSIZE = 16
+check(count() == 8, "connection pooled past POOLSIZE")
+print("ok")
+
+get("/quit", true)
+http.closeidle()
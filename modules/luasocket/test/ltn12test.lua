@@ -0,0 +1,124 @@
+-- checks that the native ltn12 pump gives the same results as the Lua one
+local socket = require("socket")
+local ltn12 = require("ltn12")
+local mime = require("mime")
+
+local function check(cond, msg)
+    if not cond then
+        io.stderr:write("ERROR: ", msg, "!\n")
+        os.exit(1)
+    end
+end
+
+local function tmpfile(data)
+    local name = os.tmpname()
+    if data then
+        local f = io.open(name, "wb")
+        f:write(data)
+        f:close()
+    end
+    return name
+end
+
+local function readall(name)
+    local f = io.open(name, "rb")
+    local s = f:read("*a")
+    f:close()
+    return s
+end
+
+local parts = {}
+for i = 1, 20000 do parts[i] = string.char(i % 256) .. "line " .. i .. "\n" end
+local data = table.concat(parts)
+local input = tmpfile(data)
+
+-- runs the same transfer through both pumps
+local function both(make)
+    local t1, t2 = {}, {}
+    local src, snk = make(t1)
+    check(ltn12.pump.all(src, snk), "native pump failed")
+    src, snk = make(t2)
+    check(ltn12.pump.all(src, snk, ltn12.pump.step), "Lua pump failed")
+    return table.concat(t1), table.concat(t2)
+end
+
+io.write("testing file source into table sink: ")
+local a, b = both(function(t)
+    return ltn12.source.file(io.open(input, "rb")), ltn12.sink.table(t)
+end)
+check(a == data and b == data, "file to table mismatch")
+print("ok")
+
+io.write("testing filter chains on both ends: ")
+a, b = both(function(t)
+    local src = ltn12.source.chain(ltn12.source.file(io.open(input, "rb")),
+        mime.normalize())
+    src = ltn12.source.chain(src, mime.encode("base64"))
+    return src, ltn12.sink.chain(mime.wrap("base64"), ltn12.sink.table(t))
+end)
+check(a == b and #a > #data, "filtered transfer mismatch")
+a, b = both(function(t)
+    local src = ltn12.source.chain(ltn12.source.file(io.open(input, "rb")),
+        ltn12.filter.chain(mime.encode("quoted-printable"), mime.wrap("quoted-printable")))
+    return src, ltn12.sink.chain(function(chunk) return chunk and chunk:upper() end,
+        ltn12.sink.table(t))
+end)
+check(a == b, "opaque filter mismatch")
+print("ok")
+
+io.write("testing filters that yield: ")
+local yields = 0
+local co = coroutine.wrap(function()
+    local t = {}
+    local src = ltn12.source.chain(ltn12.source.file(io.open(input, "rb")),
+        function(chunk) coroutine.yield() return chunk end)
+    check(ltn12.pump.all(src, (ltn12.sink.table(t))), "yielding pump failed")
+    return table.concat(t)
+end)
+local out = co()
+while not out do
+    yields = yields + 1
+    out = co()
+end
+check(out == data and yields > 1, "yielding filter mismatch")
+print("ok")
+
+io.write("testing file to file: ")
+local output = tmpfile()
+check(ltn12.pump.all(
+    ltn12.source.chain(ltn12.source.file(io.open(input, "rb")), mime.encode("base64")),
+    ltn12.sink.chain(mime.decode("base64"), ltn12.sink.file(io.open(output, "wb")))),
+    "file to file failed")
+check(readall(output) == data, "file round trip mismatch")
+print("ok")
+
+io.write("testing file to socket to file: ")
+local server = assert(socket.bind("127.0.0.1", 0))
+local ip, port = server:getsockname()
+local client = assert(socket.connect(ip, port))
+local peer = assert(server:accept())
+check(ltn12.pump.all(ltn12.source.file(io.open(input, "rb")),
+    socket.sink("close-when-done", client)), "file to socket failed")
+check(ltn12.pump.all(socket.source("until-closed", peer),
+    ltn12.sink.file(io.open(output, "wb"))), "socket to file failed")
+check(readall(output) == data, "socket transfer mismatch")
+client = assert(socket.connect(ip, port))
+peer = assert(server:accept())
+client:send(data)
+local t = {}
+-- read part of it through the Lua source first, then let the pump resume
+local src = socket.source("by-length", peer, 1000)
+check(src() == data:sub(1, 1000), "partial read mismatch")
+src = socket.source("by-length", peer, #data - 1000)
+check(ltn12.pump.all(src, (ltn12.sink.table(t))), "by-length failed")
+check(table.concat(t) == data:sub(1001), "by-length mismatch")
+check(src() == nil, "source should be exhausted")
+client:close()
+local r, e = ltn12.pump.all(socket.source("by-length", peer, 10), (ltn12.sink.table({})))
+check(not r and e == "closed", "should have reported closed")
+peer:close()
+server:close()
+print("ok")
+
+os.remove(input)
+os.remove(output)
@@ -0,0 +1,64 @@
+-- checks the block Base64 and quoted-printable paths of mime.core
+-- against the byte-at-a-time streaming filters
+local mime = require("mime")
+local ltn12 = require("ltn12")
+
+math.randomseed(os.time())
+
+local function random(size, alphabet)
+    local t = {}
+    for i = 1, size do
+        if alphabet then
+            local j = math.random(#alphabet)
+            t[i] = alphabet:sub(j, j)
+        else t[i] = string.char(math.random(0, 255)) end
+    end
+    return table.concat(t)
+end
+
+-- runs a filter over input split into chunks of at most 'size' bytes
+local function stream(filter, input, size)
+    local out = {}
+    local pos = 1
+    local source = function()
+        if pos > #input then return nil end
+        local chunk = input:sub(pos, pos + math.random(size) - 1)
+        pos = pos + #chunk
+        return chunk
+    end
+    ltn12.pump.all(ltn12.source.chain(source, filter), (ltn12.sink.table(out)))
+    return table.concat(out)
+end
+
+io.write("testing base64 round trip: ")
+for i = 0, 200 do
+    local s = random(i*7)
+    local e = mime.b64(s) or ""
+    assert(#e == math.ceil(#s/3)*4, "bad encoded size")
+    assert(e == stream(mime.encode("base64"), s, 5), "block and stream differ")
+    assert((mime.unb64(e) or "") == s, "round trip failed")
+    local w = stream(mime.wrap("base64"), e, 50)
+    assert(stream(mime.decode("base64"), w, 7) == s, "wrapped decode failed")
+end
+print("ok")
+
+io.write("testing base64 with garbage: ")
+local known = "SGVsbG8sIFdvcmxkIQ=="
+assert(mime.unb64(known) == "Hello, World!")
+assert(mime.unb64(" SGVs\r\nbG8s*IFdv cmxk\0IQ==") == "Hello, World!")
+local a, b = mime.unb64(known:sub(1, 15), known:sub(16, 18))
+assert(a == "Hello, World" and b == "IQ", "bad partial decode")
+print("ok")
+
+io.write("testing quoted-printable round trip: ")
+for i = 0, 200 do
+    local s = random(i*5, "abc xyz\t=\r\n.,!\0\255")
+    local q = mime.qp(s) or ""
+    assert(q == stream(mime.encode("quoted-printable"), s, 5),
+        "block and stream differ")
+    assert(stream(mime.decode("quoted-printable"), q, 3) ==
+        stream(mime.decode("quoted-printable"), q, 1000),
+        "decode depends on chunking")
+end
+assert(mime.unqp("caf=C3=A9 =\r\nbar") == "caf\195\169 bar")
+print("ok")
@@ -0,0 +1,89 @@
+-- checks socket.prefork: workers answer on a shared port, dead workers
+-- are replaced and SIGTERM to the supervisor stops them all
+local ok, posix = pcall(require, "posix")
+if not ok then
+    print("posix not available, skipping prefork test")
+    return
+end
+local socket = require("socket")
+local prefork = require("socket.prefork")
+
+local host = "127.0.0.1"
+
+local function check(cond, msg)
+    if not cond then
+        io.stderr:write("ERROR: ", msg, "!\n")
+        os.exit(1)
+    end
+end
+
+-- answers each request line with the worker pid; "quit" also ends it
+local function handler(server)
+    local pid = posix.getpid("pid")
+    while true do
+        local c = server:accept()
+        if c then
+            local line = c:receive()
+            c:send(pid .. "\n")
+            c:close()
+            if line == "quit" then return end
+        end
+    end
+end
+
+local function ask(port, what)
+    local c = socket.connect(host, port)
+    if not c then return nil end
+    c:send(what .. "\n")
+    local pid = c:receive()
+    c:close()
+    return tonumber(pid)
+end
+
+local function run(port, reuseport)
+    local supervisor = posix.fork()
+    if supervisor == 0 then
+        prefork.MINLIFE = 0
+        local ok, err = prefork.serve{host = host, port = port, workers = 3,
+            reuseport = reuseport, handler = handler}
+        if not ok then io.stderr:write(err, "\n") end
+        posix._exit(ok and 0 or 1)
+    end
+    -- wait for the workers to come up
+    for i = 1, 50 do
+        if ask(port, "pid") then break end
+        socket.sleep(0.1)
+    end
+    local seen, n = {}, 0
+    for i = 1, 30 do
+        local pid = ask(port, "pid")
+        check(pid, "worker did not answer")
+        if not seen[pid] then seen[pid], n = true, n + 1 end
+    end
+    check(n >= 1 and n <= 3, "unexpected number of workers")
+    -- a worker that exits is replaced by a new process
+    local gone = ask(port, "quit")
+    check(gone, "worker did not answer quit")
+    local fresh
+    for i = 1, 100 do
+        local pid = ask(port, "pid")
+        check(pid ~= gone, "exited worker still answers")
+        if pid and not seen[pid] then fresh = pid break end
+        socket.sleep(0.01)
+    end
+    check(fresh, "exited worker was not replaced")
+    -- SIGTERM stops the supervisor and its workers
+    posix.kill(supervisor, posix.SIGTERM)
+    local pid, how, status = posix.wait(supervisor)
+    check(pid == supervisor and how == "exited" and status == 0,
+        "supervisor did not exit cleanly")
+    check(not socket.connect(host, port), "workers survived the supervisor")
+end
+
+io.stderr:write("testing prefork with SO_REUSEPORT: ")
+run(8385, true)
+print("ok")
+
+io.stderr:write("testing prefork with a shared listener: ")
+run(8386, false)
+print("ok")
@@ -565,6 +565,180 @@ function test_readafterclose()
     print("ok")
 end
 
+------------------------------------------------------------------------
+function test_udpmany()
+    local server = assert(socket.udp())
+    assert(server:setsockname("127.0.0.1", 0))
+    local ip, p = server:getsockname()
+    local client = assert(socket.udp())
+    server:settimeout(1)
+    client:settimeout(1)
+    local list = {}
+    for i = 1, 100 do list[i] = {tostring(i), ip, p} end
+    list[50][1] = ""
+    assert(client:sendmany(list) == 100, "not all datagrams sent")
+    local got = {}
+    while #got < 100 do
+        local batch, err = server:receivemany(32)
+        assert(batch, err)
+        assert(#batch >= 1 and #batch <= 32, "bad batch size")
+        for _, d in ipairs(batch) do got[#got+1] = d end
+    end
+    for i = 1, 100 do
+        assert(got[i][1] == list[i][1], "datagram out of order or corrupted")
+        assert(got[i][2] == "127.0.0.1", "bad source address")
+    end
+    -- echo the triples straight back, then use the connected form
+    local cip, cp = client:getsockname()
+    for i = 1, 3 do got[i][2], got[i][3] = "127.0.0.1", cp end
+    assert(server:sendmany({got[1], got[2], got[3]}) == 3)
+    assert(client:setpeername(ip, p))
+    local back = assert(client:receivemany(10))
+    assert(#back >= 1 and back[1] == "1", "connected receive failed")
+    assert(client:sendmany({"a", "b"}) == 2)
+    back = assert(server:receivemany(10, 1))
+    assert(back[1][1] == "a", "truncation failed")
+    server:settimeout(0.1)
+    while #back < 2 do back[#back+1] = assert(server:receivemany())[1] end
+    local r, e = server:receivemany()
+    assert(not r and e == "timeout", "should have timed out")
+    server:close()
+    client:close()
+    print("ok")
+end
+
+------------------------------------------------------------------------
+function test_sendfile()
+    local parts = {}
+    for i = 1, 30000 do parts[i] = i .. "\n" end
+    local data = table.concat(parts)
+    local name = os.tmpname()
+    local f = assert(io.open(name, "w+b"))
+    f:write(data)
+    local server = assert(socket.bind("127.0.0.1", 0))
+    local ip, port = server:getsockname()
+    local client = assert(socket.connect(ip, port))
+    local peer = assert(server:accept())
+    -- the handle has unflushed data, which sendfile must see
+    assert(client:sendfile(f) == #data, "whole file not sent")
+    assert(peer:receive(#data) == data, "whole file mismatch")
+    assert(client:sendfile(f, 100, 1000) == 1000, "range not sent")
+    assert(peer:receive(1000) == data:sub(101, 1100), "range mismatch")
+    assert(client:sendfile(f, #data - 10, 1000) == 10, "tail not sent")
+    assert(peer:receive(10) == data:sub(-10), "tail mismatch")
+    assert(client:sendfile(f, #data + 10) == 0, "past end should send nothing")
+    -- the file position is left alone
+    f:seek("set", 5)
+    client:sendfile(f, 0, 5)
+    assert(f:read(3) == data:sub(6, 8), "file position moved")
+    peer:receive(5)
+    -- a peer that does not read makes us time out with partial progress
+    f:seek("end")
+    for i = 1, 60 do f:write(data) end
+    client:settimeout(0.1)
+    local r, e, sent = client:sendfile(f)
+    assert(not r and e == "timeout" and sent > 0, "should have timed out")
+    local _, s = client:getstats()
+    assert(s >= #data + 1015 + sent, "stats not updated")
+    client:close()
+    peer:close()
+    server:close()
+    f:close()
+    local ok = pcall(client.sendfile, assert(socket.tcp()), f)
+    assert(not ok, "closed file accepted")
+    os.remove(name)
+    print("ok")
+end
+
+------------------------------------------------------------------------
+function test_dnscache()
+    local dns = socket.dns
+    local stats = dns.getcachestats
+    assert(dns.setcache(8, 0.5, 0.5))
+    local h, m, n = stats()
+    assert(n == 0, "setcache should flush")
+    local ip = assert(dns.toip("localhost"))
+    assert(dns.toip("localhost") == ip, "cached answer differs")
+    local h2, m2 = stats()
+    assert(h2 == h + 1 and m2 == m + 1, "toip was not cached")
+    -- failures are cached too
+    local r1, e1 = dns.toip("host.is.invalid")
+    local r2, e2 = dns.toip("host.is.invalid")
+    assert(not r1 and not r2 and e1 == e2, "negative answer differs")
+    -- connect goes through the cache
+    h, m = stats()
+    socket.connect("localhost", 1)
+    socket.connect("localhost", 1)
+    h2, m2, n = stats()
+    assert(h2 == h + 1 and m2 == m + 1, "connect was not cached")
+    assert(n == 3, "wrong number of entries")
+    -- other ports share the entry
+    socket.connect("localhost", 2)
+    h, m, n = stats()
+    assert(h == h2 + 1 and m == m2 and n == 3, "port is part of the key")
+    -- numeric addresses never reach the cache
+    assert(dns.getaddrinfo("127.0.0.1"))
+    assert(dns.toip("127.0.0.1"))
+    assert(select(3, stats()) == 3, "numeric address was cached")
+    -- entries expire
+    socket.sleep(0.6)
+    h, m = stats()
+    dns.toip("localhost")
+    h2, m2 = stats()
+    assert(h2 == h and m2 == m + 1, "expired entry was used")
+    -- the size is bounded
+    assert(dns.setcache(1))
+    dns.toip("localhost")
+    dns.toip("host.is.invalid")
+    assert(select(3, stats()) == 1, "cache grew past its size")
+    assert(dns.flushcache())
+    assert(select(3, stats()) == 0, "flush left entries behind")
+    assert(dns.setcache(256, 30, 5))
+    print("ok")
+end
+
+------------------------------------------------------------------------
+function test_timerwheel()
+    local timer = socket.timer
+    local tick = 0.001
+    local w = timer.wheel(tick)
+    assert(w:timeout() == nil, "empty wheel should not ask for a timeout")
+    local id = w:schedule(0.5, "first")
+    local t = w:timeout()
+    assert(t > 0.4 and t <= 0.5, "bad timeout " .. tostring(t))
+    assert(w:cancel(id) and not w:cancel(id), "cancel should work once")
+    assert(w:count() == 0)
+    -- spread deadlines over every level, including past the last one
+    math.randomseed(1)
+    local start, deadline, fired, ids = timer.now(), {}, {}, {}
+    for i = 1, 20000 do
+        local delay = math.random()^3 * 20000
+        local before = timer.now()
+        ids[i] = w:schedule(delay, i)
+        deadline[i] = {before + delay, timer.now() + delay}
+    end
+    for i = 3, 20000, 3 do assert(w:cancel(ids[i]), "cancel failed") end
+    assert(w:count() == 20000 - 6666, "wrong count")
+    local prev = start
+    local now = start
+    while w:count() > 0 do
+        now = now + math.random() * 100
+        assert(w:timeout() >= 0)
+        for _, i in ipairs(w:expire(now)) do
+            assert(i % 3 ~= 0, "cancelled deadline fired")
+            assert(not fired[i], "deadline fired twice")
+            fired[i] = true
+            assert(deadline[i][1] <= now, "deadline fired early")
+            assert(deadline[i][2] + tick > prev, "deadline fired late")
+        end
+        prev = now
+    end
+    for i = 1, 20000 do
+        assert(fired[i] or i % 3 == 0, "deadline never fired")
+    end
+    print("ok")
+end
+
 test("method registration")
 test_methods(socket.tcp(), {
     "accept",
@@ -580,6 +754,7 @@ test_methods(socket.tcp(), {
     "listen",
     "receive",
     "send",
+    "sendfile",
     "setfd",
     "setoption",
     "setpeername",
@@ -597,7 +772,9 @@ test_methods(socket.udp(), {
     "getsockname",
     "receive",
     "receivefrom",
+    "receivemany",
     "send",
+    "sendmany",
     "sendto",
     "setfd",
     "setoption",
@@ -633,6 +810,18 @@ accept_errors()
 test("getstats test")
 getstats_test()
 
+test("batched udp")
+test_udpmany()
+
+test("sendfile")
+test_sendfile()
+
+test("resolver cache")
+test_dnscache()
+
+test("timer wheel")
+test_timerwheel()
+
 test("character line")
 test_asciiline(1)
 test_asciiline(17)